@@ -5,6 +5,7 @@
 #include <cmath>
 
 #include "TextEditor.h"
+#include "profiler.h"
 
 #define IMGUI_DEFINE_MATH_OPERATORS
 #include "imgui.h" // for imGui::GetCurrentWindow()
@@ -42,6 +43,24 @@ TextEditor::TextEditor()
 	, mColorRangeMax(0)
 	, mSelectionMode(SelectionMode::Normal)
 	, mCheckComments(true)
+	, mCommentRangeMin(0)
+	, mCommentRangeMax(0)
+	, mColorizerQuit(false)
+	, mColorizeJobId(0)
+	, mColorizeJobMin(std::numeric_limits<int>::max())
+	, mColorizeJobMax(0)
+	, mColorizeJobLineCount(0)
+	, mColorizeJobEditLine(std::numeric_limits<int>::max())
+	, mFont(nullptr)
+	, mFontSize(0.0f)
+	, mSpaceSize(0.0f)
+	, mLineWidthsStale(true)
+	, mLongestLine(0.0f)
+	, mLongestLineIndex(0)
+	, mLineWidthsDirtyMin(0)
+	, mLineWidthsDirtyMax(0)
+	, mDocumentVersion(1)
+	, mTextSnapshotVersion(0)
 	, mLastClick(-1.0f)
 	, mHandleKeyboardInputs(true)
 	, mHandleMouseInputs(true)
@@ -49,13 +68,22 @@ TextEditor::TextEditor()
 	, mShowWhitespaces(true)
 	, mStartTime(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count())
 {
+	mLineStates.push_back(LineState());
+	mLineWidths.push_back(-1.0f);
 	SetPalette(GetCC29Palette());
 	SetLanguageDefinition(LanguageDefinition::HLSL());
-	mLines.push_back(Line());
+	mAsciiAdvance.fill(0.0f);
 }
 
 TextEditor::~TextEditor()
 {
+	{
+		std::lock_guard<std::mutex> lock(mColorizerMutex);
+		mColorizerQuit = true;
+	}
+	mColorizerSignal.notify_one();
+	if (mColorizerThread.joinable())
+		mColorizerThread.join();
 }
 
 void TextEditor::SetLanguageDefinition(const LanguageDefinition & aLanguageDef)
@@ -66,6 +94,8 @@ void TextEditor::SetLanguageDefinition(const LanguageDefinition & aLanguageDef)
 	for (auto& r : mLanguageDefinition.mTokenRegexStrings)
 		mRegexList.push_back(std::make_pair(std::regex(r.first, std::regex_constants::optimize), r.second));
 
+	mJobLanguageDefinition.reset();
+	mJobRegexList.reset();
 	Colorize();
 }
 
@@ -74,43 +104,225 @@ void TextEditor::SetPalette(const Palette & aValue)
 	mPaletteBase = aValue;
 }
 
-std::string TextEditor::GetText(const Coordinates & aStart, const Coordinates & aEnd) const
+TextEditor::TextBuffer::TextBuffer()
+	: mLineStarts(1, 0)
+	, mLength(0)
 {
-	std::string result;
+}
 
-	auto lstart = aStart.mLine;
-	auto lend = aEnd.mLine;
-	auto istart = GetCharacterIndex(aStart);
-	auto iend = GetCharacterIndex(aEnd);
-	size_t s = 0;
+void TextEditor::TextBuffer::Assign(const char* aText, size_t aLength)
+{
+	mOriginalGlyphs.clear();
+	mAddedGlyphs.clear();
+	mOriginalGlyphs.reserve(aLength);
+	mLineStarts.assign(1, 0);
 
-	for (size_t i = lstart; i < lend; i++)
-		s += mLines[i].size();
+	for (size_t i = 0; i < aLength; ++i)
+	{
+		auto chr = aText[i];
+		if (chr == '\r')
+			continue;	// ignore the carriage return character
+		if (chr == '\n')
+			mLineStarts.push_back(mOriginalGlyphs.size() + 1);
+		mOriginalGlyphs.emplace_back(Glyph(chr, PaletteIndex::Default));
+	}
 
-	result.reserve(s + s / 8);
+	mLength = mOriginalGlyphs.size();
+	mPieces.clear();
+	mPieceStarts.clear();
+	if (mLength > 0)
+	{
+		mPieces.push_back(Piece{ false, 0, mLength });
+		mPieceStarts.push_back(0);
+	}
+}
 
-	while (istart < iend || lstart < lend)
+int TextEditor::TextBuffer::Insert(size_t aOffset, const char* aText, size_t aLength)
+{
+	const size_t start = mAddedGlyphs.size();
+	for (size_t i = 0; i < aLength; ++i)
 	{
-		if (lstart >= (int)mLines.size())
-			break;
+		if (aText[i] != '\r')
+			mAddedGlyphs.emplace_back(Glyph(aText[i], PaletteIndex::Default));
+	}
 
-		auto& line = mLines[lstart];
-		if (istart < (int)line.size())
+	if (mAddedGlyphs.size() == start)
+		return 0;
+	return Insert(aOffset, Pieces(1, Piece{ true, start, mAddedGlyphs.size() - start }));
+}
+
+int TextEditor::TextBuffer::Insert(size_t aOffset, const Pieces& aPieces)
+{
+	std::vector<size_t> lineStarts;
+	size_t length = 0;
+	for (auto& piece : aPieces)
+	{
+		auto glyphs = GetGlyphs(piece);
+		for (size_t i = 0; i < piece.mLength; ++i)
 		{
-			result += line[istart].mChar;
-			istart++;
+			if (glyphs[i].mChar == '\n')
+				lineStarts.push_back(aOffset + length + i + 1);
 		}
+		length += piece.mLength;
+	}
+	if (length == 0)
+		return 0;
+
+	// lines after the insertion point move by the inserted length, the new ones are indexed in between
+	auto line = std::upper_bound(mLineStarts.begin(), mLineStarts.end(), aOffset);
+	for (auto it = line; it != mLineStarts.end(); ++it)
+		*it += length;
+	mLineStarts.insert(line, lineStarts.begin(), lineStarts.end());
+
+	auto index = SplitPiece(aOffset);
+	mPieces.insert(mPieces.begin() + index, aPieces.begin(), aPieces.end());
+	mLength += length;
+	MergePieces(index, index + aPieces.size());
+
+	return (int)lineStarts.size();
+}
+
+int TextEditor::TextBuffer::Erase(size_t aBegin, size_t aEnd)
+{
+	if (aBegin >= aEnd)
+		return 0;
+
+	// lines starting within the erased range are joined to the one before, the lines after it move back
+	auto first = std::upper_bound(mLineStarts.begin(), mLineStarts.end(), aBegin);
+	auto last = std::upper_bound(first, mLineStarts.end(), aEnd);
+	const int removed = (int)(last - first);
+	for (auto it = last; it != mLineStarts.end(); ++it)
+		*it -= aEnd - aBegin;
+	mLineStarts.erase(first, last);
+
+	auto from = SplitPiece(aBegin);
+	auto to = SplitPiece(aEnd);
+	mPieces.erase(mPieces.begin() + from, mPieces.begin() + to);
+	mPieceStarts.erase(mPieceStarts.begin() + from, mPieceStarts.begin() + to);
+	mLength -= aEnd - aBegin;
+	MergePieces(from, from);
+
+	return removed;
+}
+
+TextEditor::TextBuffer::Pieces TextEditor::TextBuffer::GetPieces(size_t aBegin, size_t aEnd) const
+{
+	Pieces result;
+	if (aBegin >= aEnd)
+		return result;
+
+	for (auto i = FindPiece(aBegin); i < mPieces.size() && mPieceStarts[i] < aEnd; ++i)
+	{
+		const auto begin = std::max(aBegin, mPieceStarts[i]);
+		const auto end = std::min(aEnd, mPieceStarts[i] + mPieces[i].mLength);
+		result.push_back(Piece{ mPieces[i].mAdded, mPieces[i].mStart + (begin - mPieceStarts[i]), end - begin });
+	}
+	return result;
+}
+
+void TextEditor::TextBuffer::GetText(size_t aBegin, size_t aEnd, std::string& aText) const
+{
+	if (aBegin >= aEnd)
+		return;
+
+	aText.reserve(aText.size() + (aEnd - aBegin));
+	for (auto& piece : GetPieces(aBegin, aEnd))
+	{
+		auto glyphs = GetGlyphs(piece);
+		for (size_t i = 0; i < piece.mLength; ++i)
+			aText.push_back(glyphs[i].mChar);
+	}
+}
+
+void TextEditor::TextBuffer::CopyLines(size_t aFrom, size_t aTo, Lines& aLines) const
+{
+	aLines.clear();
+	aLines.resize(aTo - aFrom);
+	for (size_t i = aFrom; i < aTo; ++i)
+	{
+		auto line = (*this)[i];
+		auto& copy = aLines[i - aFrom];
+		copy.reserve(line.size());
+		for (size_t j = 0; j < line.size(); ++j)
+			copy.push_back(line[j]);
+	}
+}
+
+size_t TextEditor::TextBuffer::FindPiece(size_t aOffset) const
+{
+	return std::upper_bound(mPieceStarts.begin(), mPieceStarts.end(), aOffset) - mPieceStarts.begin() - 1;
+}
+
+// Makes a piece start at aOffset and returns its index, or the number of pieces at the end of the text
+size_t TextEditor::TextBuffer::SplitPiece(size_t aOffset)
+{
+	if (aOffset >= mLength)
+		return mPieces.size();
+
+	auto index = FindPiece(aOffset);
+	const auto split = aOffset - mPieceStarts[index];
+	if (split == 0)
+		return index;
+
+	auto tail = mPieces[index];
+	tail.mStart += split;
+	tail.mLength -= split;
+	mPieces[index].mLength = split;
+	mPieces.insert(mPieces.begin() + index + 1, tail);
+	mPieceStarts.insert(mPieceStarts.begin() + index + 1, aOffset);
+	return index + 1;
+}
+
+// Joins the pieces around [aFrom, aTo) that continue each other in the same buffer, so typing keeps growing
+// a single piece, and updates the piece offsets from there on
+void TextEditor::TextBuffer::MergePieces(size_t aFrom, size_t aTo)
+{
+	const size_t first = aFrom > 0 ? aFrom - 1 : 0;
+	const size_t last = std::min(aTo + 1, mPieces.size());
+	size_t merged = first;
+	for (size_t i = first + 1; i < last; ++i)
+	{
+		auto& prev = mPieces[merged];
+		if (prev.mAdded == mPieces[i].mAdded && prev.mStart + prev.mLength == mPieces[i].mStart)
+			prev.mLength += mPieces[i].mLength;
 		else
-		{
-			istart = 0;
-			++lstart;
-			result += '\n';
-		}
+			mPieces[++merged] = mPieces[i];
 	}
+	if (merged + 1 < last)
+		mPieces.erase(mPieces.begin() + merged + 1, mPieces.begin() + last);
+
+	mPieceStarts.resize(mPieces.size());
+	for (size_t i = first; i < mPieces.size(); ++i)
+		mPieceStarts[i] = i > 0 ? mPieceStarts[i - 1] + mPieces[i - 1].mLength : 0;
+}
+
+std::string TextEditor::GetText(const Coordinates & aStart, const Coordinates & aEnd) const
+{
+	std::string result;
+	if (aStart.mLine >= (int)mLines.size())
+		return result;
+
+	// a range reaching past the last line ends with a line break
+	const bool pastEnd = aEnd.mLine >= (int)mLines.size();
+	const auto begin = mLines.GetOffset(aStart.mLine, GetCharacterIndex(aStart));
+	const auto end = pastEnd ? mLines.GetLength() : mLines.GetOffset(aEnd.mLine, GetCharacterIndex(aEnd));
+	mLines.GetText(begin, end, result);
+	if (pastEnd)
+		result += '\n';
 
 	return result;
 }
 
+TextEditor::TextBuffer::Pieces TextEditor::GetPieces(const Coordinates & aStart, const Coordinates & aEnd) const
+{
+	if (aStart.mLine >= (int)mLines.size())
+		return TextBuffer::Pieces();
+
+	const auto begin = mLines.GetOffset(aStart.mLine, GetCharacterIndex(aStart));
+	const auto end = aEnd.mLine >= (int)mLines.size() ? mLines.GetLength() : mLines.GetOffset(aEnd.mLine, GetCharacterIndex(aEnd));
+	return mLines.GetPieces(begin, end);
+}
+
 TextEditor::Coordinates TextEditor::GetActualCursorCoordinates() const
 {
 	return SanitizeCoordinates(mState.mCursorPosition);
@@ -200,7 +412,7 @@ void TextEditor::Advance(Coordinates & aCoordinates) const
 {
 	if (aCoordinates.mLine < (int)mLines.size())
 	{
-		auto& line = mLines[aCoordinates.mLine];
+		auto line = mLines[aCoordinates.mLine];
 		auto cindex = GetCharacterIndex(aCoordinates);
 
 		if (cindex + 1 < (int)line.size())
@@ -227,46 +439,33 @@ void TextEditor::DeleteRange(const Coordinates & aStart, const Coordinates & aEn
 	if (aEnd == aStart)
 		return;
 
-	auto start = GetCharacterIndex(aStart);
-	auto end = GetCharacterIndex(aEnd);
-
-	if (aStart.mLine == aEnd.mLine)
-	{
-		auto& line = mLines[aStart.mLine];
-		auto n = GetLineMaxColumn(aStart.mLine);
-		if (aEnd.mColumn >= n)
-			line.erase(line.begin() + start, line.end());
-		else
-			line.erase(line.begin() + start, line.begin() + end);
-	}
-	else
-	{
-		auto& firstLine = mLines[aStart.mLine];
-		auto& lastLine = mLines[aEnd.mLine];
-
-		firstLine.erase(firstLine.begin() + start, firstLine.end());
-		lastLine.erase(lastLine.begin(), lastLine.begin() + end);
+	auto start = mLines.GetOffset(aStart.mLine, GetCharacterIndex(aStart));
+	auto end = mLines.GetOffset(aEnd.mLine, GetCharacterIndex(aEnd));
+	mLines.Erase(start, end);
 
-		if (aStart.mLine < aEnd.mLine)
-			firstLine.insert(firstLine.end(), lastLine.begin(), lastLine.end());
-
-		if (aStart.mLine < aEnd.mLine)
-			RemoveLine(aStart.mLine + 1, aEnd.mLine + 1);
-	}
+	if (aStart.mLine < aEnd.mLine)
+		RemoveLine(aStart.mLine + 1, aEnd.mLine + 1);
 
 	mTextChanged = true;
+	++mDocumentVersion;
 }
 
 int TextEditor::InsertTextAt(Coordinates& /* inout */ aWhere, const char * aValue)
 {
 	assert(!mReadOnly);
+	assert(!mLines.empty());
+
+	if (*aValue == '\0')
+		return 0;
+
+	// The whole text is appended to the added buffer and spliced in as a single piece, so big pastes stay linear
+	auto offset = mLines.GetOffset(aWhere.mLine, GetCharacterIndex(aWhere));
+	int totalLines = mLines.Insert(offset, aValue, strlen(aValue));
+	if (totalLines > 0)
+		InsertLines(aWhere.mLine + 1, totalLines);
 
-	int cindex = GetCharacterIndex(aWhere);
-	int totalLines = 0;
 	while (*aValue != '\0')
 	{
-		assert(!mLines.empty());
-
 		if (*aValue == '\r')
 		{
 			// skip
@@ -274,38 +473,59 @@ int TextEditor::InsertTextAt(Coordinates& /* inout */ aWhere, const char * aValu
 		}
 		else if (*aValue == '\n')
 		{
-			if (cindex < (int)mLines[aWhere.mLine].size())
-			{
-				auto& newLine = InsertLine(aWhere.mLine + 1);
-				auto& line = mLines[aWhere.mLine];
-				newLine.insert(newLine.begin(), line.begin() + cindex, line.end());
-				line.erase(line.begin() + cindex, line.end());
-			}
-			else
-			{
-				InsertLine(aWhere.mLine + 1);
-			}
+			++aValue;
 			++aWhere.mLine;
 			aWhere.mColumn = 0;
-			cindex = 0;
-			++totalLines;
-			++aValue;
 		}
 		else
 		{
-			auto& line = mLines[aWhere.mLine];
 			auto d = UTF8CharLength(*aValue);
-			while (d-- > 0 && *aValue != '\0')
-				line.insert(line.begin() + cindex++, Glyph(*aValue++, PaletteIndex::Default));
+			while (d-- > 0 && *aValue != '\0' && *aValue != '\n')
+				++aValue;
 			++aWhere.mColumn;
 		}
-
-		mTextChanged = true;
 	}
 
+	mTextChanged = true;
+	++mDocumentVersion;
+
 	return totalLines;
 }
 
+void TextEditor::RemovePiecesAt(const Coordinates& aWhere, const TextBuffer::Pieces& aPieces)
+{
+	assert(!mReadOnly);
+
+	// exactly the glyphs of the pieces are removed, so they are never left in the text twice after a redo
+	size_t length = 0;
+	for (auto& piece : aPieces)
+		length += piece.mLength;
+
+	auto offset = mLines.GetOffset(aWhere.mLine, GetCharacterIndex(aWhere));
+	int totalLines = mLines.Erase(offset, std::min(offset + length, mLines.GetLength()));
+	if (totalLines > 0)
+		RemoveLine(aWhere.mLine + 1, aWhere.mLine + 1 + totalLines);
+
+	mTextChanged = true;
+	++mDocumentVersion;
+}
+
+void TextEditor::InsertPiecesAt(const Coordinates& aWhere, const TextBuffer::Pieces& aPieces)
+{
+	assert(!mReadOnly);
+
+	auto offset = mLines.GetOffset(aWhere.mLine, GetCharacterIndex(aWhere));
+	int totalLines = mLines.Insert(offset, aPieces);
+	if (totalLines > 0)
+		InsertLines(aWhere.mLine + 1, totalLines);
+
+	// the glyphs come back with the colors they were stored with, so every line they land on is scanned again
+	Colorize(aWhere.mLine, totalLines + 1);
+
+	mTextChanged = true;
+	++mDocumentVersion;
+}
+
 void TextEditor::AddUndo(UndoRecord& aValue)
 {
 	assert(!mReadOnly);
@@ -317,7 +537,7 @@ void TextEditor::AddUndo(UndoRecord& aValue)
 	//	);
 
 	mUndoBuffer.resize((size_t)(mUndoIndex + 1));
-	mUndoBuffer.back() = aValue;
+	mUndoBuffer.back() = std::move(aValue);
 	++mUndoIndex;
 }
 
@@ -332,7 +552,7 @@ TextEditor::Coordinates TextEditor::ScreenPosToCoordinates(const ImVec2& aPositi
 
 	if (lineNo >= 0 && lineNo < (int)mLines.size())
 	{
-		auto& line = mLines.at(lineNo);
+		auto line = mLines[lineNo];
 
 		int columnIndex = 0;
 		float columnX = 0.0f;
@@ -343,9 +563,8 @@ TextEditor::Coordinates TextEditor::ScreenPosToCoordinates(const ImVec2& aPositi
 
 			if (line[columnIndex].mChar == '\t')
 			{
-				float spaceSize = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, " ").x;
 				float oldX = columnX;
-				float newColumnX = (1.0f + std::floor((1.0f + columnX) / (float(mTabSize) * spaceSize))) * (float(mTabSize) * spaceSize);
+				float newColumnX = (1.0f + std::floor((1.0f + columnX) / (float(mTabSize) * mSpaceSize))) * (float(mTabSize) * mSpaceSize);
 				columnWidth = newColumnX - oldX;
 				if (mTextStart + columnX + columnWidth * 0.5f > local.x)
 					break;
@@ -358,10 +577,9 @@ TextEditor::Coordinates TextEditor::ScreenPosToCoordinates(const ImVec2& aPositi
 				char buf[7];
 				auto d = UTF8CharLength(line[columnIndex].mChar);
 				int i = 0;
-				while (i < 6 && d-- > 0)
+				while (i < 6 && d-- > 0 && (size_t)columnIndex < line.size())
 					buf[i++] = line[columnIndex++].mChar;
-				buf[i] = '\0';
-				columnWidth = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, buf).x;
+				columnWidth = TextWidth(buf, buf + i);
 				if (mTextStart + columnX + columnWidth * 0.5f > local.x)
 					break;
 				columnX += columnWidth;
@@ -379,7 +597,7 @@ TextEditor::Coordinates TextEditor::FindWordStart(const Coordinates & aFrom) con
 	if (at.mLine >= (int)mLines.size())
 		return at;
 
-	auto& line = mLines[at.mLine];
+	auto line = mLines[at.mLine];
 	auto cindex = GetCharacterIndex(at);
 
 	if (cindex >= (int)line.size())
@@ -413,7 +631,7 @@ TextEditor::Coordinates TextEditor::FindWordEnd(const Coordinates & aFrom) const
 	if (at.mLine >= (int)mLines.size())
 		return at;
 
-	auto& line = mLines[at.mLine];
+	auto line = mLines[at.mLine];
 	auto cindex = GetCharacterIndex(at);
 
 	if (cindex >= (int)line.size())
@@ -452,7 +670,7 @@ TextEditor::Coordinates TextEditor::FindNextWord(const Coordinates & aFrom) cons
 	bool skip = false;
 	if (cindex < (int)mLines[at.mLine].size())
 	{
-		auto& line = mLines[at.mLine];
+		auto line = mLines[at.mLine];
 		isword = isalnum(line[cindex].mChar);
 		skip = isword;
 	}
@@ -465,7 +683,7 @@ TextEditor::Coordinates TextEditor::FindNextWord(const Coordinates & aFrom) cons
 			return Coordinates(l, GetLineMaxColumn(l));
 		}
 
-		auto& line = mLines[at.mLine];
+		auto line = mLines[at.mLine];
 		if (cindex < (int)line.size())
 		{
 			isword = isalnum(line[cindex].mChar);
@@ -494,7 +712,7 @@ int TextEditor::GetCharacterIndex(const Coordinates& aCoordinates) const
 {
 	if (aCoordinates.mLine >= mLines.size())
 		return -1;
-	auto& line = mLines[aCoordinates.mLine];
+	auto line = mLines[aCoordinates.mLine];
 	int c = 0;
 	int i = 0;
 	for (; i < line.size() && c < aCoordinates.mColumn;)
@@ -512,7 +730,7 @@ int TextEditor::GetCharacterColumn(int aLine, int aIndex) const
 {
 	if (aLine >= mLines.size())
 		return 0;
-	auto& line = mLines[aLine];
+	auto line = mLines[aLine];
 	int col = 0;
 	int i = 0;
 	while (i < aIndex && i < (int)line.size())
@@ -531,7 +749,7 @@ int TextEditor::GetLineCharacterCount(int aLine) const
 {
 	if (aLine >= mLines.size())
 		return 0;
-	auto& line = mLines[aLine];
+	auto line = mLines[aLine];
 	int c = 0;
 	for (unsigned i = 0; i < line.size(); c++)
 		i += UTF8CharLength(line[i].mChar);
@@ -542,7 +760,7 @@ int TextEditor::GetLineMaxColumn(int aLine) const
 {
 	if (aLine >= mLines.size())
 		return 0;
-	auto& line = mLines[aLine];
+	auto line = mLines[aLine];
 	int col = 0;
 	for (unsigned i = 0; i < line.size(); )
 	{
@@ -561,7 +779,7 @@ bool TextEditor::IsOnWordBoundary(const Coordinates & aAt) const
 	if (aAt.mLine >= (int)mLines.size() || aAt.mColumn == 0)
 		return true;
 
-	auto& line = mLines[aAt.mLine];
+	auto line = mLines[aAt.mLine];
 	auto cindex = GetCharacterIndex(aAt);
 	if (cindex >= (int)line.size())
 		return true;
@@ -572,11 +790,12 @@ bool TextEditor::IsOnWordBoundary(const Coordinates & aAt) const
 	return isspace(line[cindex].mChar) != isspace(line[cindex - 1].mChar);
 }
 
+// The line helpers below only move the per-line state along: the text itself is already edited in mLines
 void TextEditor::RemoveLine(int aStart, int aEnd)
 {
 	assert(!mReadOnly);
 	assert(aEnd >= aStart);
-	assert(mLines.size() > (size_t)(aEnd - aStart));
+	assert(mLineStates.size() > (size_t)(aEnd - aStart));
 
 	ErrorMarkers etmp;
 	for (auto& i : mErrorMarkers)
@@ -597,16 +816,18 @@ void TextEditor::RemoveLine(int aStart, int aEnd)
 	}
 	mBreakpoints = std::move(btmp);
 
-	mLines.erase(mLines.begin() + aStart, mLines.begin() + aEnd);
+	mLineStates.erase(mLineStates.begin() + aStart, mLineStates.begin() + aEnd);
+	RemoveLineWidths(aStart, aEnd);
 	assert(!mLines.empty());
 
 	mTextChanged = true;
+	++mDocumentVersion;
 }
 
 void TextEditor::RemoveLine(int aIndex)
 {
 	assert(!mReadOnly);
-	assert(mLines.size() > 1);
+	assert(mLineStates.size() > 1);
 
 	ErrorMarkers etmp;
 	for (auto& i : mErrorMarkers)
@@ -627,29 +848,30 @@ void TextEditor::RemoveLine(int aIndex)
 	}
 	mBreakpoints = std::move(btmp);
 
-	mLines.erase(mLines.begin() + aIndex);
+	mLineStates.erase(mLineStates.begin() + aIndex);
+	RemoveLineWidths(aIndex, aIndex + 1);
 	assert(!mLines.empty());
 
 	mTextChanged = true;
+	++mDocumentVersion;
 }
 
-TextEditor::Line& TextEditor::InsertLine(int aIndex)
+void TextEditor::InsertLines(int aIndex, int aCount)
 {
 	assert(!mReadOnly);
 
-	auto& result = *mLines.insert(mLines.begin() + aIndex, Line());
+	mLineStates.insert(mLineStates.begin() + aIndex, aCount, LineState());
+	InsertLineWidths(aIndex, aCount);
 
 	ErrorMarkers etmp;
 	for (auto& i : mErrorMarkers)
-		etmp.insert(ErrorMarkers::value_type(i.first >= aIndex ? i.first + 1 : i.first, i.second));
+		etmp.insert(ErrorMarkers::value_type(i.first >= aIndex ? i.first + aCount : i.first, i.second));
 	mErrorMarkers = std::move(etmp);
 
 	Breakpoints btmp;
 	for (auto i : mBreakpoints)
-		btmp.insert(i >= aIndex ? i + 1 : i);
+		btmp.insert(i >= aIndex ? i + aCount : i);
 	mBreakpoints = std::move(btmp);
-
-	return result;
 }
 
 std::string TextEditor::GetWordUnderCursor() const
@@ -697,6 +919,7 @@ ImU32 TextEditor::GetGlyphColor(const Glyph & aGlyph) const
 
 void TextEditor::HandleKeyboardInputs()
 {
+	PROFILE_ZONE("TextEditor::HandleKeyboardInputs");
 	ImGuiIO& io = ImGui::GetIO();
 	auto shift = io.KeyShift;
 	auto ctrl = io.ConfigMacOSXBehaviors ? io.KeySuper : io.KeyCtrl;
@@ -777,6 +1000,7 @@ void TextEditor::HandleKeyboardInputs()
 
 void TextEditor::HandleMouseInputs()
 {
+	PROFILE_ZONE("TextEditor::HandleMouseInputs");
 	ImGuiIO& io = ImGui::GetIO();
 	auto shift = io.KeyShift;
 	auto ctrl = io.ConfigMacOSXBehaviors ? io.KeySuper : io.KeyCtrl;
@@ -853,9 +1077,9 @@ void TextEditor::HandleMouseInputs()
 
 void TextEditor::Render()
 {
+	PROFILE_ZONE("TextEditor::Render");
 	/* Compute mCharAdvance regarding to scaled font size (Ctrl + mouse wheel)*/
-	const float fontSize = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, "#", nullptr, nullptr).x;
-	mCharAdvance = ImVec2(fontSize, ImGui::GetTextLineHeightWithSpacing() * mLineSpacing);
+	mCharAdvance = ImVec2(mAsciiAdvance['#'], ImGui::GetTextLineHeightWithSpacing() * mLineSpacing);
 
 	/* Update palette with the current alpha from style */
 	for (int i = 0; i < (int)PaletteIndex::Max; ++i)
@@ -869,7 +1093,6 @@ void TextEditor::Render()
 
 	auto contentSize = ImGui::GetWindowContentRegionMax();
 	auto drawList = ImGui::GetWindowDrawList();
-	float longest(mTextStart);
 
 	if (mScrollToTop)
 	{
@@ -880,6 +1103,7 @@ void TextEditor::Render()
 	ImVec2 cursorScreenPos = ImGui::GetCursorScreenPos();
 	auto scrollX = ImGui::GetScrollX();
 	auto scrollY = ImGui::GetScrollY();
+	auto clipMaxX = cursorScreenPos.x + scrollX + contentSize.x;
 
 	auto lineNo = (int)floor(scrollY / mCharAdvance.y);
 	auto globalLineMax = (int)mLines.size();
@@ -888,20 +1112,22 @@ void TextEditor::Render()
 	// Deduce mTextStart by evaluating mLines size (global lineMax) plus two spaces as text width
 	char buf[16];
 	snprintf(buf, 16, " %d ", globalLineMax);
-	mTextStart = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, buf, nullptr, nullptr).x + mLeftMargin;
+	mTextStart = TextWidth(buf, buf + strlen(buf)) + mLeftMargin;
+
+	// Only lines edited since the last frame are measured again, the rest come from the cache
+	UpdateLongestLine();
+	float longest = mTextStart + mLongestLine;
 
 	if (!mLines.empty())
 	{
-		float spaceSize = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, " ", nullptr, nullptr).x;
+		const float spaceSize = mSpaceSize;
 
 		while (lineNo <= lineMax)
 		{
 			ImVec2 lineStartScreenPos = ImVec2(cursorScreenPos.x, cursorScreenPos.y + lineNo * mCharAdvance.y);
 			ImVec2 textScreenPos = ImVec2(lineStartScreenPos.x + mTextStart, lineStartScreenPos.y);
 
-			auto& line = mLines[lineNo];
-			longest = std::max(mTextStart + TextDistanceToLineStart(Coordinates(lineNo, GetLineMaxColumn(lineNo))), longest);
-			auto columnNo = 0;
+			auto line = mLines[lineNo];
 			Coordinates lineStartCoord(lineNo, 0);
 			Coordinates lineEndCoord(lineNo, GetLineMaxColumn(lineNo));
 
@@ -956,10 +1182,10 @@ void TextEditor::Render()
 			}
 
 			// Draw line number (right aligned)
-			snprintf(buf, 16, "%d  ", lineNo + 1);
+			auto bufEnd = buf + snprintf(buf, 16, "%d  ", lineNo + 1);
 
-			auto lineNoWidth = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, buf, nullptr, nullptr).x;
-			drawList->AddText(ImVec2(lineStartScreenPos.x + mTextStart - lineNoWidth, lineStartScreenPos.y), mPalette[(int)PaletteIndex::LineNumber], buf);
+			auto lineNoWidth = TextWidth(buf, bufEnd);
+			drawList->AddText(ImVec2(lineStartScreenPos.x + mTextStart - lineNoWidth, lineStartScreenPos.y), mPalette[(int)PaletteIndex::LineNumber], buf, bufEnd);
 
 			if (mState.mCursorPosition.mLine == lineNo)
 			{
@@ -994,10 +1220,8 @@ void TextEditor::Render()
 							}
 							else
 							{
-								char buf2[2];
-								buf2[0] = line[cindex].mChar;
-								buf2[1] = '\0';
-								width = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, buf2).x;
+								char buf2 = line[cindex].mChar;
+								width = TextWidth(&buf2, &buf2 + 1);
 							}
 						}
 						ImVec2 cstart(textScreenPos.x + cx, lineStartScreenPos.y);
@@ -1009,24 +1233,12 @@ void TextEditor::Render()
 				}
 			}
 
-			// Render colorized text
-			auto prevColor = line.empty() ? mPalette[(int)PaletteIndex::Default] : GetGlyphColor(line[0]);
+			// Render colorized text, one AddText call per run of same-colored non-blank glyphs
 			ImVec2 bufferOffset;
 
-			for (int i = 0; i < line.size();)
+			for (int i = 0; i < (int)line.size() && textScreenPos.x + bufferOffset.x < clipMaxX;)
 			{
 				auto& glyph = line[i];
-				auto color = GetGlyphColor(glyph);
-
-				if ((color != prevColor || glyph.mChar == '\t' || glyph.mChar == ' ') && !mLineBuffer.empty())
-				{
-					const ImVec2 newOffset(textScreenPos.x + bufferOffset.x, textScreenPos.y + bufferOffset.y);
-					drawList->AddText(newOffset, prevColor, mLineBuffer.c_str());
-					auto textSize = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, mLineBuffer.c_str(), nullptr, nullptr);
-					bufferOffset.x += textSize.x;
-					mLineBuffer.clear();
-				}
-				prevColor = color;
 
 				if (glyph.mChar == '\t')
 				{
@@ -1063,18 +1275,22 @@ void TextEditor::Render()
 				}
 				else
 				{
-					auto l = UTF8CharLength(glyph.mChar);
-					while (l-- > 0)
-						mLineBuffer.push_back(line[i++].mChar);
-				}
-				++columnNo;
-			}
+					const auto color = GetGlyphColor(glyph);
+					do
+					{
+						auto l = UTF8CharLength(line[i].mChar);
+						while (l-- > 0 && i < (int)line.size())
+							mLineBuffer.push_back(line[i++].mChar);
+					} while (i < (int)line.size() && line[i].mChar != '\t' && line[i].mChar != ' ' && GetGlyphColor(line[i]) == color);
 
-			if (!mLineBuffer.empty())
-			{
-				const ImVec2 newOffset(textScreenPos.x + bufferOffset.x, textScreenPos.y + bufferOffset.y);
-				drawList->AddText(newOffset, prevColor, mLineBuffer.c_str());
-				mLineBuffer.clear();
+					const char* runBegin = mLineBuffer.data();
+					const char* runEnd = runBegin + mLineBuffer.size();
+					const ImVec2 newOffset(textScreenPos.x + bufferOffset.x, textScreenPos.y + bufferOffset.y);
+					drawList->AddText(newOffset, color, runBegin, runEnd);
+					if (i < (int)line.size())
+						bufferOffset.x += TextWidth(runBegin, runEnd);
+					mLineBuffer.clear();
+				}
 			}
 
 			++lineNo;
@@ -1120,6 +1336,7 @@ void TextEditor::Render()
 
 void TextEditor::Render(const char* aTitle, const ImVec2& aSize, bool aBorder)
 {
+	PROFILE_ZONE("TextEditor::Render(title)");
 	mWithinRender = true;
 	mTextChanged = false;
 	mCursorPositionChanged = false;
@@ -1129,6 +1346,8 @@ void TextEditor::Render(const char* aTitle, const ImVec2& aSize, bool aBorder)
 	if (!mIgnoreImGuiChild)
 		ImGui::BeginChild(aTitle, aSize, aBorder, ImGuiWindowFlags_HorizontalScrollbar | ImGuiWindowFlags_AlwaysHorizontalScrollbar | ImGuiWindowFlags_NoMove);
 
+	UpdateFontMetrics();
+
 	if (mHandleKeyboardInputs)
 	{
 		HandleKeyboardInputs();
@@ -1155,23 +1374,15 @@ void TextEditor::Render(const char* aTitle, const ImVec2& aSize, bool aBorder)
 
 void TextEditor::SetText(const std::string & aText)
 {
-	mLines.clear();
-	mLines.emplace_back(Line());
-	for (auto chr : aText)
-	{
-		if (chr == '\r')
-		{
-			// ignore the carriage return character
-		}
-		else if (chr == '\n')
-			mLines.emplace_back(Line());
-		else
-		{
-			mLines.back().emplace_back(Glyph(chr, PaletteIndex::Default));
-		}
-	}
+	PROFILE_ZONE("TextEditor::SetText");
+	mLines.Assign(aText.data(), aText.size());
+
+	mLineStates.assign(mLines.size(), LineState());
+	mLineWidths.assign(mLines.size(), -1.0f);
+	mLineWidthsStale = true;
 
 	mTextChanged = true;
+	++mDocumentVersion;
 	mScrollToTop = true;
 
 	mUndoBuffer.clear();
@@ -1182,27 +1393,22 @@ void TextEditor::SetText(const std::string & aText)
 
 void TextEditor::SetTextLines(const std::vector<std::string> & aLines)
 {
-	mLines.clear();
-
-	if (aLines.empty())
+	PROFILE_ZONE("TextEditor::SetTextLines");
+	std::string text;
+	for (size_t i = 0; i < aLines.size(); ++i)
 	{
-		mLines.emplace_back(Line());
+		if (i > 0)
+			text += '\n';
+		text += aLines[i];
 	}
-	else
-	{
-		mLines.resize(aLines.size());
+	mLines.Assign(text.data(), text.size());
 
-		for (size_t i = 0; i < aLines.size(); ++i)
-		{
-			const std::string & aLine = aLines[i];
-
-			mLines[i].reserve(aLine.size());
-			for (size_t j = 0; j < aLine.size(); ++j)
-				mLines[i].emplace_back(Glyph(aLine[j], PaletteIndex::Default));
-		}
-	}
+	mLineStates.assign(mLines.size(), LineState());
+	mLineWidths.assign(mLines.size(), -1.0f);
+	mLineWidthsStale = true;
 
 	mTextChanged = true;
+	++mDocumentVersion;
 	mScrollToTop = true;
 
 	mUndoBuffer.clear();
@@ -1243,27 +1449,31 @@ void TextEditor::EnterCharacter(ImWchar aChar, bool aShift)
 
 			u.mRemovedStart = start;
 			u.mRemovedEnd = end;
-			u.mRemoved = GetText(start, end);
+			u.mRemoved = GetPieces(start, end);
 
 			bool modified = false;
 
 			for (int i = start.mLine; i <= end.mLine; i++)
 			{
-				auto& line = mLines[i];
+				auto line = mLines[i];
+				auto offset = mLines.GetOffset(i, 0);
 				if (aShift)
 				{
 					if (!line.empty())
 					{
 						if (line.front().mChar == '\t')
 						{
-							line.erase(line.begin());
+							mLines.Erase(offset, offset + 1);
 							modified = true;
 						}
 						else
 						{
-							for (int j = 0; j < mTabSize && !line.empty() && line.front().mChar == ' '; j++)
+							int count = 0;
+							while (count < mTabSize && count < (int)line.size() && line[count].mChar == ' ')
+								count++;
+							if (count > 0)
 							{
-								line.erase(line.begin());
+								mLines.Erase(offset, offset + count);
 								modified = true;
 							}
 						}
@@ -1271,7 +1481,7 @@ void TextEditor::EnterCharacter(ImWchar aChar, bool aShift)
 				}
 				else
 				{
-					line.insert(line.begin(), Glyph('\t', TextEditor::PaletteIndex::Background));
+					mLines.Insert(offset, "\t", 1);
 					modified = true;
 				}
 			}
@@ -1284,13 +1494,13 @@ void TextEditor::EnterCharacter(ImWchar aChar, bool aShift)
 				{
 					end = Coordinates(end.mLine, GetLineMaxColumn(end.mLine));
 					rangeEnd = end;
-					u.mAdded = GetText(start, end);
+					u.mAdded = GetPieces(start, end);
 				}
 				else
 				{
 					end = Coordinates(originalEnd.mLine, 0);
 					rangeEnd = Coordinates(end.mLine - 1, GetLineMaxColumn(end.mLine - 1));
-					u.mAdded = GetText(start, rangeEnd);
+					u.mAdded = GetPieces(start, rangeEnd);
 				}
 
 				u.mAddedStart = start;
@@ -1302,7 +1512,9 @@ void TextEditor::EnterCharacter(ImWchar aChar, bool aShift)
 				AddUndo(u);
 
 				mTextChanged = true;
+				++mDocumentVersion;
 
+				Colorize(start.mLine, end.mLine - start.mLine + 1);
 				EnsureCursorVisible();
 			}
 
@@ -1310,7 +1522,7 @@ void TextEditor::EnterCharacter(ImWchar aChar, bool aShift)
 		} // c == '\t'
 		else
 		{
-			u.mRemoved = GetSelectedText();
+			u.mRemoved = GetPieces(mState.mSelectionStart, mState.mSelectionEnd);
 			u.mRemovedStart = mState.mSelectionStart;
 			u.mRemovedEnd = mState.mSelectionEnd;
 			DeleteSelection();
@@ -1324,20 +1536,20 @@ void TextEditor::EnterCharacter(ImWchar aChar, bool aShift)
 
 	if (aChar == '\n')
 	{
-		InsertLine(coord.mLine + 1);
-		auto& line = mLines[coord.mLine];
-		auto& newLine = mLines[coord.mLine + 1];
+		auto line = mLines[coord.mLine];
+		auto cindex = GetCharacterIndex(coord);
+		auto offset = mLines.GetOffset(coord.mLine, cindex);
 
+		std::string text(1, '\n');
 		if (mLanguageDefinition.mAutoIndentation)
 			for (size_t it = 0; it < line.size() && isascii(line[it].mChar) && isblank(line[it].mChar); ++it)
-				newLine.push_back(line[it]);
+				text.push_back(line[it].mChar);
 
-		const size_t whitespaceSize = newLine.size();
-		auto cindex = GetCharacterIndex(coord);
-		newLine.insert(newLine.end(), line.begin() + cindex, line.end());
-		line.erase(line.begin() + cindex, line.begin() + line.size());
+		const size_t whitespaceSize = text.size() - 1;
+		mLines.Insert(offset, text.data(), text.size());
+		InsertLines(coord.mLine + 1, 1);
 		SetCursorPosition(Coordinates(coord.mLine + 1, GetCharacterColumn(coord.mLine + 1, (int)whitespaceSize)));
-		u.mAdded = (char)aChar;
+		u.mAdded = mLines.GetPieces(offset, offset + text.size());
 	}
 	else
 	{
@@ -1345,9 +1557,9 @@ void TextEditor::EnterCharacter(ImWchar aChar, bool aShift)
 		int e = ImTextCharToUtf8(buf, 7, aChar);
 		if (e > 0)
 		{
-			buf[e] = '\0';
-			auto& line = mLines[coord.mLine];
+			auto line = mLines[coord.mLine];
 			auto cindex = GetCharacterIndex(coord);
+			auto offset = mLines.GetOffset(coord.mLine, cindex);
 
 			if (mOverwrite && cindex < (int)line.size())
 			{
@@ -1356,16 +1568,15 @@ void TextEditor::EnterCharacter(ImWchar aChar, bool aShift)
 				u.mRemovedStart = mState.mCursorPosition;
 				u.mRemovedEnd = Coordinates(coord.mLine, GetCharacterColumn(coord.mLine, cindex + d));
 
-				while (d-- > 0 && cindex < (int)line.size())
-				{
-					u.mRemoved += line[cindex].mChar;
-					line.erase(line.begin() + cindex);
-				}
+				d = std::min(d, (int)line.size() - cindex);
+				auto removed = mLines.GetPieces(offset, offset + d);
+				u.mRemoved.insert(u.mRemoved.end(), removed.begin(), removed.end());
+				mLines.Erase(offset, offset + d);
 			}
 
-			for (auto p = buf; *p != '\0'; p++, ++cindex)
-				line.insert(line.begin() + cindex, Glyph(*p, PaletteIndex::Default));
-			u.mAdded = buf;
+			mLines.Insert(offset, buf, e);
+			u.mAdded = mLines.GetPieces(offset, offset + e);
+			cindex += e;
 
 			SetCursorPosition(Coordinates(coord.mLine, GetCharacterColumn(coord.mLine, cindex)));
 		}
@@ -1374,6 +1585,7 @@ void TextEditor::EnterCharacter(ImWchar aChar, bool aShift)
 	}
 
 	mTextChanged = true;
+	++mDocumentVersion;
 
 	u.mAddedEnd = GetActualCursorCoordinates();
 	u.mAfter = mState;
@@ -1459,6 +1671,8 @@ void TextEditor::SetSelection(const Coordinates & aStart, const Coordinates & aE
 void TextEditor::SetTabSize(int aValue)
 {
 	mTabSize = std::max(0, std::min(32, aValue));
+	mLineWidths.assign(mLines.size(), -1.0f);
+	mLineWidthsStale = true;
 }
 
 void TextEditor::InsertText(const std::string & aValue)
@@ -1632,7 +1846,7 @@ void TextEditor::MoveRight(int aAmount, bool aSelect, bool aWordMode)
 	while (aAmount-- > 0)
 	{
 		auto lindex = mState.mCursorPosition.mLine;
-		auto& line = mLines[lindex];
+		auto line = mLines[lindex];
 
 		if (cindex >= line.size())
 		{
@@ -1767,7 +1981,7 @@ void TextEditor::Delete()
 
 	if (HasSelection())
 	{
-		u.mRemoved = GetSelectedText();
+		u.mRemoved = GetPieces(mState.mSelectionStart, mState.mSelectionEnd);
 		u.mRemovedStart = mState.mSelectionStart;
 		u.mRemovedEnd = mState.mSelectionEnd;
 
@@ -1777,19 +1991,19 @@ void TextEditor::Delete()
 	{
 		auto pos = GetActualCursorCoordinates();
 		SetCursorPosition(pos);
-		auto& line = mLines[pos.mLine];
+		auto line = mLines[pos.mLine];
 
 		if (pos.mColumn == GetLineMaxColumn(pos.mLine))
 		{
 			if (pos.mLine == (int)mLines.size() - 1)
 				return;
 
-			u.mRemoved = '\n';
 			u.mRemovedStart = u.mRemovedEnd = GetActualCursorCoordinates();
 			Advance(u.mRemovedEnd);
 
-			auto& nextLine = mLines[pos.mLine + 1];
-			line.insert(line.end(), nextLine.begin(), nextLine.end());
+			auto offset = mLines.GetOffset(pos.mLine, line.size());
+			u.mRemoved = mLines.GetPieces(offset, offset + 1);
+			mLines.Erase(offset, offset + 1);
 			RemoveLine(pos.mLine + 1);
 		}
 		else
@@ -1797,14 +2011,15 @@ void TextEditor::Delete()
 			auto cindex = GetCharacterIndex(pos);
 			u.mRemovedStart = u.mRemovedEnd = GetActualCursorCoordinates();
 			u.mRemovedEnd.mColumn++;
-			u.mRemoved = GetText(u.mRemovedStart, u.mRemovedEnd);
 
-			auto d = UTF8CharLength(line[cindex].mChar);
-			while (d-- > 0 && cindex < (int)line.size())
-				line.erase(line.begin() + cindex);
+			auto d = std::min(UTF8CharLength(line[cindex].mChar), (int)line.size() - cindex);
+			auto offset = mLines.GetOffset(pos.mLine, cindex);
+			u.mRemoved = mLines.GetPieces(offset, offset + d);
+			mLines.Erase(offset, offset + d);
 		}
 
 		mTextChanged = true;
+		++mDocumentVersion;
 
 		Colorize(pos.mLine, 1);
 	}
@@ -1825,7 +2040,7 @@ void TextEditor::Backspace()
 
 	if (HasSelection())
 	{
-		u.mRemoved = GetSelectedText();
+		u.mRemoved = GetPieces(mState.mSelectionStart, mState.mSelectionEnd);
 		u.mRemovedStart = mState.mSelectionStart;
 		u.mRemovedEnd = mState.mSelectionEnd;
 
@@ -1841,14 +2056,13 @@ void TextEditor::Backspace()
 			if (mState.mCursorPosition.mLine == 0)
 				return;
 
-			u.mRemoved = '\n';
 			u.mRemovedStart = u.mRemovedEnd = Coordinates(pos.mLine - 1, GetLineMaxColumn(pos.mLine - 1));
 			Advance(u.mRemovedEnd);
 
-			auto& line = mLines[mState.mCursorPosition.mLine];
-			auto& prevLine = mLines[mState.mCursorPosition.mLine - 1];
 			auto prevSize = GetLineMaxColumn(mState.mCursorPosition.mLine - 1);
-			prevLine.insert(prevLine.end(), line.begin(), line.end());
+			auto offset = mLines.GetOffset(mState.mCursorPosition.mLine, 0) - 1;
+			u.mRemoved = mLines.GetPieces(offset, offset + 1);
+			mLines.Erase(offset, offset + 1);
 
 			ErrorMarkers etmp;
 			for (auto& i : mErrorMarkers)
@@ -1861,7 +2075,7 @@ void TextEditor::Backspace()
 		}
 		else
 		{
-			auto& line = mLines[mState.mCursorPosition.mLine];
+			auto line = mLines[mState.mCursorPosition.mLine];
 			auto cindex = GetCharacterIndex(pos) - 1;
 			auto cend = cindex + 1;
 			while (cindex > 0 && IsUTFSequence(line[cindex].mChar))
@@ -1871,17 +2085,17 @@ void TextEditor::Backspace()
 			//	--cindex;
 
 			u.mRemovedStart = u.mRemovedEnd = GetActualCursorCoordinates();
-			--u.mRemovedStart.mColumn;
+			u.mRemovedStart.mColumn = GetCharacterColumn(u.mRemovedStart.mLine, cindex);	// a tab spans more than one column
 			--mState.mCursorPosition.mColumn;
 
-			while (cindex < line.size() && cend-- > cindex)
-			{
-				u.mRemoved += line[cindex].mChar;
-				line.erase(line.begin() + cindex);
-			}
+			auto count = std::max(0, std::min(cend, (int)line.size()) - cindex);
+			auto offset = mLines.GetOffset(mState.mCursorPosition.mLine, cindex);
+			u.mRemoved = mLines.GetPieces(offset, offset + count);
+			mLines.Erase(offset, offset + count);
 		}
 
 		mTextChanged = true;
+		++mDocumentVersion;
 
 		EnsureCursorVisible();
 		Colorize(mState.mCursorPosition.mLine, 1);
@@ -1918,7 +2132,7 @@ void TextEditor::Copy()
 		if (!mLines.empty())
 		{
 			std::string str;
-			auto& line = mLines[GetActualCursorCoordinates().mLine];
+			auto line = mLines[GetActualCursorCoordinates().mLine];
 			for (auto& g : line)
 				str.push_back(g.mChar);
 			ImGui::SetClipboardText(str.c_str());
@@ -1938,7 +2152,7 @@ void TextEditor::Cut()
 		{
 			UndoRecord u;
 			u.mBefore = mState;
-			u.mRemoved = GetSelectedText();
+			u.mRemoved = GetPieces(mState.mSelectionStart, mState.mSelectionEnd);
 			u.mRemovedStart = mState.mSelectionStart;
 			u.mRemovedEnd = mState.mSelectionEnd;
 
@@ -1964,17 +2178,19 @@ void TextEditor::Paste()
 
 		if (HasSelection())
 		{
-			u.mRemoved = GetSelectedText();
+			u.mRemoved = GetPieces(mState.mSelectionStart, mState.mSelectionEnd);
 			u.mRemovedStart = mState.mSelectionStart;
 			u.mRemovedEnd = mState.mSelectionEnd;
 			DeleteSelection();
 		}
 
-		u.mAdded = clipText;
 		u.mAddedStart = GetActualCursorCoordinates();
+		auto offset = mLines.GetOffset(u.mAddedStart.mLine, GetCharacterIndex(u.mAddedStart));
+		auto length = mLines.GetLength();
 
 		InsertText(clipText);
 
+		u.mAdded = mLines.GetPieces(offset, offset + mLines.GetLength() - length);
 		u.mAddedEnd = GetActualCursorCoordinates();
 		u.mAfter = mState;
 		AddUndo(u);
@@ -2115,9 +2331,14 @@ const TextEditor::Palette & TextEditor::GetRetroBluePalette()
 }
 
 
-std::string TextEditor::GetText() const
+const std::string& TextEditor::GetText() const
 {
-	return GetText(Coordinates(), Coordinates((int)mLines.size(), 0));
+	if (mTextSnapshotVersion != mDocumentVersion)
+	{
+		mTextSnapshot = GetText(Coordinates(), Coordinates((int)mLines.size(), 0));
+		mTextSnapshotVersion = mDocumentVersion;
+	}
+	return mTextSnapshot;
 }
 
 std::vector<std::string> TextEditor::GetTextLines() const
@@ -2126,8 +2347,9 @@ std::vector<std::string> TextEditor::GetTextLines() const
 
 	result.reserve(mLines.size());
 
-	for (auto & line : mLines)
+	for (size_t l = 0; l < mLines.size(); ++l)
 	{
+		auto line = mLines[l];
 		std::string text;
 
 		text.resize(line.size());
@@ -2156,6 +2378,7 @@ std::string TextEditor::GetCurrentLineText()const
 
 void TextEditor::ProcessInputs()
 {
+	PROFILE_ZONE("TextEditor::ProcessInputs");
 }
 
 void TextEditor::Colorize(int aFromLine, int aLines)
@@ -2165,22 +2388,40 @@ void TextEditor::Colorize(int aFromLine, int aLines)
 	mColorRangeMax = std::max(mColorRangeMax, toLine);
 	mColorRangeMin = std::max(0, mColorRangeMin);
 	mColorRangeMax = std::max(mColorRangeMin, mColorRangeMax);
+	mCommentRangeMin = std::max(0, std::min(mCommentRangeMin, aFromLine));
+	mCommentRangeMax = std::max(mCommentRangeMax, toLine);
 	mCheckComments = true;
+
+	// results for lines above this one stay valid when the job in flight comes back
+	if (mColorizeJobMin < mColorizeJobMax)
+		mColorizeJobEditLine = std::min(mColorizeJobEditLine, std::max(0, aFromLine));
+
+	// Every edit colorizes the lines it touched, so their cached widths go stale here as well
+	InvalidateLineWidths(std::max(0, aFromLine), toLine);
 }
 
 void TextEditor::ColorizeRange(int aFromLine, int aToLine)
 {
+	PROFILE_ZONE("TextEditor::ColorizeRange");
 	if (mLines.empty() || aFromLine >= aToLine)
 		return;
 
+	int endLine = std::max(0, std::min((int)mLines.size(), aToLine));
+	if (aFromLine < endLine)
+		ColorizeLines(mLines, aFromLine, endLine, mLanguageDefinition, mRegexList);
+}
+
+template<class TLines>
+void TextEditor::ColorizeLines(TLines& aLines, size_t aFrom, size_t aTo, const LanguageDefinition& aLanguageDefinition, const RegexList& aRegexList)
+{
+	PROFILE_ZONE("TextEditor::ColorizeLines");
 	std::string buffer;
 	std::cmatch results;
 	std::string id;
 
-	int endLine = std::max(0, std::min((int)mLines.size(), aToLine));
-	for (int i = aFromLine; i < endLine; ++i)
+	for (size_t i = aFrom; i < aTo; ++i)
 	{
-		auto& line = mLines[i];
+		auto&& line = aLines[i];
 
 		if (line.empty())
 			continue;
@@ -2206,9 +2447,9 @@ void TextEditor::ColorizeRange(int aFromLine, int aToLine)
 
 			bool hasTokenizeResult = false;
 
-			if (mLanguageDefinition.mTokenize != nullptr)
+			if (aLanguageDefinition.mTokenize != nullptr)
 			{
-				if (mLanguageDefinition.mTokenize(first, last, token_begin, token_end, token_color))
+				if (aLanguageDefinition.mTokenize(first, last, token_begin, token_end, token_color))
 					hasTokenizeResult = true;
 			}
 
@@ -2217,7 +2458,7 @@ void TextEditor::ColorizeRange(int aFromLine, int aToLine)
 				// todo : remove
 				//printf("using regex for %.*s\n", first + 10 < last ? 10 : int(last - first), first);
 
-				for (auto& p : mRegexList)
+				for (auto& p : aRegexList)
 				{
 					if (std::regex_search(first, last, results, p.first, std::regex_constants::match_continuous))
 					{
@@ -2245,21 +2486,21 @@ void TextEditor::ColorizeRange(int aFromLine, int aToLine)
 					id.assign(token_begin, token_end);
 
 					// todo : allmost all language definitions use lower case to specify keywords, so shouldn't this use ::tolower ?
-					if (!mLanguageDefinition.mCaseSensitive)
+					if (!aLanguageDefinition.mCaseSensitive)
 						std::transform(id.begin(), id.end(), id.begin(), ::toupper);
 
 					if (!line[first - bufferBegin].mPreprocessor)
 					{
-						if (mLanguageDefinition.mKeywords.count(id) != 0)
+						if (aLanguageDefinition.mKeywords.count(id) != 0)
 							token_color = PaletteIndex::Keyword;
-						else if (mLanguageDefinition.mIdentifiers.count(id) != 0)
+						else if (aLanguageDefinition.mIdentifiers.count(id) != 0)
 							token_color = PaletteIndex::KnownIdentifier;
-						else if (mLanguageDefinition.mPreprocIdentifiers.count(id) != 0)
+						else if (aLanguageDefinition.mPreprocIdentifiers.count(id) != 0)
 							token_color = PaletteIndex::PreprocIdentifier;
 					}
 					else
 					{
-						if (mLanguageDefinition.mPreprocIdentifiers.count(id) != 0)
+						if (aLanguageDefinition.mPreprocIdentifiers.count(id) != 0)
 							token_color = PaletteIndex::PreprocIdentifier;
 					}
 				}
@@ -2275,39 +2516,37 @@ void TextEditor::ColorizeRange(int aFromLine, int aToLine)
 
 void TextEditor::ColorizeInternal()
 {
+	PROFILE_ZONE("TextEditor::ColorizeInternal");
 	if (mLines.empty() || !mColorizerEnabled)
 		return;
 
 	if (mCheckComments)
 	{
-		auto endLine = mLines.size();
-		auto endIndex = 0;
-		auto commentStartLine = endLine;
-		auto commentStartIndex = endIndex;
-		auto withinString = false;
-		auto withinSingleLineComment = false;
-		auto withinPreproc = false;
-		auto firstChar = true;			// there is no other non-whitespace characters in the line before
-		auto concatenate = false;		// '\' on the very end of the line
-		auto currentLine = 0;
-		auto currentIndex = 0;
-		while (currentLine < endLine || currentIndex < endIndex)
-		{
-			auto& line = mLines[currentLine];
-
-			if (currentIndex == 0 && !concatenate)
-			{
-				withinSingleLineComment = false;
-				withinPreproc = false;
-				firstChar = true;
-			}
+		auto endLine = (int)mLines.size();
+		auto fromLine = std::min(mCommentRangeMin, endLine - 1);
+		auto currentLine = fromLine;
+		auto state = mLineStates[currentLine];
 
-			concatenate = false;
+		for (; currentLine < endLine; ++currentLine)
+		{
+			// past the edited lines, stop as soon as the carried state matches the cached one:
+			// every following line would then be scanned exactly as before
+			if (currentLine >= mCommentRangeMax && state == mLineStates[currentLine])
+				break;
+			mLineStates[currentLine] = state;
+
+			auto line = mLines[currentLine];
+			auto withinString = state.mWithinString;
+			auto withinSingleLineComment = state.mWithinSingleLineComment;
+			auto withinComment = state.mWithinMultiLineComment;
+			auto withinPreproc = state.mWithinPreproc;
+			auto firstChar = state.mFirstChar;	// there is no other non-whitespace characters in the line before
+			auto concatenate = false;			// '\' on the very end of the line
 
-			if (!line.empty())
+			for (int currentIndex = 0; currentIndex < (int)line.size(); )
 			{
-				auto& g = line[currentIndex];
-				auto c = g.mChar;
+				const auto glyphIndex = currentIndex;
+				auto c = line[currentIndex].mChar;
 
 				if (c != mLanguageDefinition.mPreprocChar && !isspace(c))
 					firstChar = false;
@@ -2315,11 +2554,10 @@ void TextEditor::ColorizeInternal()
 				if (currentIndex == (int)line.size() - 1 && line[line.size() - 1].mChar == '\\')
 					concatenate = true;
 
-				bool inComment = (commentStartLine < currentLine || (commentStartLine == currentLine && commentStartIndex <= currentIndex));
-
 				if (withinString)
 				{
-					line[currentIndex].mMultiLineComment = inComment;
+					line[currentIndex].mMultiLineComment = withinComment;
+					line[currentIndex].mComment = withinSingleLineComment;
 
 					if (c == '\"')
 					{
@@ -2327,7 +2565,10 @@ void TextEditor::ColorizeInternal()
 						{
 							currentIndex += 1;
 							if (currentIndex < (int)line.size())
-								line[currentIndex].mMultiLineComment = inComment;
+							{
+								line[currentIndex].mMultiLineComment = withinComment;
+								line[currentIndex].mComment = withinSingleLineComment;
+							}
 						}
 						else
 							withinString = false;
@@ -2336,7 +2577,10 @@ void TextEditor::ColorizeInternal()
 					{
 						currentIndex += 1;
 						if (currentIndex < (int)line.size())
-							line[currentIndex].mMultiLineComment = inComment;
+						{
+							line[currentIndex].mMultiLineComment = withinComment;
+							line[currentIndex].mComment = withinSingleLineComment;
+						}
 					}
 				}
 				else
@@ -2347,7 +2591,8 @@ void TextEditor::ColorizeInternal()
 					if (c == '\"')
 					{
 						withinString = true;
-						line[currentIndex].mMultiLineComment = inComment;
+						line[currentIndex].mMultiLineComment = withinComment;
+						line[currentIndex].mComment = withinSingleLineComment;
 					}
 					else
 					{
@@ -2365,86 +2610,375 @@ void TextEditor::ColorizeInternal()
 						else if (!withinSingleLineComment && currentIndex + startStr.size() <= line.size() &&
 							equals(startStr.begin(), startStr.end(), from, from + startStr.size(), pred))
 						{
-							commentStartLine = currentLine;
-							commentStartIndex = currentIndex;
+							withinComment = true;
 						}
 
-						inComment = inComment = (commentStartLine < currentLine || (commentStartLine == currentLine && commentStartIndex <= currentIndex));
-
-						line[currentIndex].mMultiLineComment = inComment;
+						line[currentIndex].mMultiLineComment = withinComment;
 						line[currentIndex].mComment = withinSingleLineComment;
 
 						auto& endStr = mLanguageDefinition.mCommentEnd;
 						if (currentIndex + 1 >= (int)endStr.size() &&
 							equals(endStr.begin(), endStr.end(), from + 1 - endStr.size(), from + 1, pred))
 						{
-							commentStartIndex = endIndex;
-							commentStartLine = endLine;
+							withinComment = false;
 						}
 					}
 				}
-				line[currentIndex].mPreprocessor = withinPreproc;
 				currentIndex += UTF8CharLength(c);
-				if (currentIndex >= (int)line.size())
-				{
-					currentIndex = 0;
-					++currentLine;
-				}
+				for (auto i = glyphIndex; i < currentIndex && i < (int)line.size(); ++i)
+					line[i].mPreprocessor = withinPreproc;
 			}
-			else
+
+			if (!concatenate)
 			{
-				currentIndex = 0;
-				++currentLine;
+				withinSingleLineComment = false;
+				withinPreproc = false;
+				firstChar = true;
 			}
+
+			state.mWithinString = withinString;
+			state.mWithinSingleLineComment = withinSingleLineComment;
+			state.mWithinMultiLineComment = withinComment;
+			state.mWithinPreproc = withinPreproc;
+			state.mFirstChar = firstChar;
 		}
+
+		// preprocessor state feeds keyword highlighting, so the rescanned lines need new tokens too
+		mColorRangeMin = std::min(mColorRangeMin, fromLine);
+		mColorRangeMax = std::max(mColorRangeMax, currentLine);
+
+		mCommentRangeMin = std::numeric_limits<int>::max();
+		mCommentRangeMax = 0;
 		mCheckComments = false;
 	}
 
+	ApplyColorizeResults();
+
 	if (mColorRangeMin < mColorRangeMax)
 	{
-		const int increment = (mLanguageDefinition.mTokenize == nullptr) ? 10 : 10000;
-		const int to = std::min(mColorRangeMin + increment, mColorRangeMax);
-		ColorizeRange(mColorRangeMin, to);
-		mColorRangeMin = to;
+		// the lines of an edit are tokenized right away, anything larger on the colorizer thread
+		const int maxSyncLines = 64;
+		if (mColorRangeMax - mColorRangeMin > maxSyncLines)
+			PostColorizeJob(mColorRangeMin, mColorRangeMax);
+		else
+			ColorizeRange(mColorRangeMin, mColorRangeMax);
+
+		mColorRangeMin = std::numeric_limits<int>::max();
+		mColorRangeMax = 0;
+	}
+}
+
+void TextEditor::PostColorizeJob(int aFromLine, int aToLine)
+{
+	PROFILE_ZONE("TextEditor::PostColorizeJob");
+	// a job still in flight is superseded, so the lines it has not handed back yet are taken over by the new one,
+	// widened by the lines inserted or removed since it was posted
+	if (mColorizeJobMin < mColorizeJobMax)
+	{
+		const int grown = std::max(0, (int)mLines.size() - mColorizeJobLineCount);
+		const int shrunk = std::max(0, mColorizeJobLineCount - (int)mLines.size());
+		aFromLine = std::min(aFromLine, mColorizeJobMin - shrunk);
+		aToLine = std::max(aToLine, mColorizeJobMax + grown);
+	}
+	aFromLine = std::max(0, aFromLine);
+	aToLine = std::min((int)mLines.size(), aToLine);
+	if (aFromLine >= aToLine)
+		return;
+
+	if (!mJobLanguageDefinition)
+	{
+		mJobLanguageDefinition = std::make_shared<const LanguageDefinition>(mLanguageDefinition);
+		mJobRegexList = std::make_shared<const RegexList>(mRegexList);
+	}
+
+	std::unique_ptr<ColorizeJob> job(new ColorizeJob());
+	job->mId = ++mColorizeJobId;
+	job->mVersion = mDocumentVersion;
+	job->mFromLine = aFromLine;
+	job->mLast = true;
+	mLines.CopyLines(aFromLine, aToLine, job->mLines);
+	job->mLanguageDefinition = mJobLanguageDefinition;
+	job->mRegexList = mJobRegexList;
+
+	mColorizeJobMin = aFromLine;
+	mColorizeJobMax = aToLine;
+	mColorizeJobLineCount = (int)mLines.size();
+	mColorizeJobEditLine = std::numeric_limits<int>::max();
+
+	{
+		std::lock_guard<std::mutex> lock(mColorizerMutex);
+		mColorizeRequest = std::move(job);
+	}
+
+	if (!mColorizerThread.joinable())
+		mColorizerThread = std::thread(&TextEditor::ColorizerThread, this);
+	mColorizerSignal.notify_one();
+}
+
+void TextEditor::ApplyColorizeResults()
+{
+	PROFILE_ZONE("TextEditor::ApplyColorizeResults");
+	std::vector<std::unique_ptr<ColorizeJob>> results;
+	{
+		std::lock_guard<std::mutex> lock(mColorizerMutex);
+		results.swap(mColorizeResults);
+	}
+
+	for (auto& result : results)
+	{
+		if (result->mId != mColorizeJobId || mColorizeJobMin >= mColorizeJobMax)
+			continue;
+
+		// lines above the first edit are unchanged since the job was posted, so their colors still apply
+		const int editLine = result->mVersion == mDocumentVersion ? std::numeric_limits<int>::max() : mColorizeJobEditLine;
+		const int count = std::max(0, std::min((int)result->mLines.size(), editLine - result->mFromLine));
 
-		if (mColorRangeMax == mColorRangeMin)
+		for (int i = 0; i < count; ++i)
 		{
-			mColorRangeMin = std::numeric_limits<int>::max();
-			mColorRangeMax = 0;
+			auto& src = result->mLines[i];
+			auto dst = mLines[result->mFromLine + i];
+			for (size_t j = 0; j < src.size(); ++j)
+				dst[j].mColorIndex = src[j].mColorIndex;
+		}
+		mColorizeJobMin = result->mFromLine + count;
+
+		if (count < (int)result->mLines.size())
+		{
+			// the job reached the edit: drop the rest and tokenize again from the edit onward,
+			// including the lines pushed down by inserted ones
+			const int grown = std::max(0, (int)mLines.size() - mColorizeJobLineCount);
+			const int shrunk = std::max(0, mColorizeJobLineCount - (int)mLines.size());
+			mColorRangeMin = std::min(mColorRangeMin, std::max(editLine, mColorizeJobMin - shrunk));
+			mColorRangeMax = std::max(mColorRangeMax, std::min((int)mLines.size(), mColorizeJobMax + grown));
+			mColorizeJobMin = std::numeric_limits<int>::max();
+			mColorizeJobMax = 0;
+			++mColorizeJobId;
+			continue;
+		}
+
+		if (result->mLast)
+		{
+			mColorizeJobMin = std::numeric_limits<int>::max();
+			mColorizeJobMax = 0;
 		}
-		return;
+	}
+}
+
+void TextEditor::ColorizerThread()
+{
+	PROFILE_THREAD("Colorizer");
+	std::unique_lock<std::mutex> lock(mColorizerMutex);
+	for (;;)
+	{
+		mColorizerSignal.wait(lock, [this] { return mColorizerQuit || mColorizeRequest != nullptr; });
+		if (mColorizerQuit)
+			return;
+
+		auto job = std::move(mColorizeRequest);
+		lock.unlock();
+
+		// hand the colors back in slices, so the top of a large document shows up while the rest is tokenized
+		const int sliceLines = 256;
+		const int count = (int)job->mLines.size();
+		for (int from = 0; from < count; from += sliceLines)
+		{
+			const int to = std::min(from + sliceLines, count);
+
+			std::unique_ptr<ColorizeJob> slice(new ColorizeJob());
+			slice->mId = job->mId;
+			slice->mVersion = job->mVersion;
+			slice->mFromLine = job->mFromLine + from;
+			slice->mLast = to == count;
+			slice->mLines.assign(std::make_move_iterator(job->mLines.begin() + from), std::make_move_iterator(job->mLines.begin() + to));
+			ColorizeLines(slice->mLines, 0, slice->mLines.size(), *job->mLanguageDefinition, *job->mRegexList);
+
+			std::lock_guard<std::mutex> guard(mColorizerMutex);
+			mColorizeResults.push_back(std::move(slice));
+			if (mColorizerQuit || mColorizeRequest != nullptr)
+				break;
+		}
+
+		lock.lock();
 	}
 }
 
 float TextEditor::TextDistanceToLineStart(const Coordinates& aFrom) const
 {
-	auto& line = mLines[aFrom.mLine];
+	auto line = mLines[aFrom.mLine];
 	float distance = 0.0f;
-	float spaceSize = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, " ", nullptr, nullptr).x;
 	int colIndex = GetCharacterIndex(aFrom);
 	for (size_t it = 0u; it < line.size() && it < colIndex; )
 	{
-		if (line[it].mChar == '\t')
+		auto c = line[it].mChar;
+		if (c == '\t')
+		{
+			distance = (1.0f + std::floor((1.0f + distance) / (float(mTabSize) * mSpaceSize))) * (float(mTabSize) * mSpaceSize);
+			++it;
+		}
+		else if (c < 0x80)
 		{
-			distance = (1.0f + std::floor((1.0f + distance) / (float(mTabSize) * spaceSize))) * (float(mTabSize) * spaceSize);
+			distance += mAsciiAdvance[c];
 			++it;
 		}
 		else
 		{
-			auto d = UTF8CharLength(line[it].mChar);
+			auto d = UTF8CharLength(c);
 			char tempCString[7];
 			int i = 0;
 			for (; i < 6 && d-- > 0 && it < (int)line.size(); i++, it++)
 				tempCString[i] = line[it].mChar;
 
-			tempCString[i] = '\0';
-			distance += ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, tempCString, nullptr, nullptr).x;
+			distance += ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, tempCString, tempCString + i, nullptr).x;
 		}
 	}
 
 	return distance;
 }
 
+float TextEditor::TextWidth(const char* aText, const char* aTextEnd) const
+{
+	float width = 0.0f;
+	for (auto p = aText; p < aTextEnd; )
+	{
+		auto c = (uint8_t)*p;
+		if (c < 0x80)
+		{
+			width += mAsciiAdvance[c];
+			++p;
+		}
+		else
+		{
+			auto end = std::min(p + UTF8CharLength(c), aTextEnd);
+			width += ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, p, end, nullptr).x;
+			p = end;
+		}
+	}
+	return width;
+}
+
+float TextEditor::GetLineWidth(int aLine)
+{
+	auto& width = mLineWidths[aLine];
+	if (width < 0.0f)
+		width = TextDistanceToLineStart(Coordinates(aLine, GetLineMaxColumn(aLine)));
+	return width;
+}
+
+void TextEditor::InvalidateLineWidths(int aFromLine, int aToLine)
+{
+	if (aFromLine >= aToLine)
+		return;
+	for (int i = aFromLine; i < aToLine; ++i)
+		mLineWidths[i] = -1.0f;
+	if (mLineWidthsDirtyMin >= mLineWidthsDirtyMax)
+	{
+		mLineWidthsDirtyMin = aFromLine;
+		mLineWidthsDirtyMax = aToLine;
+	}
+	else
+	{
+		mLineWidthsDirtyMin = std::min(mLineWidthsDirtyMin, aFromLine);
+		mLineWidthsDirtyMax = std::max(mLineWidthsDirtyMax, aToLine);
+	}
+}
+
+void TextEditor::InsertLineWidths(int aIndex, int aCount)
+{
+	mLineWidths.insert(mLineWidths.begin() + aIndex, aCount, -1.0f);
+	if (mLongestLineIndex >= aIndex)
+		mLongestLineIndex += aCount;
+	if (mLineWidthsDirtyMin < mLineWidthsDirtyMax)
+	{
+		if (mLineWidthsDirtyMin >= aIndex)
+			mLineWidthsDirtyMin += aCount;
+		if (mLineWidthsDirtyMax > aIndex)
+			mLineWidthsDirtyMax += aCount;
+	}
+	InvalidateLineWidths(aIndex, aIndex + aCount);
+}
+
+void TextEditor::RemoveLineWidths(int aStart, int aEnd)
+{
+	mLineWidths.erase(mLineWidths.begin() + aStart, mLineWidths.begin() + aEnd);
+	// Removing the longest line is the one case where every line has to be measured again
+	if (mLongestLineIndex >= aStart && mLongestLineIndex < aEnd)
+		mLineWidthsStale = true;
+	else if (mLongestLineIndex >= aEnd)
+		mLongestLineIndex -= aEnd - aStart;
+	auto shift = [aStart, aEnd](int aLine) { return aLine < aStart ? aLine : aLine < aEnd ? aStart : aLine - (aEnd - aStart); };
+	mLineWidthsDirtyMin = shift(mLineWidthsDirtyMin);
+	mLineWidthsDirtyMax = shift(mLineWidthsDirtyMax);
+}
+
+// Measures the edited lines and keeps the longest one up to date; all lines are scanned only after
+// a full invalidation, or when the longest line got shorter and no edited line replaces it
+void TextEditor::UpdateLongestLine()
+{
+	int lineCount = (int)mLines.size();
+	if (!mLineWidthsStale && mLineWidthsDirtyMin < mLineWidthsDirtyMax)
+	{
+		int dirtyMax = std::min(mLineWidthsDirtyMax, lineCount);
+		int best = -1;
+		float bestWidth = 0.0f;
+		for (int i = mLineWidthsDirtyMin; i < dirtyMax; ++i)
+		{
+			float width = GetLineWidth(i);
+			if (best < 0 || width > bestWidth)
+			{
+				best = i;
+				bestWidth = width;
+			}
+		}
+		bool longestEdited = mLongestLineIndex >= mLineWidthsDirtyMin && mLongestLineIndex < dirtyMax;
+		if (best >= 0 && bestWidth >= mLongestLine)
+		{
+			mLongestLine = bestWidth;
+			mLongestLineIndex = best;
+		}
+		else if (longestEdited)
+		{
+			mLineWidthsStale = true;
+		}
+	}
+	mLineWidthsDirtyMin = mLineWidthsDirtyMax = 0;
+
+	if (mLineWidthsStale)
+	{
+		mLongestLine = 0.0f;
+		mLongestLineIndex = 0;
+		for (int i = 0; i < lineCount; ++i)
+		{
+			float width = GetLineWidth(i);
+			if (width > mLongestLine)
+			{
+				mLongestLine = width;
+				mLongestLineIndex = i;
+			}
+		}
+		mLineWidthsStale = false;
+	}
+}
+
+void TextEditor::UpdateFontMetrics()
+{
+	auto font = ImGui::GetFont();
+	auto fontSize = ImGui::GetFontSize();
+	if (font == mFont && fontSize == mFontSize)
+		return;
+
+	mFont = font;
+	mFontSize = fontSize;
+	for (int c = 0; c < (int)mAsciiAdvance.size(); ++c)
+	{
+		char ch = (char)c;
+		mAsciiAdvance[c] = font->CalcTextSizeA(fontSize, FLT_MAX, -1.0f, &ch, &ch + 1, nullptr).x;
+	}
+	mSpaceSize = mAsciiAdvance[' '];
+
+	mLineWidths.assign(mLines.size(), -1.0f);
+	mLineWidthsStale = true;
+}
+
 void TextEditor::EnsureCursorVisible()
 {
 	if (!mWithinRender)
@@ -2485,10 +3019,10 @@ int TextEditor::GetPageSize() const
 }
 
 TextEditor::UndoRecord::UndoRecord(
-	const std::string& aAdded,
+	const TextBuffer::Pieces& aAdded,
 	const TextEditor::Coordinates aAddedStart,
 	const TextEditor::Coordinates aAddedEnd,
-	const std::string& aRemoved,
+	const TextBuffer::Pieces& aRemoved,
 	const TextEditor::Coordinates aRemovedStart,
 	const TextEditor::Coordinates aRemovedEnd,
 	TextEditor::EditorState& aBefore,
@@ -2510,14 +3044,13 @@ void TextEditor::UndoRecord::Undo(TextEditor * aEditor)
 {
 	if (!mAdded.empty())
 	{
-		aEditor->DeleteRange(mAddedStart, mAddedEnd);
+		aEditor->RemovePiecesAt(mAddedStart, mAdded);
 		aEditor->Colorize(mAddedStart.mLine - 1, mAddedEnd.mLine - mAddedStart.mLine + 2);
 	}
 
 	if (!mRemoved.empty())
 	{
-		auto start = mRemovedStart;
-		aEditor->InsertTextAt(start, mRemoved.c_str());
+		aEditor->InsertPiecesAt(mRemovedStart, mRemoved);
 		aEditor->Colorize(mRemovedStart.mLine - 1, mRemovedEnd.mLine - mRemovedStart.mLine + 2);
 	}
 
@@ -2530,15 +3063,14 @@ void TextEditor::UndoRecord::Redo(TextEditor * aEditor)
 {
 	if (!mRemoved.empty())
 	{
-		aEditor->DeleteRange(mRemovedStart, mRemovedEnd);
-		aEditor->Colorize(mRemovedStart.mLine - 1, mRemovedEnd.mLine - mRemovedStart.mLine + 1);
+		aEditor->RemovePiecesAt(mRemovedStart, mRemoved);
+		aEditor->Colorize(mRemovedStart.mLine - 1, mRemovedEnd.mLine - mRemovedStart.mLine + 2);
 	}
 
 	if (!mAdded.empty())
 	{
-		auto start = mAddedStart;
-		aEditor->InsertTextAt(start, mAdded.c_str());
-		aEditor->Colorize(mAddedStart.mLine - 1, mAddedEnd.mLine - mAddedStart.mLine + 1);
+		aEditor->InsertPiecesAt(mAddedStart, mAdded);
+		aEditor->Colorize(mAddedStart.mLine - 1, mAddedEnd.mLine - mAddedStart.mLine + 2);
 	}
 
 	aEditor->mState = mAfter;
@@ -1,9 +1,13 @@
 #pragma once
 
+#include <algorithm>
 #include <string>
 #include <vector>
 #include <array>
 #include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <unordered_set>
 #include <unordered_map>
 #include <map>
@@ -13,7 +17,7 @@
 class TextEditor
 {
 public:
-	enum class PaletteIndex
+	enum class PaletteIndex : uint8_t
 	{
 		Default,
 		Keyword,
@@ -133,6 +137,7 @@ public:
 	typedef std::array<ImU32, (unsigned)PaletteIndex::Max> Palette;
 	typedef uint8_t Char;
 
+	// Kept at 3 bytes per byte of text: the char, its token color and the comment/preprocessor bits
 	struct Glyph
 	{
 		Char mChar;
@@ -196,7 +201,7 @@ public:
 
 	void Render(const char* aTitle, const ImVec2& aSize = ImVec2(), bool aBorder = false);
 	void SetText(const std::string& aText);
-	std::string GetText() const;
+	const std::string& GetText() const;
 
 	void SetTextLines(const std::vector<std::string>& aLines);
 	std::vector<std::string> GetTextLines() const;
@@ -214,6 +219,8 @@ public:
 
 	bool IsColorizerEnabled() const { return mColorizerEnabled; }
 	void SetColorizerEnable(bool aValue);
+	// Colorizes lines [aFromLine, aToLine) on the calling thread, without the background colorizer
+	void ColorizeRange(int aFromLine = 0, int aToLine = 0);
 
 	Coordinates GetCursorPosition() const { return GetActualCursorCoordinates(); }
 	void SetCursorPosition(const Coordinates& aPosition);
@@ -271,6 +278,115 @@ public:
 private:
 	typedef std::vector<std::pair<std::regex, PaletteIndex>> RegexList;
 
+	// The document as a piece table. Glyphs never move once stored: SetText fills the original buffer and every
+	// glyph inserted afterwards is appended to the added buffer. The text is the sequence of pieces referencing
+	// both, with a '\n' glyph ending each line but the last, and the offset of every line is kept in mLineStarts.
+	class TextBuffer
+	{
+	public:
+		struct Piece
+		{
+			bool mAdded;	// glyphs are in the added buffer rather than the original one
+			size_t mStart;
+			size_t mLength;
+		};
+
+		typedef std::vector<Piece> Pieces;
+
+		// Glyphs of one line, valid until the next edit. Most lines lie within a single piece,
+		// the span of the last glyph looked up is kept so walking a line only searches at piece boundaries.
+		template<class T>
+		class LineView
+		{
+		public:
+			class iterator
+			{
+			public:
+				iterator(const LineView* aLine, size_t aIndex) : mLine(aLine), mIndex(aIndex) {}
+
+				T& operator*() const { return (*mLine)[mIndex]; }
+				iterator& operator++() { ++mIndex; return *this; }
+				iterator operator+(ptrdiff_t aOffset) const { return iterator(mLine, mIndex + aOffset); }
+				iterator operator-(ptrdiff_t aOffset) const { return iterator(mLine, mIndex - aOffset); }
+				bool operator==(const iterator& o) const { return mIndex == o.mIndex; }
+				bool operator!=(const iterator& o) const { return mIndex != o.mIndex; }
+
+			private:
+				const LineView* mLine;
+				size_t mIndex;
+			};
+
+			LineView(const TextBuffer* aBuffer, size_t aStart, size_t aSize)
+				: mBuffer(aBuffer), mStart(aStart), mSize(aSize), mSpan(nullptr), mSpanBegin(0), mSpanEnd(0) {}
+
+			size_t size() const { return mSize; }
+			bool empty() const { return mSize == 0; }
+
+			T& operator[](size_t aIndex) const
+			{
+				if (aIndex < mSpanBegin || aIndex >= mSpanEnd)
+					FindSpan(aIndex);
+				return mSpan[aIndex - mSpanBegin];
+			}
+
+			T& front() const { return (*this)[0]; }
+			T& back() const { return (*this)[mSize - 1]; }
+			iterator begin() const { return iterator(this, 0); }
+			iterator end() const { return iterator(this, mSize); }
+
+		private:
+			void FindSpan(size_t aIndex) const
+			{
+				const auto piece = mBuffer->FindPiece(mStart + aIndex);
+				const auto pieceStart = mBuffer->mPieceStarts[piece];
+				const auto begin = std::max(pieceStart, mStart);
+				const auto end = std::min(pieceStart + mBuffer->mPieces[piece].mLength, mStart + mSize);
+				mSpan = const_cast<T*>(mBuffer->GetGlyphs(mBuffer->mPieces[piece])) + (begin - pieceStart);
+				mSpanBegin = begin - mStart;
+				mSpanEnd = end - mStart;
+			}
+
+			const TextBuffer* mBuffer;
+			size_t mStart;
+			size_t mSize;
+			mutable T* mSpan;
+			mutable size_t mSpanBegin, mSpanEnd;
+		};
+
+		TextBuffer();
+
+		size_t size() const { return mLineStarts.size(); }
+		bool empty() const { return mLineStarts.empty(); }
+		LineView<Glyph> operator[](size_t aLine) { return LineView<Glyph>(this, mLineStarts[aLine], GetLineLength(aLine)); }
+		LineView<const Glyph> operator[](size_t aLine) const { return LineView<const Glyph>(this, mLineStarts[aLine], GetLineLength(aLine)); }
+
+		size_t GetLength() const { return mLength; }
+		size_t GetOffset(size_t aLine, size_t aIndex) const { return mLineStarts[aLine] + aIndex; }
+		size_t GetLineLength(size_t aLine) const { return (aLine + 1 < mLineStarts.size() ? mLineStarts[aLine + 1] - 1 : mLength) - mLineStarts[aLine]; }
+
+		void Assign(const char* aText, size_t aLength);
+		// Both return the number of lines inserted or removed
+		int Insert(size_t aOffset, const char* aText, size_t aLength);
+		int Insert(size_t aOffset, const Pieces& aPieces);
+		int Erase(size_t aBegin, size_t aEnd);
+		Pieces GetPieces(size_t aBegin, size_t aEnd) const;
+		void GetText(size_t aBegin, size_t aEnd, std::string& aText) const;
+		void CopyLines(size_t aFrom, size_t aTo, Lines& aLines) const;
+
+	private:
+		const Glyph* GetGlyphs(const Piece& aPiece) const { return (aPiece.mAdded ? mAddedGlyphs : mOriginalGlyphs).data() + aPiece.mStart; }
+		size_t FindPiece(size_t aOffset) const;
+		size_t SplitPiece(size_t aOffset);
+		void MergePieces(size_t aFrom, size_t aTo);
+
+		std::vector<Glyph> mOriginalGlyphs;
+		std::vector<Glyph> mAddedGlyphs;	// only appended to, so the pieces held by undo records stay valid
+		Pieces mPieces;
+		std::vector<size_t> mPieceStarts;	// document offset of every piece
+		std::vector<size_t> mLineStarts;	// document offset of every line
+		size_t mLength;
+	};
+
 	struct EditorState
 	{
 		Coordinates mSelectionStart;
@@ -285,11 +401,11 @@ private:
 		~UndoRecord() {}
 
 		UndoRecord(
-			const std::string& aAdded,
+			const TextBuffer::Pieces& aAdded,
 			const TextEditor::Coordinates aAddedStart,
 			const TextEditor::Coordinates aAddedEnd,
 
-			const std::string& aRemoved,
+			const TextBuffer::Pieces& aRemoved,
 			const TextEditor::Coordinates aRemovedStart,
 			const TextEditor::Coordinates aRemovedEnd,
 
@@ -299,11 +415,12 @@ private:
 		void Undo(TextEditor* aEditor);
 		void Redo(TextEditor* aEditor);
 
-		std::string mAdded;
+		// the text added and removed, as pieces of the document buffers rather than copies
+		TextBuffer::Pieces mAdded;
 		Coordinates mAddedStart;
 		Coordinates mAddedEnd;
 
-		std::string mRemoved;
+		TextBuffer::Pieces mRemoved;
 		Coordinates mRemovedStart;
 		Coordinates mRemovedEnd;
 
@@ -313,19 +430,71 @@ private:
 
 	typedef std::vector<UndoRecord> UndoBuffer;
 
+	// Comment/preprocessor scanner state carried into the first glyph of a line.
+	// Cached per line, so that an edit only rescans until the carried state matches again.
+	struct LineState
+	{
+		bool mWithinString = false;
+		bool mWithinSingleLineComment = false;
+		bool mWithinMultiLineComment = false;
+		bool mWithinPreproc = false;
+		bool mFirstChar = true;
+
+		bool operator ==(const LineState& o) const
+		{
+			return
+				mWithinString == o.mWithinString &&
+				mWithinSingleLineComment == o.mWithinSingleLineComment &&
+				mWithinMultiLineComment == o.mWithinMultiLineComment &&
+				mWithinPreproc == o.mWithinPreproc &&
+				mFirstChar == o.mFirstChar;
+		}
+
+		bool operator !=(const LineState& o) const { return !(*this == o); }
+	};
+
+	typedef std::vector<LineState> LineStates;
+
+	// Lines handed to the colorizer thread, or a slice of them handed back with their token colors.
+	// mVersion is the document version they were copied at.
+	struct ColorizeJob
+	{
+		uint64_t mId;
+		uint64_t mVersion;
+		int mFromLine;
+		bool mLast;
+		Lines mLines;
+		std::shared_ptr<const LanguageDefinition> mLanguageDefinition;
+		std::shared_ptr<const RegexList> mRegexList;
+	};
+
 	void ProcessInputs();
 	void Colorize(int aFromLine = 0, int aCount = -1);
-	void ColorizeRange(int aFromLine = 0, int aToLine = 0);
 	void ColorizeInternal();
+	template<class TLines>
+	static void ColorizeLines(TLines& aLines, size_t aFrom, size_t aTo, const LanguageDefinition& aLanguageDefinition, const RegexList& aRegexList);
+	void PostColorizeJob(int aFromLine, int aToLine);
+	void ApplyColorizeResults();
+	void ColorizerThread();
 	float TextDistanceToLineStart(const Coordinates& aFrom) const;
+	float TextWidth(const char* aText, const char* aTextEnd) const;
+	float GetLineWidth(int aLine);
+	void InvalidateLineWidths(int aFromLine, int aToLine);
+	void InsertLineWidths(int aIndex, int aCount);
+	void RemoveLineWidths(int aStart, int aEnd);
+	void UpdateLongestLine();
+	void UpdateFontMetrics();
 	void EnsureCursorVisible();
 	int GetPageSize() const;
 	std::string GetText(const Coordinates& aStart, const Coordinates& aEnd) const;
+	TextBuffer::Pieces GetPieces(const Coordinates& aStart, const Coordinates& aEnd) const;
 	Coordinates GetActualCursorCoordinates() const;
 	Coordinates SanitizeCoordinates(const Coordinates& aValue) const;
 	void Advance(Coordinates& aCoordinates) const;
 	void DeleteRange(const Coordinates& aStart, const Coordinates& aEnd);
 	int InsertTextAt(Coordinates& aWhere, const char* aValue);
+	void RemovePiecesAt(const Coordinates& aWhere, const TextBuffer::Pieces& aPieces);
+	void InsertPiecesAt(const Coordinates& aWhere, const TextBuffer::Pieces& aPieces);
 	void AddUndo(UndoRecord& aValue);
 	Coordinates ScreenPosToCoordinates(const ImVec2& aPosition) const;
 	Coordinates FindWordStart(const Coordinates& aFrom) const;
@@ -338,7 +507,7 @@ private:
 	bool IsOnWordBoundary(const Coordinates& aAt) const;
 	void RemoveLine(int aStart, int aEnd);
 	void RemoveLine(int aIndex);
-	Line& InsertLine(int aIndex);
+	void InsertLines(int aIndex, int aCount);
 	void EnterCharacter(ImWchar aChar, bool aShift);
 	void Backspace();
 	void DeleteSelection();
@@ -351,7 +520,7 @@ private:
 	void Render();
 
 	float mLineSpacing;
-	Lines mLines;
+	TextBuffer mLines;
 	EditorState mState;
 	UndoBuffer mUndoBuffer;
 	int mUndoIndex;
@@ -380,11 +549,39 @@ private:
 	RegexList mRegexList;
 
 	bool mCheckComments;
+	int mCommentRangeMin, mCommentRangeMax;
+	LineStates mLineStates;
+
+	std::thread mColorizerThread;
+	std::mutex mColorizerMutex;
+	std::condition_variable mColorizerSignal;
+	std::unique_ptr<ColorizeJob> mColorizeRequest;
+	std::vector<std::unique_ptr<ColorizeJob>> mColorizeResults;
+	bool mColorizerQuit;
+	uint64_t mColorizeJobId;            // only results of this job are applied
+	int mColorizeJobMin, mColorizeJobMax;
+	int mColorizeJobLineCount;
+	int mColorizeJobEditLine;           // first line edited while the job is in flight
+	std::shared_ptr<const LanguageDefinition> mJobLanguageDefinition;
+	std::shared_ptr<const RegexList> mJobRegexList;
+
 	Breakpoints mBreakpoints;
 	ErrorMarkers mErrorMarkers;
 	ImVec2 mCharAdvance;
+	ImFont* mFont;                      // font and size the layout caches below were measured with
+	float mFontSize;
+	float mSpaceSize;
+	std::array<float, 128> mAsciiAdvance;
+	std::vector<float> mLineWidths;     // pixel width of each line, negative when it has to be measured again
+	bool mLineWidthsStale;             // every line has to be measured for the longest one
+	float mLongestLine;
+	int mLongestLineIndex;
+	int mLineWidthsDirtyMin, mLineWidthsDirtyMax;  // lines to measure again, the longest one can only grow unless it is among them
 	Coordinates mInteractiveStart, mInteractiveEnd;
 	std::string mLineBuffer;
+	uint64_t mDocumentVersion;
+	mutable std::string mTextSnapshot;
+	mutable uint64_t mTextSnapshotVersion;
 	uint64_t mStartTime;
 
 	float mLastClick;
@@ -0,0 +1,319 @@
+// Microbenchmarks of the CPU hot paths of the viewer, on synthetic inputs, without any window or GL context:
+//   benchmark [--runs n] [--max-size px] [--output results.json] [--baseline baseline.json] [--tolerance ratio]
+// Each case is run n times and reported by its median and fastest run. With a baseline, the cases whose fastest
+// run, the least disturbed by the rest of the machine, grew by more than the tolerance are listed and the exit
+// code is 1, so that `make bench` fails on a regression.
+// The baseline holds timings of one machine: regenerate it with `make bench-baseline` when it changes.
+
+#include "renderer3D.h"
+#include "TextEditor.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+
+//Normal maps and screenshots go from this size up to --max-size, doubling each time
+#define BENCHMARK_MIN_SIZE 512
+//Below this many milliseconds, a slower run is taken as noise rather than a regression: the small
+//screenshot cases mostly time writes to the page cache
+#define BENCHMARK_MIN_REGRESSION_MS 2.0
+
+struct BenchmarkResult {
+    std::string name;
+    double medianMs;
+    double minMs;
+};
+
+//Keeps the results of the timed code alive, so that it is not optimized away
+static volatile size_t sink = 0;
+
+//Times runs calls of run, each one after an untimed call of setup when there is one
+static BenchmarkResult Measure(const std::string &name, int runs, std::function<void()> run, std::function<void()> setup = nullptr) {
+    std::vector<double> times;
+    for (int i = 0; i < runs; i++) {
+        if (setup)
+            setup();
+        auto start = std::chrono::steady_clock::now();
+        run();
+        times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    std::sort(times.begin(), times.end());
+    BenchmarkResult result = {name, times[times.size() / 2], times[0]};
+    printf("%-28s median %10.3f ms   min %10.3f ms\n", name.c_str(), result.medianMs, result.minMs);
+    fflush(stdout);
+    return result;
+}
+
+//Height field of the synthetic inputs: a few periodic bumps over [0, 1]^2
+static float Height(float u, float v) {
+    const float tau = 6.2831853f;
+    return 0.05f * sinf(3 * tau * u) * cosf(2 * tau * v) + 0.02f * sinf(11 * tau * (u + v)) + 0.01f * cosf(29 * tau * u);
+}
+
+static glm::vec3 HeightNormal(float u, float v, float du) {
+    float dx = (Height(u + du, v) - Height(u - du, v)) / (2 * du);
+    float dy = (Height(u, v + du) - Height(u, v - du)) / (2 * du);
+    return glm::normalize(glm::vec3(-dx, -dy, 1));
+}
+
+//Displaced grid of quads x quads faces pairs, as the OBJ files of the models folder
+static bool WriteGrid(const char* path, int quads) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "ERROR::BENCHMARK:: Could not write '%s'\n", path);
+        return false;
+    }
+    for (int y = 0; y <= quads; y++) {
+        for (int x = 0; x <= quads; x++) {
+            float u = x / (float)quads, v = y / (float)quads;
+            glm::vec3 n = HeightNormal(u, v, 0.5f / quads);
+            fprintf(file, "v %f %f %f\nvt %f %f\nvn %f %f %f\n", 2 * u - 1, Height(u, v), 2 * v - 1, u, v, n.x, n.z, n.y);
+        }
+    }
+    for (int y = 0; y < quads; y++) {
+        for (int x = 0; x < quads; x++) {
+            int a = y * (quads + 1) + x + 1;
+            int b = a + 1, c = a + quads + 1, d = c + 1;
+            fprintf(file, "f %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, c, c, c, b, b, b);
+            fprintf(file, "f %d/%d/%d %d/%d/%d %d/%d/%d\n", b, b, b, c, c, c, d, d, d);
+        }
+    }
+    return fclose(file) == 0;
+}
+
+//Tangent space normal map of the height field, size x size
+static bool WriteNormalMap(const char* path, int size) {
+    std::vector<unsigned char> pixels((size_t)size * size * 3);
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            glm::vec3 n = HeightNormal((x + 0.5f) / size, (y + 0.5f) / size, 0.5f / size);
+            for (int c = 0; c < 3; c++)
+                pixels[3 * ((size_t)y * size + x) + c] = (unsigned char)((n[c] * 0.5f + 0.5f) * 255.0f + 0.5f);
+        }
+    }
+    if (!stbi_write_png(path, size, size, 3, pixels.data(), size * 3)) {
+        fprintf(stderr, "ERROR::BENCHMARK:: Could not write '%s'\n", path);
+        return false;
+    }
+    return true;
+}
+
+//Shader source of the given number of lines, from a block of the kind of code the editor shows
+static std::string MakeShaderSource(int lines) {
+    static const char* block[] = {
+        "// Specular lobe of the LEAN map, whitened by the covariance of the slopes",
+        "uniform sampler2D bmap;",
+        "uniform vec3 lightDirection = vec3(0.5, 1.0, 0.25);",
+        "float lobe(vec2 b, vec3 sigma, vec2 h) {",
+        "\tfloat det = sigma.x * sigma.y - sigma.z * sigma.z;",
+        "\tvec2 d = h - b;",
+        "\tfloat q = (d.x * d.x * sigma.y + d.y * d.y * sigma.x - 2.0 * d.x * d.y * sigma.z) / det;",
+        "\treturn det > 0.0 ? exp(-0.5 * q) / (6.2831853 * sqrt(det)) : 0.0; /* degenerate */",
+        "}",
+        "#define SAMPLES 16",
+        "void shade(in vec2 uv, out vec4 color) {",
+        "\tvec3 b = texture(bmap, uv).xyz * 2.0 - 1.0;",
+        "\tfor (int i = 0; i < SAMPLES; i++)",
+        "\t\tcolor += vec4(lobe(b.xy, vec3(0.01, 0.02, 0.0), vec2(float(i) / 16.0, 0.5)));",
+        "}",
+        "",
+    };
+    const int blockLines = sizeof(block) / sizeof(block[0]);
+    std::string source;
+    for (int i = 0; i < lines; i++) {
+        source += block[i % blockLines];
+        source += '\n';
+    }
+    return source;
+}
+
+static bool WriteResults(const char* path, const std::vector<BenchmarkResult> &results, int runs) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "ERROR::BENCHMARK:: Could not write '%s'\n", path);
+        return false;
+    }
+    fprintf(file, "{\n  \"runs\": %d,\n  \"benchmarks\": [\n", runs);
+    for (size_t i = 0; i < results.size(); i++)
+        fprintf(file, "    {\"name\": \"%s\", \"median_ms\": %.4f, \"min_ms\": %.4f}%s\n", results[i].name.c_str(),
+                results[i].medianMs, results[i].minMs, i + 1 < results.size() ? "," : "");
+    fprintf(file, "  ]\n}\n");
+    return fclose(file) == 0;
+}
+
+//Reads back the timings of every case of a file written by WriteResults
+static bool ReadResults(const char* path, std::vector<BenchmarkResult> &results) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        fprintf(stderr, "ERROR::BENCHMARK:: Could not read '%s'\n", path);
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        char name[256];
+        double median = 0, min = 0;
+        if (sscanf(line.c_str(), " {\"name\": \"%255[^\"]\", \"median_ms\": %lf, \"min_ms\": %lf", name, &median, &min) == 3)
+            results.push_back({name, median, min});
+    }
+    return true;
+}
+
+//Number of cases slower than tolerance times their baseline
+static int CompareResults(const std::vector<BenchmarkResult> &results, const std::vector<BenchmarkResult> &baseline, double tolerance) {
+    int regressions = 0;
+    printf("\n%-28s %12s %12s %8s\n", "case", "baseline ms", "min ms", "ratio");
+    for (const BenchmarkResult &result : results) {
+        auto reference = std::find_if(baseline.begin(), baseline.end(), [&](const BenchmarkResult &b) { return b.name == result.name; });
+        if (reference == baseline.end()) {
+            printf("%-28s %12s %12.3f %8s\n", result.name.c_str(), "-", result.minMs, "new");
+            continue;
+        }
+        double ratio = reference->minMs > 0 ? result.minMs / reference->minMs : 1;
+        bool regression = ratio > tolerance && result.minMs - reference->minMs > BENCHMARK_MIN_REGRESSION_MS;
+        printf("%-28s %12.3f %12.3f %7.2fx%s\n", result.name.c_str(), reference->minMs, result.minMs, ratio, regression ? "  REGRESSION" : "");
+        regressions += regression;
+    }
+    return regressions;
+}
+
+int main(int argc, char** argv) {
+    int runs = 5;
+    int maxSize = 2048;
+    double tolerance = 1.5;
+    const char* output = "benchmark_results.json";
+    const char* baselinePath = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+            runs = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--max-size") == 0 && i + 1 < argc)
+            maxSize = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+            output = argv[++i];
+        else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+            baselinePath = argv[++i];
+        else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc)
+            tolerance = atof(argv[++i]);
+        else {
+            fprintf(stderr, "Usage: %s [--runs n] [--max-size px] [--output results.json] [--baseline baseline.json] [--tolerance ratio]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    std::vector<int> sizes;
+    for (int size = BENCHMARK_MIN_SIZE; size <= maxSize; size *= 2)
+        sizes.push_back(size);
+    std::vector<std::string> files; //Inputs and outputs, removed at the end
+    std::vector<BenchmarkResult> results;
+
+    //LoadMesh, without the upload of the vertex buffer
+    std::string faceSource;
+    for (int quads : {64, 256, 512}) {
+        std::string path = "benchmark_grid_" + std::to_string(quads) + ".obj";
+        if (!WriteGrid(path.c_str(), quads))
+            return 2;
+        files.push_back(path);
+        faceSource = path;
+        results.push_back(Measure("parse_mesh/grid_" + std::to_string(quads), runs, [&]() {
+            std::vector<VertexData> vertices;
+            Renderer3D::ParseMesh(path.c_str(), vertices);
+            sink += vertices.size();
+        }));
+    }
+
+    //splitstr on the face lines of the largest grid, as ParseMesh calls it
+    std::vector<std::string> faces;
+    std::ifstream grid(faceSource);
+    for (std::string line; std::getline(grid, line);)
+        if (line[0] == 'f')
+            faces.push_back(line);
+    results.push_back(Measure("splitstr/faces_" + std::to_string(faces.size()), runs, [&]() {
+        for (const std::string &face : faces) {
+            std::vector<std::string> split = splitstr(face, " ");
+            for (int i = 1; i < 4; i++)
+                sink += splitstr(split[i], "/").size();
+        }
+    }));
+
+    //SetNormal's decode and LEAN pyramid, from a cold histogram cache
+    for (int size : sizes) {
+        std::string path = "benchmark_normal_" + std::to_string(size) + ".png";
+        std::string cache = ReplaceExtension(path, ".bmap.gaussian");
+        if (!WriteNormalMap(path.c_str(), size))
+            return 2;
+        files.push_back(path);
+        files.push_back(cache);
+        results.push_back(Measure("normal_pyramid/" + std::to_string(size), runs, [&]() {
+            std::vector<TextureData> textures;
+            if (!Renderer3D::DecodeNormal(path, 64, 16, MIP_FILTER_KAISER, textures))
+                fprintf(stderr, "ERROR::BENCHMARK:: Could not decode '%s'\n", path.c_str());
+            sink += textures.size();
+        }, [&]() {
+            remove(cache.c_str());
+        }));
+    }
+
+    //Syntax highlighting of the whole shader, as after SetText
+    for (int lines : {1000, 10000}) {
+        TextEditor editor;
+        editor.SetLanguageDefinition(TextEditor::LanguageDefinition::GLSL());
+        editor.SetText(MakeShaderSource(lines));
+        results.push_back(Measure("colorize/lines_" + std::to_string(lines), runs, [&]() {
+            editor.ColorizeRange(0, editor.GetTotalLines());
+        }));
+    }
+
+    //Screenshot encode, one row of tiles at a time as Screenshot streams them
+    for (int size : sizes) {
+        int rows = std::min(size, SCREENSHOT_TILE_SIZE);
+        std::vector<unsigned char> tile((size_t)size * rows * 3);
+        std::vector<float> hdrTile(tile.size());
+        for (size_t i = 0; i < tile.size(); i++) {
+            tile[i] = (unsigned char)(i * 7 % 251);
+            hdrTile[i] = tile[i] / 64.0f;
+        }
+        std::string bmp = "benchmark_screenshot_" + std::to_string(size) + ".bmp";
+        std::string pfm = ReplaceExtension(bmp, ".pfm");
+        files.push_back(bmp);
+        files.push_back(pfm);
+        results.push_back(Measure("screenshot_bmp/" + std::to_string(size), runs, [&]() {
+            BMPWriter writer;
+            writer.Open(bmp.c_str(), size, size);
+            for (int y = 0; y < size; y += rows)
+                writer.WriteRows(tile.data(), rows);
+            if (!writer.Close())
+                fprintf(stderr, "ERROR::BENCHMARK:: Could not write '%s'\n", bmp.c_str());
+        }));
+        results.push_back(Measure("screenshot_pfm/" + std::to_string(size), runs, [&]() {
+            PFMWriter writer;
+            writer.Open(pfm.c_str(), size, size);
+            for (int y = 0; y < size; y += rows)
+                writer.WriteRows(hdrTile.data(), rows);
+            if (!writer.Close())
+                fprintf(stderr, "ERROR::BENCHMARK:: Could not write '%s'\n", pfm.c_str());
+        }));
+    }
+
+    for (const std::string &file : files)
+        remove(file.c_str());
+
+    if (!WriteResults(output, results, runs))
+        return 2;
+    printf("Results written to '%s'\n", output);
+
+    if (baselinePath == NULL)
+        return 0;
+    std::vector<BenchmarkResult> baseline;
+    if (!ReadResults(baselinePath, baseline))
+        return 2;
+    int regressions = CompareResults(results, baseline, tolerance);
+    if (regressions > 0) {
+        fprintf(stderr, "ERROR::BENCHMARK:: %d case(s) more than %.2fx slower than '%s'\n", regressions, tolerance, baselinePath);
+        return 1;
+    }
+    return 0;
+}
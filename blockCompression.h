@@ -0,0 +1,163 @@
+#ifndef __BLOCKCOMPRESSION__
+#define __BLOCKCOMPRESSION__
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+// Encoders and decoders of single 4x4 blocks of the BC1, BC4 and BC5 formats.
+// Blocks are read from and written to images of `stride` bytes per row.
+
+
+static uint16_t PackRGB565(const float c[3]) {
+    int r = std::min(31, std::max(0, (int)(c[0] * 31.0f / 255.0f + 0.5f)));
+    int g = std::min(63, std::max(0, (int)(c[1] * 63.0f / 255.0f + 0.5f)));
+    int b = std::min(31, std::max(0, (int)(c[2] * 31.0f / 255.0f + 0.5f)));
+    return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static void UnpackRGB565(uint16_t c, int rgb[3]) {
+    rgb[0] = ((c >> 11) & 31) * 255 / 31;
+    rgb[1] = ((c >> 5) & 63) * 255 / 63;
+    rgb[2] = (c & 31) * 255 / 31;
+}
+
+// 8 bytes: two RGB565 end points along the principal axis of the block colors, 2 bits per texel
+void EncodeBC1Block(const unsigned char *pixels, int stride, int channels, unsigned char *block) {
+    float colors[16][3];
+    float mean[3] = {0, 0, 0};
+    for (int i = 0; i < 16; i++) {
+        const unsigned char *p = pixels + (i / 4) * stride + (i % 4) * channels;
+        for (int c = 0; c < 3; c++) {
+            colors[i][c] = p[channels >= 3 ? c : 0];
+            mean[c] += colors[i][c] / 16.0f;
+        }
+    }
+
+    //Principal axis of the colors, by power iteration on their covariance
+    float cov[6] = {0, 0, 0, 0, 0, 0};
+    for (int i = 0; i < 16; i++) {
+        float r = colors[i][0] - mean[0], g = colors[i][1] - mean[1], b = colors[i][2] - mean[2];
+        cov[0] += r * r; cov[1] += r * g; cov[2] += r * b;
+        cov[3] += g * g; cov[4] += g * b; cov[5] += b * b;
+    }
+    float axis[3] = {1, 1, 1};
+    for (int it = 0; it < 8; it++) {
+        float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+        float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+        float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+        float length = std::max(std::max(fabsf(x), fabsf(y)), fabsf(z));
+        if (length == 0)
+            break;
+        axis[0] = x / length; axis[1] = y / length; axis[2] = z / length;
+    }
+
+    float minT = 1e30f, maxT = -1e30f;
+    for (int i = 0; i < 16; i++) {
+        float t = (colors[i][0] - mean[0]) * axis[0] + (colors[i][1] - mean[1]) * axis[1] + (colors[i][2] - mean[2]) * axis[2];
+        minT = std::min(minT, t);
+        maxT = std::max(maxT, t);
+    }
+    float axisLength = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+    float end0[3], end1[3];
+    for (int c = 0; c < 3; c++) {
+        end0[c] = axisLength > 0 ? mean[c] + axis[c] * maxT / axisLength : mean[c];
+        end1[c] = axisLength > 0 ? mean[c] + axis[c] * minT / axisLength : mean[c];
+    }
+
+    uint16_t c0 = PackRGB565(end0);
+    uint16_t c1 = PackRGB565(end1);
+    if (c0 < c1)
+        std::swap(c0, c1);
+
+    uint32_t indices = 0;
+    if (c0 != c1) {
+        //Four color mode: c0, c1, 2/3 c0 + 1/3 c1, 1/3 c0 + 2/3 c1
+        int palette[4][3];
+        UnpackRGB565(c0, palette[0]);
+        UnpackRGB565(c1, palette[1]);
+        for (int c = 0; c < 3; c++) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+        for (int i = 0; i < 16; i++) {
+            int best = 0;
+            float bestDistance = 1e30f;
+            for (int j = 0; j < 4; j++) {
+                float r = colors[i][0] - palette[j][0], g = colors[i][1] - palette[j][1], b = colors[i][2] - palette[j][2];
+                float distance = r * r + g * g + b * b;
+                if (distance < bestDistance) {
+                    bestDistance = distance;
+                    best = j;
+                }
+            }
+            indices |= (uint32_t)best << (2 * i);
+        }
+    }
+
+    block[0] = c0 & 0xFF;
+    block[1] = c0 >> 8;
+    block[2] = c1 & 0xFF;
+    block[3] = c1 >> 8;
+    for (int i = 0; i < 4; i++)
+        block[4 + i] = (indices >> (8 * i)) & 0xFF;
+}
+
+// 8 bytes: the min and max of one channel, 3 bits per texel
+void EncodeBC4Block(const unsigned char *pixels, int stride, int channels, int channel, unsigned char *block) {
+    int values[16];
+    int lo = 255, hi = 0;
+    for (int i = 0; i < 16; i++) {
+        values[i] = pixels[(i / 4) * stride + (i % 4) * channels + channel];
+        lo = std::min(lo, values[i]);
+        hi = std::max(hi, values[i]);
+    }
+
+    block[0] = hi;
+    block[1] = lo;
+    uint64_t indices = 0;
+    if (hi > lo) {
+        //Eight value mode: 0 is hi, 1 is lo, 2..7 interpolate from hi to lo
+        for (int i = 0; i < 16; i++) {
+            int step = (int)((float)(hi - values[i]) * 7.0f / (hi - lo) + 0.5f);
+            int index = step == 0 ? 0 : step == 7 ? 1 : step + 1;
+            indices |= (uint64_t)index << (3 * i);
+        }
+    }
+    for (int i = 0; i < 6; i++)
+        block[2 + i] = (indices >> (8 * i)) & 0xFF;
+}
+
+// 16 bytes: BC4 blocks of the first two channels
+void EncodeBC5Block(const unsigned char *pixels, int stride, int channels, unsigned char *block) {
+    EncodeBC4Block(pixels, stride, channels, 0, block);
+    EncodeBC4Block(pixels, stride, channels, 1, block + 8);
+}
+
+void DecodeBC4Block(const unsigned char *block, unsigned char *pixels, int stride, int channels, int channel) {
+    int a0 = block[0], a1 = block[1];
+    int palette[8] = {a0, a1};
+    if (a0 > a1) {
+        for (int i = 1; i < 7; i++)
+            palette[i + 1] = ((7 - i) * a0 + i * a1) / 7;
+    } else {
+        for (int i = 1; i < 5; i++)
+            palette[i + 1] = ((5 - i) * a0 + i * a1) / 5;
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+
+    uint64_t indices = 0;
+    for (int i = 0; i < 6; i++)
+        indices |= (uint64_t)block[2 + i] << (8 * i);
+    for (int i = 0; i < 16; i++)
+        pixels[(i / 4) * stride + (i % 4) * channels + channel] = palette[(indices >> (3 * i)) & 7];
+}
+
+void DecodeBC5Block(const unsigned char *block, unsigned char *pixels, int stride, int channels) {
+    DecodeBC4Block(block, pixels, stride, channels, 0);
+    DecodeBC4Block(block + 8, pixels, stride, channels, 1);
+}
+
+#endif
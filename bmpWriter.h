@@ -0,0 +1,95 @@
+#ifndef __BMPWRITER__
+#define __BMPWRITER__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+// Writes a 24-bit BMP file a few rows at a time, so images larger than the memory
+// we want to spend on them can be encoded while they are rendered.
+// Rows are written bottom to top, as BMP stores them and as OpenGL reads them back,
+// in BGR order (GL_BGR with a pack alignment of 1).
+class BMPWriter {
+public:
+    ~BMPWriter() { Close(); }
+
+    bool Open(const char* path, int width, int height);
+    // Appends count rows of width * 3 bytes each
+    bool WriteRows(const unsigned char *rows, int count);
+    // Returns false if the file could not be written or is missing rows
+    bool Close();
+
+    int Width() const { return _width; }
+    int Height() const { return _height; }
+
+private:
+    FILE *_file = NULL;
+    int _width = 0;
+    int _height = 0;
+    int _written = 0;
+    bool _failed = false;
+};
+
+
+static void PutLE(unsigned char *p, uint32_t value, int bytes) {
+    for (int i = 0; i < bytes; i++)
+        p[i] = (value >> (8 * i)) & 0xFF;
+}
+
+bool BMPWriter::Open(const char* path, int width, int height) {
+    Close();
+    uint64_t rowBytes = ((uint64_t)width * 3 + 3) & ~(uint64_t)3;
+    uint64_t fileBytes = 54 + rowBytes * height;
+    if (width <= 0 || height <= 0 || fileBytes > 0xFFFFFFFFull) {
+        fprintf(stderr, "ERROR::SCREENSHOT:: Cannot write a %dx%d BMP file\n", width, height);
+        return false;
+    }
+    _file = fopen(path, "wb");
+    if (_file == NULL) {
+        fprintf(stderr, "ERROR::SCREENSHOT:: Could not write '%s'\n", path);
+        return false;
+    }
+    _width = width;
+    _height = height;
+    _written = 0;
+    _failed = false;
+
+    unsigned char header[54] = {'B', 'M'};
+    PutLE(header + 2, fileBytes, 4);
+    PutLE(header + 10, 54, 4);      //pixel data offset
+    PutLE(header + 14, 40, 4);      //info header size
+    PutLE(header + 18, width, 4);
+    PutLE(header + 22, height, 4);  //positive: bottom-up rows
+    PutLE(header + 26, 1, 2);       //planes
+    PutLE(header + 28, 24, 2);      //bits per pixel
+    PutLE(header + 34, rowBytes * height, 4);
+    _failed = fwrite(header, sizeof(header), 1, _file) != 1;
+    return !_failed;
+}
+
+bool BMPWriter::WriteRows(const unsigned char *rows, int count) {
+    if (_file == NULL || _written + count > _height)
+        return false;
+    size_t bytes = (size_t)_width * 3;
+    const unsigned char padding[3] = {0, 0, 0};
+    size_t pad = ((bytes + 3) & ~(size_t)3) - bytes;
+    for (int y = 0; y < count; y++) {
+        if (fwrite(rows + y * bytes, 1, bytes, _file) != bytes || fwrite(padding, 1, pad, _file) != pad)
+            _failed = true;
+    }
+    _written += count;
+    return !_failed;
+}
+
+bool BMPWriter::Close() {
+    if (_file == NULL)
+        return false;
+    bool complete = !_failed && _written == _height;
+    if (fclose(_file) != 0)
+        complete = false;
+    _file = NULL;
+    return complete;
+}
+
+#endif
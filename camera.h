@@ -0,0 +1,32 @@
+#ifndef __CAMERA__
+#define __CAMERA__
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+// Orbit camera shared by the viewer and the offline tools: the camera turns around the
+// origin, azimuth and elevation are in hundredths of radians, zoom is the distance.
+
+struct CameraPreset {
+    const char* name;
+    float azimuth;
+    float elevation;
+    float zoom;
+};
+
+//The Pos1 to Pos4 views of the viewer
+static const CameraPreset CAMERA_PRESETS[4] = {
+    {"pos1", 312, 27, 1.2f},
+    {"pos2", 309, 27, 8.3f},
+    {"pos3", 316, 40, 13},
+    {"pos4", 326, 62, 27}
+};
+
+static glm::vec3 OrbitPosition(float azimuth, float elevation, float zoom) {
+    glm::mat4 rotation(1);
+    rotation = glm::rotate(rotation, azimuth * 0.01f, glm::vec3(0, -1, 0));
+    rotation = glm::rotate(rotation, elevation * 0.01f, glm::vec3(-1, 0, 0));
+    return glm::vec3(rotation * glm::vec4(0, 0, zoom, 1));
+}
+
+#endif
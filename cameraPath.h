@@ -0,0 +1,233 @@
+#ifndef __CAMERAPATH__
+#define __CAMERAPATH__
+
+#include <GL/glew.h>
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include "camera.h"
+
+//Time step of the playback, whatever the frame rate of the recording
+#define CAMERA_PATH_STEP (1.0f / 60.0f)
+
+
+// Orbit camera state at a time of a recorded path, in seconds
+struct CameraKey {
+    float time;
+    float azimuth;
+    float elevation;
+    float zoom;
+};
+
+// Keyframes of the camera, recorded once per frame from the drag and zoom input, saved as
+// text lines "time azimuth elevation zoom" and linearly interpolated on playback.
+class CameraPath {
+public:
+    void Clear() { _keys.clear(); }
+    void Record(float time, float azimuth, float elevation, float zoom);
+    bool Save(const char* path) const;
+    bool Load(const char* path);
+
+    // State at time, clamped to the ends of the path
+    CameraKey Sample(float time) const;
+    float Duration() const { return _keys.empty() ? 0 : _keys.back().time; }
+    bool Empty() const { return _keys.empty(); }
+    int Count() const { return _keys.size(); }
+
+private:
+    std::vector<CameraKey> _keys;
+};
+
+struct FrameTiming {
+    CameraKey camera;
+    double cpuMs;   //time spent in the renderer's Draw call
+    double gpuMs;
+};
+
+struct BenchmarkSummary {
+    int frames = 0;
+    double gpuMean = 0, gpuMedian = 0, gpuP95 = 0, gpuMax = 0;
+    double cpuMean = 0, cpuMedian = 0, cpuP95 = 0, cpuMax = 0;
+};
+
+// Plays a path back one fixed step per frame, so that every run draws the same frames at the
+// same TIME, and times each of them. The GPU time comes from timestamp queries read once the
+// run is over, which do not interfere with the elapsed time queries of the renderer.
+class CameraBenchmark {
+public:
+    ~CameraBenchmark();
+
+    void Start(const CameraPath &path, float step = CAMERA_PATH_STEP);
+    bool Running() const { return _running; }
+    // Camera of the next frame, false once the path is over
+    bool Next(CameraKey &key);
+    // Bracket the Draw call of the frame
+    void BeginFrame();
+    void EndFrame(double cpuMs);
+    // Reads the timings back, writes them as CSV to path and returns false if it could not
+    bool Finish(const char* path);
+
+    float Step() const { return _step; }
+    const BenchmarkSummary& Summary() const { return _summary; }
+
+private:
+    CameraPath _path;
+    float _step = CAMERA_PATH_STEP;
+    int _frame = 0;
+    bool _running = false;
+    std::vector<GLuint> _queries;   //begin and end timestamps of each frame
+    std::vector<FrameTiming> _timings;
+    BenchmarkSummary _summary;
+};
+
+
+void CameraPath::Record(float time, float azimuth, float elevation, float zoom) {
+    _keys.push_back({time, azimuth, elevation, zoom});
+}
+
+bool CameraPath::Save(const char* path) const {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "ERROR::CAMERA_PATH:: Could not write '%s'\n", path);
+        return false;
+    }
+    fprintf(file, "# time azimuth elevation zoom\n");
+    for (const CameraKey &key : _keys)
+        fprintf(file, "%.6f %.6f %.6f %.6f\n", key.time, key.azimuth, key.elevation, key.zoom);
+    return fclose(file) == 0;
+}
+
+bool CameraPath::Load(const char* path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "ERROR::CAMERA_PATH:: Could not read '%s'\n", path);
+        return false;
+    }
+    std::vector<CameraKey> keys;
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        CameraKey key;
+        if (line[0] == '#')
+            continue;
+        if (sscanf(line, "%f %f %f %f", &key.time, &key.azimuth, &key.elevation, &key.zoom) == 4)
+            keys.push_back(key);
+    }
+    fclose(file);
+    if (keys.empty()) {
+        fprintf(stderr, "ERROR::CAMERA_PATH:: No keys in '%s'\n", path);
+        return false;
+    }
+    _keys = keys;
+    return true;
+}
+
+CameraKey CameraPath::Sample(float time) const {
+    if (_keys.empty())
+        return {time, 0, 0, 1};
+    auto next = std::upper_bound(_keys.begin(), _keys.end(), time, [](float t, const CameraKey &key) {
+        return t < key.time;
+    });
+    if (next == _keys.begin())
+        return {time, _keys.front().azimuth, _keys.front().elevation, _keys.front().zoom};
+    if (next == _keys.end())
+        return {time, _keys.back().azimuth, _keys.back().elevation, _keys.back().zoom};
+    const CameraKey &a = *(next - 1);
+    const CameraKey &b = *next;
+    float f = b.time > a.time ? (time - a.time) / (b.time - a.time) : 0;
+    return {time, a.azimuth + (b.azimuth - a.azimuth) * f, a.elevation + (b.elevation - a.elevation) * f, a.zoom + (b.zoom - a.zoom) * f};
+}
+
+
+CameraBenchmark::~CameraBenchmark() {
+    if (!_queries.empty())
+        glDeleteQueries(_queries.size(), _queries.data());
+}
+
+void CameraBenchmark::Start(const CameraPath &path, float step) {
+    if (!_queries.empty())
+        glDeleteQueries(_queries.size(), _queries.data());
+    _path = path;
+    _step = step;
+    _frame = 0;
+    _running = !path.Empty();
+    _timings.clear();
+    int frames = (int)floorf(path.Duration() / step) + 1;
+    _timings.reserve(frames);
+    _queries.resize(2 * frames);
+    glGenQueries(_queries.size(), _queries.data());
+}
+
+bool CameraBenchmark::Next(CameraKey &key) {
+    if (!_running || 2 * (_frame + 1) > (int)_queries.size())
+        return false;
+    key = _path.Sample(_frame * _step);
+    _timings.resize(_frame + 1);
+    _timings[_frame] = {key, 0, 0};
+    return true;
+}
+
+void CameraBenchmark::BeginFrame() {
+    if (_running && _frame < (int)_timings.size())
+        glQueryCounter(_queries[2 * _frame], GL_TIMESTAMP);
+}
+
+void CameraBenchmark::EndFrame(double cpuMs) {
+    if (!_running || _frame >= (int)_timings.size())
+        return;
+    glQueryCounter(_queries[2 * _frame + 1], GL_TIMESTAMP);
+    _timings[_frame].cpuMs = cpuMs;
+    _frame++;
+}
+
+static double Percentile(std::vector<double> values, double p) {
+    if (values.empty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, (size_t)(p * (values.size() - 1) + 0.5))];
+}
+
+bool CameraBenchmark::Finish(const char* path) {
+    _running = false;
+    std::vector<double> gpu, cpu;
+    for (int i = 0; i < _frame; i++) {
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(_queries[2 * i], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(_queries[2 * i + 1], GL_QUERY_RESULT, &end);
+        _timings[i].gpuMs = (end - begin) / 1e6;
+        gpu.push_back(_timings[i].gpuMs);
+        cpu.push_back(_timings[i].cpuMs);
+    }
+    _timings.resize(_frame);
+
+    _summary = BenchmarkSummary();
+    _summary.frames = _frame;
+    for (int i = 0; i < _frame; i++) {
+        _summary.gpuMean += gpu[i] / _frame;
+        _summary.cpuMean += cpu[i] / _frame;
+    }
+    _summary.gpuMedian = Percentile(gpu, 0.5);
+    _summary.gpuP95 = Percentile(gpu, 0.95);
+    _summary.gpuMax = Percentile(gpu, 1);
+    _summary.cpuMedian = Percentile(cpu, 0.5);
+    _summary.cpuP95 = Percentile(cpu, 0.95);
+    _summary.cpuMax = Percentile(cpu, 1);
+    printf("Benchmark: %d frames, GPU mean %.3f median %.3f p95 %.3f max %.3f ms, CPU mean %.3f median %.3f p95 %.3f max %.3f ms\n",
+           _summary.frames, _summary.gpuMean, _summary.gpuMedian, _summary.gpuP95, _summary.gpuMax,
+           _summary.cpuMean, _summary.cpuMedian, _summary.cpuP95, _summary.cpuMax);
+
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "ERROR::BENCHMARK:: Could not write '%s'\n", path);
+        return false;
+    }
+    fprintf(file, "frame,time,azimuth,elevation,zoom,cpu_ms,gpu_ms\n");
+    for (int i = 0; i < _frame; i++) {
+        const FrameTiming &timing = _timings[i];
+        fprintf(file, "%d,%.6f,%.4f,%.4f,%.4f,%.4f,%.4f\n", i, timing.camera.time, timing.camera.azimuth, timing.camera.elevation,
+                timing.camera.zoom, timing.cpuMs, timing.gpuMs);
+    }
+    return fclose(file) == 0;
+}
+
+#endif
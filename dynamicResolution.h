@@ -0,0 +1,111 @@
+#ifndef __DYNAMICRESOLUTION__
+#define __DYNAMICRESOLUTION__
+
+#include <GL/glew.h>
+#include <math.h>
+#include <algorithm>
+
+//Timer queries in flight, read back a few frames later so the CPU never waits on them
+#define DYNAMIC_RESOLUTION_QUERIES 4
+//Frames without camera or viewport change after which the view is rendered at full resolution
+#define DYNAMIC_RESOLUTION_IDLE_FRAMES 30
+//The scale moves in steps of this size, so that the render size does not change every frame
+#define DYNAMIC_RESOLUTION_STEP 0.05f
+
+
+// Chooses the resolution scale of the viewport from the GPU time of the previous frames,
+// so that the estimated time of the next one stays within budgetMs. The cost of a frame is
+// taken as proportional to its pixel count: scale = sqrt(budget / full resolution time).
+class DynamicResolution {
+public:
+    ~DynamicResolution();
+
+    bool enabled = false;
+    float budgetMs = 8.0f;
+    float minScale = 0.25f;
+
+    // Scale of the frame about to be drawn, 1 when disabled or idle
+    float Scale() const { return enabled && !Idle() ? _scale : 1.0f; }
+    bool Idle() const { return _stillFrames >= DYNAMIC_RESOLUTION_IDLE_FRAMES; }
+    float GpuMs() const { return _gpuMs; }
+
+    // Reads the finished timings and returns the scale of the next frame; changed when the view moved
+    float Update(bool changed);
+    // Bracket the draw calls of the frame
+    void Begin();
+    void End();
+
+private:
+    void Collect();
+
+    GLuint _queries[DYNAMIC_RESOLUTION_QUERIES] = {0};
+    float _queryScales[DYNAMIC_RESOLUTION_QUERIES] = {0};
+    bool _pending[DYNAMIC_RESOLUTION_QUERIES] = {false};
+    int _next = 0;
+    bool _timing = false;
+    float _frameScale = 1.0f;
+    float _scale = 1.0f;
+    float _gpuMs = 0;
+    float _fullMs = 0;
+    int _stillFrames = 0;
+};
+
+
+DynamicResolution::~DynamicResolution() {
+    if (_queries[0] != 0)
+        glDeleteQueries(DYNAMIC_RESOLUTION_QUERIES, _queries);
+}
+
+float DynamicResolution::Update(bool changed) {
+    if (_queries[0] == 0)
+        glGenQueries(DYNAMIC_RESOLUTION_QUERIES, _queries);
+    _stillFrames = changed ? 0 : _stillFrames + 1;
+    Collect();
+    _frameScale = Scale();
+    return _frameScale;
+}
+
+void DynamicResolution::Begin() {
+    _timing = !_pending[_next]; //Every query still in flight: this frame is not timed
+    if (!_timing)
+        return;
+    _queryScales[_next] = _frameScale;
+    glBeginQuery(GL_TIME_ELAPSED, _queries[_next]);
+}
+
+void DynamicResolution::End() {
+    if (!_timing)
+        return;
+    glEndQuery(GL_TIME_ELAPSED);
+    _pending[_next] = true;
+    _next = (_next + 1) % DYNAMIC_RESOLUTION_QUERIES;
+    _timing = false;
+}
+
+//Reads the finished queries, oldest first, and moves the scale toward the budget
+void DynamicResolution::Collect() {
+    for (int i = 0; i < DYNAMIC_RESOLUTION_QUERIES; i++) {
+        int q = (_next + i) % DYNAMIC_RESOLUTION_QUERIES;
+        if (!_pending[q])
+            continue;
+        GLint available = 0;
+        glGetQueryObjectiv(_queries[q], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(_queries[q], GL_QUERY_RESULT, &ns);
+        _pending[q] = false;
+        if (ns == 0) //Not measured by the driver
+            continue;
+
+        //Full resolution time, averaged over the last frames to damp the driver's noise
+        _gpuMs = ns / 1e6f;
+        float fullMs = _gpuMs / (_queryScales[q] * _queryScales[q]);
+        _fullMs = _fullMs > 0 ? _fullMs * 0.7f + fullMs * 0.3f : fullMs;
+        float target = sqrtf(budgetMs / _fullMs);
+        float scale = _scale + (std::min(1.0f, std::max(minScale, target)) - _scale) * 0.5f;
+        _scale = std::min(1.0f, std::max(minScale, roundf(scale / DYNAMIC_RESOLUTION_STEP) * DYNAMIC_RESOLUTION_STEP));
+    }
+}
+
+#endif
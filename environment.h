@@ -0,0 +1,323 @@
+#ifndef __ENVIRONMENT__
+#define __ENVIRONMENT__
+
+#include <sys/stat.h>
+#include <math.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include "textureLoader.h"
+
+// Prefiltered equirectangular environment: level i of the radiance texture is the
+// environment convolved with a gaussian slope lobe (as used by LEAN mapping) of standard
+// deviation maxSigma * i / (levels - 1), and a 9x1 texture holds its irradiance as SH9.
+// Both are computed on the loader threads and cached next to the source image.
+
+struct EnvironmentSettings {
+    int maxLevels = 8;
+    int samples = 64;
+    float maxSigma = 0.5f;
+};
+
+
+static uint16_t FloatToHalf(float value) {
+    if (value != value)
+        return 0; //NaN
+    uint32_t bits;
+    memcpy(&bits, &value, 4);
+    uint32_t sign = (bits >> 16) & 0x8000;
+    int exponent = (int)((bits >> 23) & 0xFF) - 127 + 15;
+    uint32_t mantissa = bits & 0x7FFFFF;
+    if (exponent <= 0)
+        return sign; //flush denormals
+    if (exponent >= 31)
+        return sign | 0x7BFF;
+    //A rounding carry out of the mantissa steps up the exponent, clamped to the largest finite half
+    return sign | std::min<uint32_t>(((uint32_t)exponent << 10) + ((mantissa + 0x1000) >> 13), 0x7BFF);
+}
+
+// Float image pyramid, box filtered, to importance sample the environment without noise
+struct RadianceImage {
+    int width = 0;
+    int height = 0;
+    std::vector<float> rgb;
+
+    void Sample(float u, float v, float out[3]) const;
+};
+
+void RadianceImage::Sample(float u, float v, float out[3]) const {
+    float x = u * width - 0.5f;
+    float y = std::min(std::max(v * height - 0.5f, 0.0f), height - 1.0f);
+    int x0 = (int)floorf(x), y0 = (int)floorf(y);
+    float fx = x - x0, fy = y - y0;
+    int x1 = x0 + 1, y1 = std::min(y0 + 1, height - 1);
+    x0 = ((x0 % width) + width) % width;
+    x1 = ((x1 % width) + width) % width;
+    for (int c = 0; c < 3; c++) {
+        float a = rgb[3 * (y0 * width + x0) + c] * (1 - fx) + rgb[3 * (y0 * width + x1) + c] * fx;
+        float b = rgb[3 * (y1 * width + x0) + c] * (1 - fx) + rgb[3 * (y1 * width + x1) + c] * fx;
+        out[c] = a * (1 - fy) + b * fy;
+    }
+}
+
+static RadianceImage HalfRadiance(const RadianceImage &image) {
+    RadianceImage half;
+    half.width = std::max(1, image.width / 2);
+    half.height = std::max(1, image.height / 2);
+    half.rgb.resize((size_t)half.width * half.height * 3);
+    for (int y = 0; y < half.height; y++)
+        for (int x = 0; x < half.width; x++)
+            for (int c = 0; c < 3; c++) {
+                int x0 = std::min(2 * x, image.width - 1), x1 = std::min(2 * x + 1, image.width - 1);
+                int y0 = std::min(2 * y, image.height - 1), y1 = std::min(2 * y + 1, image.height - 1);
+                half.rgb[3 * (y * half.width + x) + c] = 0.25f * (image.rgb[3 * (y0 * image.width + x0) + c] + image.rgb[3 * (y0 * image.width + x1) + c]
+                                                                + image.rgb[3 * (y1 * image.width + x0) + c] + image.rgb[3 * (y1 * image.width + x1) + c]);
+            }
+    return half;
+}
+
+static void EquirectDirection(float u, float v, float d[3]) {
+    float phi = (u - 0.5f) * 2.0f * (float)M_PI;
+    float theta = v * (float)M_PI;
+    d[0] = sinf(theta) * cosf(phi);
+    d[1] = cosf(theta);
+    d[2] = sinf(theta) * sinf(phi);
+}
+
+static void EquirectCoordinates(const float d[3], float &u, float &v) {
+    u = atan2f(d[2], d[0]) / (2.0f * (float)M_PI) + 0.5f;
+    v = acosf(std::min(1.0f, std::max(-1.0f, d[1]))) / (float)M_PI;
+}
+
+// Rows [from, to) of a level prefiltered with the lobe of standard deviation sigma,
+// assuming the view, normal and reflection directions are the same
+static void PrefilterRows(const std::vector<RadianceImage> &pyramid, float sigma, int samples, int width, int height, int from, int to, float *out) {
+    float alpha2 = 2.0f * sigma * sigma;
+    float texelAngle = 4.0f * (float)M_PI / ((float)pyramid[0].width * pyramid[0].height);
+
+    for (int y = from; y < to; y++) {
+        for (int x = 0; x < width; x++) {
+            float n[3];
+            EquirectDirection((x + 0.5f) / width, (y + 0.5f) / height, n);
+
+            //Tangent frame around n
+            float up[3] = {0, 1, 0};
+            if (fabsf(n[1]) > 0.999f) {
+                up[1] = 0;
+                up[0] = 1;
+            }
+            float t[3] = {up[1] * n[2] - up[2] * n[1], up[2] * n[0] - up[0] * n[2], up[0] * n[1] - up[1] * n[0]};
+            float tl = sqrtf(t[0] * t[0] + t[1] * t[1] + t[2] * t[2]);
+            t[0] /= tl; t[1] /= tl; t[2] /= tl;
+            float b[3] = {n[1] * t[2] - n[2] * t[1], n[2] * t[0] - n[0] * t[2], n[0] * t[1] - n[1] * t[0]};
+
+            float sum[3] = {0, 0, 0};
+            float weight = 0;
+            for (int i = 0; i < samples; i++) {
+                //Hammersley point mapped to gaussian slopes (Box-Muller)
+                float e1 = (i + 0.5f) / samples;
+                uint32_t bits = i;
+                bits = (bits << 16) | (bits >> 16);
+                bits = ((bits & 0x55555555u) << 1) | ((bits & 0xAAAAAAAAu) >> 1);
+                bits = ((bits & 0x33333333u) << 2) | ((bits & 0xCCCCCCCCu) >> 2);
+                bits = ((bits & 0x0F0F0F0Fu) << 4) | ((bits & 0xF0F0F0F0u) >> 4);
+                bits = ((bits & 0x00FF00FFu) << 8) | ((bits & 0xFF00FF00u) >> 8);
+                float e2 = bits * 2.3283064365386963e-10f;
+                float radius = sigma * sqrtf(-2.0f * logf(e1));
+                float sx = radius * cosf(2.0f * (float)M_PI * e2);
+                float sy = radius * sinf(2.0f * (float)M_PI * e2);
+
+                float h[3];
+                float hl = sqrtf(sx * sx + sy * sy + 1.0f);
+                for (int c = 0; c < 3; c++)
+                    h[c] = (n[c] - sx * t[c] - sy * b[c]) / hl;
+                float nh = 1.0f / hl;
+                float nl = 2.0f * nh * nh - 1.0f;
+                if (nl <= 0)
+                    continue;
+                float l[3];
+                for (int c = 0; c < 3; c++)
+                    l[c] = 2.0f * nh * h[c] - n[c];
+
+                //Read from the level whose texels cover the solid angle of the sample
+                float level = 0;
+                if (sigma > 0) {
+                    float tan2 = (sx * sx + sy * sy);
+                    float pdf = expf(-tan2 / alpha2) / (4.0f * (float)M_PI * alpha2 * nh * nh * nh * nh);
+                    level = std::max(0.0f, 0.5f * log2f(1.0f / (samples * pdf * texelAngle)) + 1.0f);
+                }
+                const RadianceImage &source = pyramid[std::min((int)pyramid.size() - 1, (int)level)];
+
+                float u, v, radiance[3];
+                EquirectCoordinates(l, u, v);
+                source.Sample(u, v, radiance);
+                for (int c = 0; c < 3; c++)
+                    sum[c] += radiance[c] * nl;
+                weight += nl;
+            }
+            for (int c = 0; c < 3; c++)
+                out[3 * (y * width + x) + c] = weight > 0 ? sum[c] / weight : 0;
+        }
+    }
+}
+
+// Irradiance SH9 coefficients (cosine lobe convolution included) of the environment
+static void ProjectIrradiance(const RadianceImage &image, float sh[27]) {
+    const float A[9] = {(float)M_PI, 2.0f * (float)M_PI / 3.0f, 2.0f * (float)M_PI / 3.0f, 2.0f * (float)M_PI / 3.0f,
+                        (float)M_PI / 4.0f, (float)M_PI / 4.0f, (float)M_PI / 4.0f, (float)M_PI / 4.0f, (float)M_PI / 4.0f};
+    for (int i = 0; i < 27; i++)
+        sh[i] = 0;
+
+    for (int y = 0; y < image.height; y++) {
+        float theta = (y + 0.5f) / image.height * (float)M_PI;
+        float solidAngle = sinf(theta) * ((float)M_PI / image.height) * (2.0f * (float)M_PI / image.width);
+        for (int x = 0; x < image.width; x++) {
+            float d[3];
+            EquirectDirection((x + 0.5f) / image.width, (y + 0.5f) / image.height, d);
+            float basis[9] = {
+                0.282095f,
+                0.488603f * d[1], 0.488603f * d[2], 0.488603f * d[0],
+                1.092548f * d[0] * d[1], 1.092548f * d[1] * d[2], 0.315392f * (3.0f * d[2] * d[2] - 1.0f),
+                1.092548f * d[0] * d[2], 0.546274f * (d[0] * d[0] - d[1] * d[1])
+            };
+            const float *radiance = &image.rgb[3 * (y * image.width + x)];
+            for (int i = 0; i < 9; i++)
+                for (int c = 0; c < 3; c++)
+                    sh[3 * i + c] += A[i] * basis[i] * radiance[c] * solidAngle;
+        }
+    }
+}
+
+
+// Cache file layout: header, then the RGB half float levels
+struct EnvironmentCacheHeader {
+    char magic[4];
+    int64_t sourceTime;
+    int32_t width, height, levels, samples;
+    float maxSigma;
+    float sh[27];
+};
+
+static std::string EnvironmentCachePath(const std::string &path) {
+    return ReplaceExtension(path, ".radiance");
+}
+
+static void MakeEnvironmentTextures(const EnvironmentCacheHeader &header, std::vector<TextureLevel> &levels, std::vector<TextureData> &textures) {
+    TextureData radiance;
+    radiance.internalFormat = GL_RGB16F;
+    radiance.type = GL_HALF_FLOAT;
+    radiance.pixelSize = 3 * sizeof(uint16_t);
+    radiance.wrapT = GL_CLAMP_TO_EDGE;
+    radiance.storageLevels = levels.size();
+    radiance.levels = std::move(levels);
+
+    TextureData sh;
+    sh.internalFormat = GL_RGB32F;
+    sh.type = GL_FLOAT;
+    sh.pixelSize = 3 * sizeof(float);
+    sh.minFilter = GL_NEAREST;
+    sh.magFilter = GL_NEAREST;
+    sh.levels.resize(1);
+    sh.levels[0].width = 9;
+    sh.levels[0].height = 1;
+    sh.levels[0].pixels.assign((const unsigned char *)header.sh, (const unsigned char *)header.sh + sizeof(header.sh));
+
+    textures.push_back(std::move(radiance));
+    textures.push_back(std::move(sh));
+}
+
+static bool ReadEnvironmentCache(const std::string &path, int64_t sourceTime, const EnvironmentSettings &settings, std::vector<TextureData> &textures) {
+    FILE *file = fopen(EnvironmentCachePath(path).c_str(), "rb");
+    if (file == NULL)
+        return false;
+
+    EnvironmentCacheHeader header;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, "ENV2", 4) == 0
+        && header.sourceTime == sourceTime && header.samples == settings.samples && header.maxSigma == settings.maxSigma
+        && header.levels == MipLevelCount(header.width, header.height, settings.maxLevels);
+    std::vector<TextureLevel> levels(valid ? header.levels : 0);
+    for (int l = 0; l < (int)levels.size() && valid; l++) {
+        levels[l].width = std::max(1, header.width >> l);
+        levels[l].height = std::max(1, header.height >> l);
+        levels[l].pixels.resize((size_t)levels[l].width * levels[l].height * 3 * sizeof(uint16_t));
+        valid = fread(levels[l].pixels.data(), 1, levels[l].pixels.size(), file) == levels[l].pixels.size();
+    }
+    fclose(file);
+
+    if (valid)
+        MakeEnvironmentTextures(header, levels, textures);
+    return valid;
+}
+
+bool DecodeEnvironment(const std::string &path, const EnvironmentSettings &settings, std::vector<TextureData> &textures) {
+    struct stat info;
+    int64_t sourceTime = stat(path.c_str(), &info) == 0 ? (int64_t)info.st_mtime : 0;
+    if (ReadEnvironmentCache(path, sourceTime, settings, textures))
+        return true;
+
+    int w, h, nbC;
+    float *data = stbi_loadf(path.c_str(), &w, &h, &nbC, 3);
+    if (data == NULL) {
+        fprintf(stderr, "ERROR::ENVIRONMENT:: Could not load '%s': %s\n", path.c_str(), stbi_failure_reason());
+        return false;
+    }
+    std::vector<RadianceImage> pyramid(1);
+    pyramid[0].width = w;
+    pyramid[0].height = h;
+    pyramid[0].rgb.assign(data, data + (size_t)w * h * 3);
+    stbi_image_free(data);
+    while (pyramid.back().width > 1 && pyramid.back().height > 1)
+        pyramid.push_back(HalfRadiance(pyramid.back()));
+
+    EnvironmentCacheHeader header = {};
+    memcpy(header.magic, "ENV2", 4);
+    header.sourceTime = sourceTime;
+    header.width = w;
+    header.height = h;
+    header.levels = MipLevelCount(w, h, settings.maxLevels);
+    header.samples = settings.samples;
+    header.maxSigma = settings.maxSigma;
+    ProjectIrradiance(pyramid[std::min<size_t>(2, pyramid.size() - 1)], header.sh);
+
+    unsigned int threadCount = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<TextureLevel> levels(header.levels);
+    for (int l = 0; l < header.levels; l++) {
+        TextureLevel &level = levels[l];
+        level.width = std::max(1, w >> l);
+        level.height = std::max(1, h >> l);
+        std::vector<float> rgb((size_t)level.width * level.height * 3);
+        if (l == 0) {
+            rgb = pyramid[0].rgb;
+        } else {
+            float sigma = settings.maxSigma * l / (header.levels - 1);
+            int count = std::min<int>(threadCount, level.height);
+            std::vector<std::thread> workers;
+            for (int t = 0; t < count; t++)
+                workers.push_back(std::thread(PrefilterRows, std::cref(pyramid), sigma, settings.samples, level.width, level.height,
+                                              level.height * t / count, level.height * (t + 1) / count, rgb.data()));
+            for (auto &worker : workers)
+                worker.join();
+        }
+
+        level.pixels.resize(rgb.size() * sizeof(uint16_t));
+        uint16_t *halves = (uint16_t *)level.pixels.data();
+        for (size_t i = 0; i < rgb.size(); i++)
+            halves[i] = FloatToHalf(rgb[i]);
+    }
+
+    FILE *file = fopen(EnvironmentCachePath(path).c_str(), "wb");
+    if (file != NULL) {
+        fwrite(&header, sizeof(header), 1, file);
+        for (auto &level : levels)
+            fwrite(level.pixels.data(), 1, level.pixels.size(), file);
+        fclose(file);
+    } else {
+        fprintf(stderr, "ERROR::ENVIRONMENT:: Could not write the cache of '%s'\n", path.c_str());
+    }
+
+    MakeEnvironmentTextures(header, levels, textures);
+    return true;
+}
+
+#endif
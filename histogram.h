@@ -0,0 +1,267 @@
+#ifndef __HISTOGRAM__
+#define __HISTOGRAM__
+
+#include <sys/stat.h>
+#include <math.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <array>
+#include "textureLoader.h"
+
+// Precomputation of histogram-preserving tiling and blending (Heitz & Neyret 2018).
+// The colors are moved to their PCA space, then each channel is replaced by the gaussian
+// quantile of its rank. The shader blends the gaussian texture and maps the result back
+// with the inverse LUT, a 2D array with one layer per mip level of the gaussian texture.
+// The first row of a layer holds the inverse CDF of each channel, prefiltered for that
+// level, and the second row the PCA basis (texels 0 to 2) and the mean color (texel 3).
+
+#define HISTOGRAM_LUT_SIZE 256
+#define HISTOGRAM_STD (1.0 / 6.0)   //standard deviation of the gaussian values, centered on 0.5
+
+
+// Inverse of the standard normal CDF (Acklam's rational approximation)
+static double NormalQuantile(double p) {
+    static const double a[6] = {-3.969683028665376e+01, 2.209460984245205e+02, -2.759285104469687e+02, 1.383577518672690e+02, -3.066479806614716e+01, 2.506628277459239e+00};
+    static const double b[5] = {-5.447609879822406e+01, 1.615858368580409e+02, -1.556989798598866e+02, 6.680131188771972e+01, -1.328068155288572e+01};
+    static const double c[6] = {-7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00, -2.549732539343734e+00, 4.374664141464968e+00, 2.938163982698783e+00};
+    static const double d[4] = {7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00, 3.754408661907416e+00};
+    if (p < 0.02425) {
+        double q = sqrt(-2 * log(p));
+        return (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) / ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+    }
+    if (p > 1 - 0.02425)
+        return -NormalQuantile(1 - p);
+    double q = p - 0.5, r = q * q;
+    return (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) * q / (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1);
+}
+
+// Eigenvectors (columns of vectors) of a symmetric 3x3 matrix, by Jacobi rotations
+static void SymmetricEigenvectors(double m[3][3], double vectors[3][3]) {
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            vectors[i][j] = i == j;
+
+    for (int sweep = 0; sweep < 32; sweep++) {
+        double off = fabs(m[0][1]) + fabs(m[0][2]) + fabs(m[1][2]);
+        if (off < 1e-12)
+            break;
+        for (int p = 0; p < 2; p++) {
+            for (int q = p + 1; q < 3; q++) {
+                if (fabs(m[p][q]) < 1e-15)
+                    continue;
+                double theta = (m[q][q] - m[p][p]) / (2 * m[p][q]);
+                double t = (theta >= 0 ? 1 : -1) / (fabs(theta) + sqrt(theta * theta + 1));
+                double c = 1 / sqrt(t * t + 1), s = t * c;
+                for (int k = 0; k < 3; k++) {
+                    double mkp = m[k][p], mkq = m[k][q];
+                    m[k][p] = c * mkp - s * mkq;
+                    m[k][q] = s * mkp + c * mkq;
+                }
+                for (int k = 0; k < 3; k++) {
+                    double mpk = m[p][k], mqk = m[q][k];
+                    m[p][k] = c * mpk - s * mqk;
+                    m[q][k] = s * mpk + c * mqk;
+                }
+                for (int k = 0; k < 3; k++) {
+                    double vkp = vectors[k][p], vkq = vectors[k][q];
+                    vectors[k][p] = c * vkp - s * vkq;
+                    vectors[k][q] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+}
+
+
+// Cache file layout: header, gaussian texels (RGB8) and the inverse LUT texels (RGB32F)
+struct HistogramCacheHeader {
+    char magic[4];
+    int64_t sourceTime;
+    int32_t width, height, lutSize;
+};
+
+// Inverse LUT of a mip level whose gaussian values lost `lost` of their variance by
+// averaging: a coarse value x stands for fine values distributed as N(x, lost), so the
+// level maps x to the mean of the full resolution LUT over that distribution
+static void PrefilterLUT(const std::vector<float> &lut, const float lost[3], std::vector<float> &prefiltered) {
+    prefiltered = lut;
+    for (int c = 0; c < 3; c++) {
+        float sigma = sqrtf(std::max(0.0f, lost[c]));
+        if (sigma * HISTOGRAM_LUT_SIZE < 0.5f)
+            continue;
+        int radius = (int)ceilf(4.0f * sigma * HISTOGRAM_LUT_SIZE);
+        for (int i = 0; i < HISTOGRAM_LUT_SIZE; i++) {
+            double sum = 0, weight = 0;
+            for (int k = -radius; k <= radius; k++) {
+                float d = k / (sigma * HISTOGRAM_LUT_SIZE);
+                float w = expf(-0.5f * d * d);
+                int j = std::min(HISTOGRAM_LUT_SIZE - 1, std::max(0, i + k)); //values beyond the LUT are its ends
+                sum += w * lut[3 * j + c];
+                weight += w;
+            }
+            prefiltered[3 * i + c] = sum / weight;
+        }
+    }
+}
+
+static void MakeHistogramTextures(int width, int height, std::vector<unsigned char> &gaussian, std::vector<float> &lut, int mip_levels, MipFilter filter, std::vector<TextureData> &textures) {
+    TextureData gauss;
+    gauss.levels.resize(1);
+    gauss.levels[0].width = width;
+    gauss.levels[0].height = height;
+    gauss.levels[0].pixels = std::move(gaussian);
+    gauss.storageLevels = MipLevelCount(width, height, mip_levels);
+    GenerateMipChain(gauss, filter, 0);
+
+    TextureData inverse;
+    inverse.internalFormat = GL_RGB32F;
+    inverse.type = GL_FLOAT;
+    inverse.pixelSize = 3 * sizeof(float);
+    inverse.wrapS = GL_CLAMP_TO_EDGE;
+    inverse.wrapT = GL_CLAMP_TO_EDGE;
+    inverse.minFilter = GL_LINEAR;
+    inverse.layers = gauss.levels.size();
+    inverse.levels.resize(inverse.layers);
+
+    //Variance of the gaussian values of every level, then one LUT per level, each on its own thread
+    std::vector<std::array<float, 3>> variance(inverse.layers);
+    std::vector<std::thread> workers;
+    for (int l = 0; l < inverse.layers; l++) {
+        workers.push_back(std::thread([&, l]() {
+            const TextureLevel &level = gauss.levels[l];
+            size_t count = (size_t)level.width * level.height;
+            for (int c = 0; c < 3; c++) {
+                double sum = 0, sum2 = 0;
+                for (size_t i = 0; i < count; i++) {
+                    double g = level.pixels[3 * i + c] / 255.0;
+                    sum += g;
+                    sum2 += g * g;
+                }
+                variance[l][c] = std::max(0.0, sum2 / count - (sum / count) * (sum / count));
+            }
+        }));
+    }
+    for (auto &worker : workers)
+        worker.join();
+    workers.clear();
+
+    for (int l = 0; l < inverse.layers; l++) {
+        workers.push_back(std::thread([&, l]() {
+            float lost[3];
+            for (int c = 0; c < 3; c++)
+                lost[c] = variance[0][c] - variance[l][c];
+            std::vector<float> prefiltered;
+            PrefilterLUT(lut, lost, prefiltered);
+
+            TextureLevel &layer = inverse.levels[l];
+            layer.width = HISTOGRAM_LUT_SIZE;
+            layer.height = 2;
+            const unsigned char *bytes = (const unsigned char *)prefiltered.data();
+            layer.pixels.assign(bytes, bytes + prefiltered.size() * sizeof(float));
+        }));
+    }
+    for (auto &worker : workers)
+        worker.join();
+
+    textures.push_back(std::move(gauss));
+    textures.push_back(std::move(inverse));
+}
+
+// Gaussian texture and inverse LUT of a w*h RGB float image, cached in cachePath
+// (keyed by the modification time of sourcePath)
+bool GaussianizeTexture(const std::string &sourcePath, const std::string &cachePath, const float *pixels, int w, int h, int mip_levels, MipFilter filter, std::vector<TextureData> &textures) {
+    size_t count = (size_t)w * h;
+    std::vector<unsigned char> gaussian(count * 3);
+    std::vector<float> lut(HISTOGRAM_LUT_SIZE * 2 * 3, 0.0f);
+
+    struct stat info;
+    int64_t sourceTime = stat(sourcePath.c_str(), &info) == 0 ? (int64_t)info.st_mtime : 0;
+    FILE *file = fopen(cachePath.c_str(), "rb");
+    if (file != NULL) {
+        HistogramCacheHeader header;
+        bool valid = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, "GAU1", 4) == 0 && header.sourceTime == sourceTime
+            && header.width == w && header.height == h && header.lutSize == HISTOGRAM_LUT_SIZE
+            && fread(gaussian.data(), 1, gaussian.size(), file) == gaussian.size()
+            && fread(lut.data(), sizeof(float), lut.size(), file) == lut.size();
+        fclose(file);
+        if (valid) {
+            MakeHistogramTextures(w, h, gaussian, lut, mip_levels, filter, textures);
+            return true;
+        }
+    }
+
+    //PCA of the colors
+    double mean[3] = {0, 0, 0};
+    for (size_t i = 0; i < count; i++)
+        for (int c = 0; c < 3; c++)
+            mean[c] += pixels[3 * i + c] / (double)count;
+    double covariance[3][3] = {{0}};
+    for (size_t i = 0; i < count; i++)
+        for (int a = 0; a < 3; a++)
+            for (int b = 0; b < 3; b++)
+                covariance[a][b] += (pixels[3 * i + a] - mean[a]) * (pixels[3 * i + b] - mean[b]) / count;
+    double basis[3][3];
+    SymmetricEigenvectors(covariance, basis);
+
+    std::vector<float> projected[3];
+    for (int c = 0; c < 3; c++) {
+        projected[c].resize(count);
+        for (size_t i = 0; i < count; i++)
+            projected[c][i] = (pixels[3 * i + 0] - mean[0]) * basis[0][c] + (pixels[3 * i + 1] - mean[1]) * basis[1][c] + (pixels[3 * i + 2] - mean[2]) * basis[2][c];
+    }
+
+    //Each channel on its own thread: sort by value, the rank gives the gaussian value and the sorted values the inverse CDF
+    auto gaussianize = [&](int c) {
+        std::vector<uint32_t> order(count);
+        for (size_t i = 0; i < count; i++)
+            order[i] = i;
+        const std::vector<float> &values = projected[c];
+        std::sort(order.begin(), order.end(), [&values](uint32_t a, uint32_t b) { return values[a] < values[b]; });
+
+        for (size_t rank = 0; rank < count; rank++) {
+            double g = 0.5 + HISTOGRAM_STD * NormalQuantile((rank + 0.5) / count);
+            gaussian[3 * order[rank] + c] = (unsigned char)std::min(255.0, std::max(0.0, g * 255.0 + 0.5));
+        }
+        for (int i = 0; i < HISTOGRAM_LUT_SIZE; i++) {
+            double g = (i + 0.5) / HISTOGRAM_LUT_SIZE;
+            double u = 0.5 * erfc(-((g - 0.5) / HISTOGRAM_STD) / sqrt(2.0));
+            size_t index = std::min(count - 1, (size_t)(u * count));
+            lut[3 * i + c] = values[order[index]];
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int c = 0; c < 3; c++)
+        workers.push_back(std::thread(gaussianize, c));
+    for (auto &worker : workers)
+        worker.join();
+
+    for (int c = 0; c < 3; c++) {
+        for (int k = 0; k < 3; k++)
+            lut[3 * (HISTOGRAM_LUT_SIZE + c) + k] = basis[k][c];
+        lut[3 * (HISTOGRAM_LUT_SIZE + 3) + c] = mean[c];
+    }
+
+    file = fopen(cachePath.c_str(), "wb");
+    if (file != NULL) {
+        HistogramCacheHeader header = {};
+        memcpy(header.magic, "GAU1", 4);
+        header.sourceTime = sourceTime;
+        header.width = w;
+        header.height = h;
+        header.lutSize = HISTOGRAM_LUT_SIZE;
+        fwrite(&header, sizeof(header), 1, file);
+        fwrite(gaussian.data(), 1, gaussian.size(), file);
+        fwrite(lut.data(), sizeof(float), lut.size(), file);
+        fclose(file);
+    } else {
+        fprintf(stderr, "ERROR::HISTOGRAM:: Could not write '%s'\n", cachePath.c_str());
+    }
+
+    MakeHistogramTextures(w, h, gaussian, lut, mip_levels, filter, textures);
+    return true;
+}
+
+#endif
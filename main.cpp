@@ -3,6 +3,8 @@
 // If you are new to Dear ImGui, read documentation from the docs/ folder + read the top of imgui.cpp.
 // Read online: https://github.com/ocornut/imgui/tree/master/docs
 #include "renderer3D.h"
+#include "cameraPath.h"
+#include "renderThread.h"
 
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
@@ -17,6 +19,7 @@
 #include "TextEditor.h"
 #include <iostream>
 #include <sstream>
+#include <chrono>
 #include "ImGuizmo/ImGuizmo.h"
 
 
@@ -32,6 +35,13 @@ static void glfw_error_callback(int error, const char* description)
     fprintf(stderr, "Glfw Error %d: %s\n", error, description);
 }
 
+//Result of a call to the render thread, once it has run
+template<typename T>
+static bool Ready(std::future<T> &result)
+{
+    return result.valid() && result.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
 int main(int, char**)
 {
 
@@ -72,6 +82,13 @@ int main(int, char**)
     glfwMakeContextCurrent(window);
     glfwSwapInterval(1); // Enable vsync
 
+    //Context of the render thread, sharing the textures of the window's one
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow* renderWindow = glfwCreateWindow(1, 1, "Renderer", NULL, window);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+    if (renderWindow == NULL)
+        fprintf(stderr, "ERROR::RENDER_THREAD:: No shared context, rendering on the main thread\n");
+
     // Setup glew
     GLenum res = glewInit();
     if (res != GLEW_OK) {
@@ -79,6 +96,8 @@ int main(int, char**)
         return 1;
     }
 
+    PROFILE_THREAD("Main");
+
     // Setup Dear ImGui context
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
@@ -124,26 +143,39 @@ int main(int, char**)
     float azimuth = 45;
     float elevation = 45;
     float zoom = 2;
-
-    glm::mat4 rotation(1);
-    rotation = glm::rotate(rotation, azimuth * 0.01f, glm::vec3(0, -1, 0));
-    rotation = glm::rotate(rotation, elevation * 0.01f, glm::vec3(-1, 0, 0));
-    glm::vec4 newCamPosition(0, 0, zoom, 1);
-    newCamPosition = rotation * newCamPosition;
-    glm::vec3 cameraPosition;
-    cameraPosition = newCamPosition;
+    glm::vec3 cameraPosition = OrbitPosition(azimuth, elevation, zoom);
+
+    //Camera path recorded from the viewer input, played back as a benchmark by the render thread
+    CameraPath cameraPath;
+    bool recording = false;
+    float recordTime = 0;
+    static char cameraPathFile[256] = "camera_path.txt";
+    static char benchmarkPath[256] = "benchmark.csv";
+#ifdef PROFILE
+    static char tracePath[256] = "trace.json";
+#endif
     const char* fshaderfilepath = "./shaders/fshader.glsl";
     const char* vshaderfilepath = "./shaders/vshader.glsl";
     static char albedoPath[256] = "textures/anisonoiseTile.png";
     static char normalPath[256] = "textures/anisonoiseTile_Normal.png";
 
-    Renderer3D renderer3D(size, cameraPosition, "./models/bigGrid.obj", fshaderfilepath, vshaderfilepath);
-
-    renderer3D.SetAlbedo(albedoPath);
-    renderer3D.SetNormal(normalPath);
-
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_CULL_FACE);
+    std::function<void()> makeCurrent;
+    if (renderWindow != NULL)
+        makeCurrent = [renderWindow]() { glfwMakeContextCurrent(renderWindow); };
+    RenderThread renderThread(makeCurrent, [&](glm::vec3 &camera) {
+        camera = cameraPosition;
+        Renderer3D *renderer = new Renderer3D(size, camera, "./models/bigGrid.obj", fshaderfilepath, vshaderfilepath);
+        renderer->SetAlbedo(albedoPath);
+        renderer->SetNormal(normalPath);
+        glEnable(GL_DEPTH_TEST);
+        glEnable(GL_CULL_FACE);
+        return renderer;
+    });
+    //Edited here and sent whole to the render thread on change
+    RendererSettings settings = renderThread.Settings();
+    bool comparison = false;
+    std::string fshaderCode, vshaderCode;
+    std::future<std::string> fshaderResult, vshaderResult;
 
 
 
@@ -265,6 +297,7 @@ int main(int, char**)
     // Main loop
     while (!glfwWindowShouldClose(window))
     {
+        PROFILE_ZONE("Frame");
         ImGui::SetNextWindowPos(ImVec2(0.0f, 0.0f));
         ImGui::SetNextWindowSize(ImGui::GetIO().DisplaySize);
 
@@ -283,10 +316,14 @@ int main(int, char**)
         ImGuizmo::BeginFrame();
         ImGuizmo::Enable(true);
 
+        //Last frame of the render thread, which may be several frames of the UI old
+        RendererStats stats = renderThread.Stats();
+
         
 
         // FRAGMENT SHADER EDITOR
         {
+            PROFILE_ZONE("Fragment shader editor");
             auto cpos = editorFShader.GetCursorPosition();
             ImGui::Begin("Fragment Shader", nullptr,
              ImGuiWindowFlags_NoTitleBar | 
@@ -297,7 +334,14 @@ int main(int, char**)
 
 
             if (ImGui::Button("Compile")) {
-                std::string error = renderer3D.SetFShader(editorFShader.GetText());
+                fshaderCode = editorFShader.GetText();
+                std::string code = fshaderCode;
+                fshaderResult = renderThread.Call<std::string>([code](Renderer3D &renderer) { return renderer.SetFShader(code); });
+            }
+
+            //Compiled by the render thread between two of its frames
+            if (Ready(fshaderResult)) {
+                std::string error = fshaderResult.get();
                 fsmarkers.clear();
                 if (error.compare("") != 0) {
                     int a, line, c;
@@ -308,7 +352,7 @@ int main(int, char**)
                     printf("AFTER\n");
                 } else {
                     fShaderFile.open(fshaderfilepath);
-                    fShaderFile << editorFShader.GetText();
+                    fShaderFile << fshaderCode;
                     fShaderFile.close();
                 }
                 editorFShader.SetErrorMarkers(fsmarkers);
@@ -327,6 +371,7 @@ int main(int, char**)
 
         // VERTEX SHADER EDITOR
         {
+            PROFILE_ZONE("Vertex shader editor");
             auto cpos = editorVShader.GetCursorPosition();
             ImGui::Begin("Vertex Shader", nullptr,
              ImGuiWindowFlags_NoTitleBar | 
@@ -336,8 +381,14 @@ int main(int, char**)
             ImGui::SetWindowSize(ImVec2(800, 600), ImGuiCond_FirstUseEver);
 
             if (ImGui::Button("Compile")) {
+                vshaderCode = editorVShader.GetText();
+                std::string code = vshaderCode;
+                vshaderResult = renderThread.Call<std::string>([code](Renderer3D &renderer) { return renderer.SetVShader(code); });
+            }
+
+            if (Ready(vshaderResult)) {
                 vsmarkers.clear();
-                std::string error = renderer3D.SetVShader(editorVShader.GetText());
+                std::string error = vshaderResult.get();
                 if (error.compare("") != 0) {
                     int a, line, c;
                     char message[1024];
@@ -347,7 +398,7 @@ int main(int, char**)
                     printf("AFTER\n");
                 } else {
                     vShaderFile.open(vshaderfilepath);
-                    vShaderFile << editorVShader.GetText();
+                    vShaderFile << vshaderCode;
                     vShaderFile.close();
                 }
                 editorVShader.SetErrorMarkers(vsmarkers);
@@ -365,6 +416,7 @@ int main(int, char**)
 
         // MODEL VIEWER
         {
+            PROFILE_ZONE("Model viewer");
             ImGui::Begin("Model Viewer", nullptr, 
              ImGuiWindowFlags_NoTitleBar | 
              ImGuiWindowFlags_NoDecoration | 
@@ -372,7 +424,7 @@ int main(int, char**)
              ImGuiWindowFlags_NoBackground);
 
             static bool validInput = false;
-            if (ImGui::IsWindowHovered() && ImGui::IsMouseClicked(ImGuiMouseButton_Left)) {
+            if (ImGui::IsWindowHovered() && ImGui::IsMouseClicked(ImGuiMouseButton_Left) && !stats.benchmarking) {
                 validInput = true;
             }
 
@@ -391,49 +443,51 @@ int main(int, char**)
                     elevation = currentElevation;
                     validInput = false;
                 } 
-        
-                
 
-
-                glm::mat4 rotation(1);
-                rotation = glm::rotate(rotation, currentAzimuth * 0.01f, glm::vec3(0, -1, 0));
-                rotation = glm::rotate(rotation, currentElevation * 0.01f, glm::vec3(-1, 0, 0));
-                glm::vec4 newCamPosition(0, 0, zoom, 1);
-                newCamPosition = rotation * newCamPosition;
-                cameraPosition = newCamPosition;
+                cameraPosition = OrbitPosition(currentAzimuth, currentElevation, zoom);
             }
 
-            if (ImGui::IsWindowHovered() && ImGui::GetIO().MouseWheel) {
+            if (ImGui::IsWindowHovered() && ImGui::GetIO().MouseWheel && !stats.benchmarking) {
                 zoom += (ImGui::GetIO().MouseWheel * 0.1f) * zoom;
                 zoom = std::min(100.0f, std::max(0.2f, zoom));
 
+                cameraPosition = OrbitPosition(currentAzimuth, currentElevation, zoom);
+            }
 
-                glm::mat4 rotation(1);
-                rotation = glm::rotate(rotation, currentAzimuth * 0.01f, glm::vec3(0, -1, 0));
-                rotation = glm::rotate(rotation, currentElevation * 0.01f, glm::vec3(-1, 0, 0));
-                glm::vec4 newCamPosition(0, 0, zoom, 1);
-                newCamPosition = rotation * newCamPosition;
-                cameraPosition = newCamPosition;
+            if (recording) {
+                cameraPath.Record(recordTime, currentAzimuth, currentElevation, zoom);
+                recordTime += deltaTime;
             }
 
+            //Playback: the render thread follows the path, the controls show its camera
+            if (stats.benchmarking) {
+                azimuth = stats.benchmarkKey.azimuth;
+                elevation = stats.benchmarkKey.elevation;
+                zoom = stats.benchmarkKey.zoom;
+                cameraPosition = OrbitPosition(azimuth, elevation, zoom);
+            }
 
-            renderer3D.Draw(ImVec2(ImGui::GetWindowSize().x - 16, ImGui::GetWindowSize().y - 16), clear_color, deltaTime, time);
+            renderThread.Submit({ImVec2(ImGui::GetWindowSize().x - 16, ImGui::GetWindowSize().y - 16), clear_color, deltaTime, time, cameraPosition});
+            renderThread.Show();
             ImGui::SetCursorPos(ImVec2(20, 20));
             ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+            ImGui::SetCursorPos(ImVec2(20, 40));
+            ImGui::Text("Renderer %.3f ms/frame%s", stats.renderMs, renderThread.Threaded() ? " (render thread)" : "");
             ImGuizmo::SetDrawlist();
 			ImGuizmo::SetRect(ImGui::GetWindowPos().x + ImGui::GetWindowSize().x - 150, ImGui::GetWindowPos().y + 50, 100, 100 * ImGui::GetWindowSize().y / ImGui::GetWindowSize().x);
             ImGuizmo::SetGizmoSizeClipSpace(1);
             ImGuizmo::SetOrthographic(true);
 
             const glm::mat4 matrix(1);
-            ImGuizmo::Manipulate((float*)&renderer3D.getViewMatrix()[0][0], (float*)& renderer3D.getProjectionMatrix()[0][0], ImGuizmo::OPERATION::TRANSLATE, ImGuizmo::MODE::WORLD, (float*)& matrix[0][0]);
-            //ImGuizmo::DrawCubes((float*)&renderer3D.getViewMatrix()[0][0], (float*)& renderer3D.getProjectionMatrix()[0][0], (float*)& matrix[0][0], 1);
+            ImGuizmo::Manipulate((float*)&stats.view[0][0], (float*)& stats.projection[0][0], ImGuizmo::OPERATION::TRANSLATE, ImGuizmo::MODE::WORLD, (float*)& matrix[0][0]);
+            //ImGuizmo::DrawCubes((float*)&stats.view[0][0], (float*)& stats.projection[0][0], (float*)& matrix[0][0], 1);
    
            
             ImGui::End();
         }
 
         {   //CAM CONTROLS
+            PROFILE_ZONE("Camera controls");
             ImGui::Begin("Camera Controls", nullptr, 
              ImGuiWindowFlags_NoTitleBar | 
              ImGuiWindowFlags_NoDecoration | 
@@ -443,57 +497,48 @@ int main(int, char**)
 
             ImGui::Text("Camera Position: %.3f, %.3f, %.3f", cameraPosition.x, cameraPosition.y, cameraPosition.z);
             ImGui::Text("Azimuth: %.3f, Elevation: %.3f, Zoom: %.3f", azimuth, elevation, zoom);
-            if (ImGui::Button("Pos1")) {
-                azimuth = 312;
-                elevation = 27;
-                zoom = 1.2;
-
-                glm::mat4 rotation(1);
-                rotation = glm::rotate(rotation, azimuth * 0.01f, glm::vec3(0, -1, 0));
-                rotation = glm::rotate(rotation, elevation * 0.01f, glm::vec3(-1, 0, 0));
-                glm::vec4 newCamPosition(0, 0, zoom, 1);
-                newCamPosition = rotation * newCamPosition;
-                cameraPosition = newCamPosition;
+            for (int i = 0; i < 4; i++) {
+                char label[8];
+                snprintf(label, sizeof(label), "Pos%d", i + 1);
+                if (i > 0)
+                    ImGui::SameLine();
+                if (ImGui::Button(label) && !stats.benchmarking) {
+                    azimuth = CAMERA_PRESETS[i].azimuth;
+                    elevation = CAMERA_PRESETS[i].elevation;
+                    zoom = CAMERA_PRESETS[i].zoom;
+                    cameraPosition = OrbitPosition(azimuth, elevation, zoom);
+                }
+            }
+
+            if (ImGui::Button(recording ? "Stop recording" : "Record path")) {
+                recording = !recording;
+                if (recording) {
+                    cameraPath.Clear();
+                    recordTime = 0;
+                }
             }
             ImGui::SameLine();
-            if (ImGui::Button("Pos2")) {
-                azimuth = 309;
-                elevation = 27;
-                zoom = 8.3;
-
-                glm::mat4 rotation(1);
-                rotation = glm::rotate(rotation, azimuth * 0.01f, glm::vec3(0, -1, 0));
-                rotation = glm::rotate(rotation, elevation * 0.01f, glm::vec3(-1, 0, 0));
-                glm::vec4 newCamPosition(0, 0, zoom, 1);
-                newCamPosition = rotation * newCamPosition;
-                cameraPosition = newCamPosition;
+            if (ImGui::Button("Save path")) {
+                cameraPath.Save(cameraPathFile);
             }
             ImGui::SameLine();
-            if (ImGui::Button("Pos3")) {
-                azimuth = 316;
-                elevation = 40;
-                zoom = 13;
-
-                glm::mat4 rotation(1);
-                rotation = glm::rotate(rotation, azimuth * 0.01f, glm::vec3(0, -1, 0));
-                rotation = glm::rotate(rotation, elevation * 0.01f, glm::vec3(-1, 0, 0));
-                glm::vec4 newCamPosition(0, 0, zoom, 1);
-                newCamPosition = rotation * newCamPosition;
-                cameraPosition = newCamPosition;
+            if (ImGui::Button("Load path")) {
+                cameraPath.Load(cameraPathFile);
             }
             ImGui::SameLine();
-            if (ImGui::Button("Pos4")) {
-                azimuth = 326;
-                elevation = 62;
-                zoom = 27;
-
-                glm::mat4 rotation(1);
-                rotation = glm::rotate(rotation, azimuth * 0.01f, glm::vec3(0, -1, 0));
-                rotation = glm::rotate(rotation, elevation * 0.01f, glm::vec3(-1, 0, 0));
-                glm::vec4 newCamPosition(0, 0, zoom, 1);
-                newCamPosition = rotation * newCamPosition;
-                cameraPosition = newCamPosition;
+            if (ImGui::Button("Play benchmark") && !recording && !stats.benchmarking) {
+                //Full resolution frames, so that runs compare
+                settings.dynamicResolution = false;
+                RendererSettings applied = settings;
+                renderThread.Post([applied](Renderer3D &renderer) { applied.Apply(renderer); });
+                renderThread.StartBenchmark(cameraPath, benchmarkPath);
             }
+            ImGui::InputText("Camera path", cameraPathFile, 256);
+            ImGui::InputText("Benchmark CSV", benchmarkPath, 256);
+            const BenchmarkSummary &summary = stats.benchmark;
+            ImGui::Text("Path: %d keys, %.2f s%s", cameraPath.Count(), cameraPath.Duration(), stats.benchmarking ? " (playing)" : "");
+            ImGui::Text("%d frames, GPU mean %.3f median %.3f p95 %.3f max %.3f ms", summary.frames, summary.gpuMean, summary.gpuMedian, summary.gpuP95, summary.gpuMax);
+            ImGui::Text("CPU mean %.3f median %.3f p95 %.3f max %.3f ms", summary.cpuMean, summary.cpuMedian, summary.cpuP95, summary.cpuMax);
 
             ImGui::End();
         }
@@ -503,19 +548,160 @@ int main(int, char**)
         }
 
         {
+            PROFILE_ZONE("Set path");
             ImGui::Begin("Set Path");
 
             if (ImGui::InputText("Albedo path", albedoPath, 256, ImGuiInputTextFlags_EnterReturnsTrue)) {
-                renderer3D.SetAlbedo(albedoPath);
+                std::string path = albedoPath;
+                renderThread.Post([path](Renderer3D &renderer) { renderer.SetAlbedo(path.c_str()); });
             }
 
             if (ImGui::InputText("Normap path", normalPath, 256, ImGuiInputTextFlags_EnterReturnsTrue)) {
-                renderer3D.SetNormal(normalPath);
+                std::string path = normalPath;
+                renderThread.Post([path](Renderer3D &renderer) { renderer.SetNormal(path.c_str()); });
+            }
+
+            bool changed = false;
+            changed |= ImGui::Checkbox("Environment lighting", &settings.environment);
+            changed |= ImGui::Checkbox("Specular lobe table", &settings.lobeLUT);
+            ImGui::SameLine();
+            static LobeBenchmark lobeBenchmark;
+            static std::future<LobeBenchmark> lobeBenchmarkResult;
+            if (ImGui::Button("Benchmark")) {
+                lobeBenchmarkResult = renderThread.Call<LobeBenchmark>([](Renderer3D &renderer) { return renderer.BenchmarkLobeLUT(20); });
+            }
+            if (Ready(lobeBenchmarkResult)) {
+                lobeBenchmark = lobeBenchmarkResult.get();
+            }
+            ImGui::Text("Analytic %.3f ms, table %.3f ms, error max %.4f mean %.5f", lobeBenchmark.analyticMs, lobeBenchmark.lutMs, lobeBenchmark.maxError, lobeBenchmark.meanError);
+
+            changed |= ImGui::Checkbox("Histogram-preserving tiling", &settings.histogram);
+
+            changed |= ImGui::Checkbox("Depth pre-pass", &settings.depthPrepass);
+            ImGui::SameLine();
+            static OverdrawStats overdraw;
+            static std::future<OverdrawStats> overdrawResult;
+            if (ImGui::Button("Measure overdraw")) {
+                overdrawResult = renderThread.Call<OverdrawStats>([](Renderer3D &renderer) { return renderer.MeasureOverdraw(20); });
+            }
+            if (Ready(overdrawResult)) {
+                overdraw = overdrawResult.get();
+            }
+            ImGui::Text("Shaded fragments %u, with pre-pass %u (%.1f%% saved), %.3f ms / %.3f ms", overdraw.fragments, overdraw.prepassFragments,
+                        overdraw.fragments > 0 ? 100.0 * (1.0 - (double)overdraw.prepassFragments / overdraw.fragments) : 0.0, overdraw.ms, overdraw.prepassMs);
+
+            changed |= ImGui::Checkbox("Dynamic resolution", &settings.dynamicResolution);
+            changed |= ImGui::SliderFloat("Frame budget (ms)", &settings.frameBudget, 1.0f, 50.0f);
+            ImGui::Text("Resolution scale %.2f, GPU %.2f ms", stats.resolutionScale, stats.gpuMs);
+
+            changed |= ImGui::SliderFloat("Exposure (stops)", &settings.exposure, -4.0f, 4.0f);
+            changed |= ImGui::Checkbox("Tone mapping", &settings.tonemap);
+            ImGui::SameLine();
+            changed |= ImGui::Checkbox("32-bit float target", &settings.float32Target);
+
+            //Specular variants of fshader.glsl, the differences are to the first one
+            static const char* variants[4][2] = {
+                {"Ground truth", "#define GROUND_TRUTH"},
+                {"Covariance", ""},
+                {"Constant sigma", "#define CONSTANT_SIGMA"},
+                {"Covariance 0", "#define COV0"}
+            };
+            if (ImGui::Checkbox("Compare variants", &comparison)) {
+                bool enabled = comparison;
+                renderThread.Post([enabled](Renderer3D &renderer) {
+                    renderer.ClearComparison();
+                    if (enabled) {
+                        for (auto &variant : variants)
+                            renderer.AddComparisonView(variant[0], variant[1]);
+                    }
+                });
+            }
+            ImGui::SameLine();
+            changed |= ImGui::Checkbox("Difference", &settings.comparisonDifference);
+            changed |= ImGui::SliderFloat("Difference scale", &settings.differenceScale, 1.0f, 100.0f);
+
+            if (changed) {
+                RendererSettings applied = settings;
+                renderThread.Post([applied](Renderer3D &renderer) { applied.Apply(renderer); });
             }
 
             static char screenPath[256] = "screenshots/screen.bmp";
-            if (ImGui::InputText("Screenshot", screenPath, 256, ImGuiInputTextFlags_EnterReturnsTrue)) {
-                renderer3D.Screenshot(screenPath);
+            static int screenSize[2] = {0, 0};
+            ImGui::InputInt2("Screenshot size (0: viewport)", screenSize);
+            if (ImGui::InputText("Screenshot (.bmp, .pfm)", screenPath, 256, ImGuiInputTextFlags_EnterReturnsTrue)) {
+                std::string path = screenPath;
+                int width = screenSize[0];
+                int height = screenSize[1];
+                renderThread.Post([path, width, height](Renderer3D &renderer) { renderer.Screenshot(path.c_str(), width, height); });
+            }
+#ifdef PROFILE
+            if (ImGui::InputText("Trace (Chrome JSON)", tracePath, 256, ImGuiInputTextFlags_EnterReturnsTrue)) {
+                PROFILE_DUMP(tracePath);
+            }
+#endif
+
+            ImGui::End();
+        }
+
+        {
+            PROFILE_ZONE("Memory");
+            ImGui::Begin("Memory");
+            MemoryTracker &memory = MemoryTracker::Instance();
+            const double MB = 1.0 / (1024.0 * 1024.0);
+            ImGui::Text("GPU %.1f MB, peak %.1f MB", memory.Bytes(true) * MB, memory.Peak(true) * MB);
+            ImGui::Text("CPU %.1f MB, peak %.1f MB", memory.Bytes(false) * MB, memory.Peak(false) * MB);
+
+            if (ImGui::BeginTable("Categories", 5, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+                ImGui::TableSetupColumn("Category");
+                ImGui::TableSetupColumn("Memory");
+                ImGui::TableSetupColumn("Count");
+                ImGui::TableSetupColumn("MB");
+                ImGui::TableSetupColumn("Peak MB");
+                ImGui::TableHeadersRow();
+                for (const MemoryCategory &category : memory.Categories()) {
+                    ImGui::TableNextRow();
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%s", category.name.c_str());
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%s", category.gpu ? "GPU" : "CPU");
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%d", category.count);
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%.2f", category.bytes * MB);
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%.2f", category.peak * MB);
+                }
+                ImGui::EndTable();
+            }
+
+            if (ImGui::CollapsingHeader("GPU allocations")) {
+                if (ImGui::BeginTable("Allocations", 5, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+                    ImGui::TableSetupColumn("Category");
+                    ImGui::TableSetupColumn("Format");
+                    ImGui::TableSetupColumn("Size");
+                    ImGui::TableSetupColumn("Levels");
+                    ImGui::TableSetupColumn("MB");
+                    ImGui::TableHeadersRow();
+                    for (const MemoryAllocation &allocation : memory.Allocations()) {
+                        ImGui::TableNextRow();
+                        ImGui::TableNextColumn();
+                        ImGui::Text("%s", allocation.category.c_str());
+                        ImGui::TableNextColumn();
+                        ImGui::Text("%s", MemoryTracker::FormatName(allocation.format));
+                        ImGui::TableNextColumn();
+                        if (allocation.format == 0)
+                            ImGui::Text("-");
+                        else if (allocation.layers > 1)
+                            ImGui::Text("%dx%dx%d", allocation.width, allocation.height, allocation.layers);
+                        else
+                            ImGui::Text("%dx%d", allocation.width, allocation.height);
+                        ImGui::TableNextColumn();
+                        ImGui::Text("%d", allocation.levels);
+                        ImGui::TableNextColumn();
+                        ImGui::Text("%.2f", allocation.bytes * MB);
+                    }
+                    ImGui::EndTable();
+                }
             }
 
             ImGui::End();
@@ -526,22 +712,35 @@ int main(int, char**)
         time += deltaTime;
 
         // Rendering
-        ImGui::Render();
-        int display_w, display_h;
-        glfwGetFramebufferSize(window, &display_w, &display_h);
-        glViewport(0, 0, display_w, display_h);
-        glClearColor(clear_color.x * clear_color.w, clear_color.y * clear_color.w, clear_color.z * clear_color.w, clear_color.w);
-        glClear(GL_COLOR_BUFFER_BIT);
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        {
+            PROFILE_ZONE("ImGui render");
+            PROFILE_GPU_ZONE("ImGui render");
+            ImGui::Render();
+            int display_w, display_h;
+            glfwGetFramebufferSize(window, &display_w, &display_h);
+            glViewport(0, 0, display_w, display_h);
+            glClearColor(clear_color.x * clear_color.w, clear_color.y * clear_color.w, clear_color.z * clear_color.w, clear_color.w);
+            glClear(GL_COLOR_BUFFER_BIT);
+            ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+            renderThread.Displayed();
+        }
 
         glfwSwapBuffers(window);
+        PROFILE_FRAME();
     }
 
+#ifdef PROFILE
+    PROFILE_DUMP(tracePath);
+#endif
+
     // Cleanup
+    renderThread.Stop();
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
 
+    if (renderWindow != NULL)
+        glfwDestroyWindow(renderWindow);
     glfwDestroyWindow(window);
     glfwTerminate();
 
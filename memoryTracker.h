@@ -0,0 +1,248 @@
+#ifndef __MEMORYTRACKER__
+#define __MEMORYTRACKER__
+
+#include <GL/glew.h>
+#include <stddef.h>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct MemoryCategory {
+    std::string name;
+    bool gpu;
+    int count = 0;      //GL objects, or buffers still allocated on the CPU
+    size_t bytes = 0;
+    size_t peak = 0;    //high-water mark of bytes
+};
+
+// A texture or buffer, as it was allocated
+struct MemoryAllocation {
+    std::string category;
+    GLuint name;
+    GLenum format;      //0 for buffers
+    int width;
+    int height;
+    int levels;
+    int layers;
+    size_t bytes;
+};
+
+// Bytes held per category, with their high-water marks: GL textures and buffers, recorded with
+// their format and size when allocated and removed by name when deleted, and the large CPU
+// buffers, added and freed by their owners. Shared by the whole process, as the texture
+// decoders report their buffers from the loader threads.
+class MemoryTracker {
+public:
+    static MemoryTracker& Instance() {
+        static MemoryTracker tracker;
+        return tracker;
+    }
+
+    void AddTexture(const char* category, GLuint name, GLenum format, int width, int height, int levels, int layers = 1);
+    // Allocating a buffer again (glBufferData) replaces its previous size
+    void AddBuffer(const char* category, GLuint name, size_t bytes);
+    void RemoveTextures(const GLuint *names, int count);
+    void RemoveBuffers(const GLuint *names, int count);
+
+    // CPU buffers
+    void Allocate(const char* category, size_t bytes);
+    void Free(const char* category, size_t bytes);
+
+    std::vector<MemoryCategory> Categories() const;
+    // GL objects, largest first
+    std::vector<MemoryAllocation> Allocations() const;
+    size_t Bytes(bool gpu) const { std::lock_guard<std::mutex> lock(_mutex); return _total[gpu]; }
+    size_t Peak(bool gpu) const { std::lock_guard<std::mutex> lock(_mutex); return _peak[gpu]; }
+
+    // Bytes of a texture with its mip chain, block compressed formats in 4x4 blocks;
+    // three-channel formats are counted unpadded, although drivers may store them in four
+    static size_t TextureBytes(GLenum format, int width, int height, int levels, int layers = 1);
+    static const char* FormatName(GLenum format);
+
+private:
+    MemoryTracker() {}
+    void Add(const std::string &category, bool gpu, size_t bytes);
+    void Remove(const std::string &category, bool gpu, size_t bytes);
+    static int BlockBytes(GLenum format);
+    static int PixelBytes(GLenum format);
+
+    mutable std::mutex _mutex;
+    std::map<std::string, MemoryCategory> _categories;
+    std::map<GLuint, MemoryAllocation> _textures;
+    std::map<GLuint, MemoryAllocation> _buffers;
+    size_t _total[2] = {0, 0};  //CPU, GPU
+    size_t _peak[2] = {0, 0};
+};
+
+
+void MemoryTracker::AddTexture(const char* category, GLuint name, GLenum format, int width, int height, int levels, int layers) {
+    MemoryAllocation allocation = {category, name, format, width, height, levels, layers, TextureBytes(format, width, height, levels, layers)};
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto previous = _textures.find(name);
+    if (previous != _textures.end())
+        Remove(previous->second.category, true, previous->second.bytes);
+    _textures[name] = allocation;
+    Add(allocation.category, true, allocation.bytes);
+}
+
+void MemoryTracker::AddBuffer(const char* category, GLuint name, size_t bytes) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto previous = _buffers.find(name);
+    if (previous != _buffers.end())
+        Remove(previous->second.category, true, previous->second.bytes);
+    _buffers[name] = {category, name, 0, 0, 0, 1, 1, bytes};
+    Add(category, true, bytes);
+}
+
+void MemoryTracker::RemoveTextures(const GLuint *names, int count) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (int i = 0; i < count; i++) {
+        auto it = _textures.find(names[i]);
+        if (it == _textures.end())
+            continue;
+        Remove(it->second.category, true, it->second.bytes);
+        _textures.erase(it);
+    }
+}
+
+void MemoryTracker::RemoveBuffers(const GLuint *names, int count) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (int i = 0; i < count; i++) {
+        auto it = _buffers.find(names[i]);
+        if (it == _buffers.end())
+            continue;
+        Remove(it->second.category, true, it->second.bytes);
+        _buffers.erase(it);
+    }
+}
+
+void MemoryTracker::Allocate(const char* category, size_t bytes) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    Add(category, false, bytes);
+}
+
+void MemoryTracker::Free(const char* category, size_t bytes) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    Remove(category, false, bytes);
+}
+
+void MemoryTracker::Add(const std::string &category, bool gpu, size_t bytes) {
+    MemoryCategory &entry = _categories[category];
+    entry.name = category;
+    entry.gpu = gpu;
+    entry.count++;
+    entry.bytes += bytes;
+    entry.peak = std::max(entry.peak, entry.bytes);
+    _total[gpu] += bytes;
+    _peak[gpu] = std::max(_peak[gpu], _total[gpu]);
+}
+
+void MemoryTracker::Remove(const std::string &category, bool gpu, size_t bytes) {
+    MemoryCategory &entry = _categories[category];
+    entry.count--;
+    entry.bytes -= std::min(entry.bytes, bytes);
+    _total[gpu] -= std::min(_total[gpu], bytes);
+}
+
+std::vector<MemoryCategory> MemoryTracker::Categories() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::vector<MemoryCategory> categories;
+    for (auto &entry : _categories)
+        categories.push_back(entry.second);
+    std::stable_sort(categories.begin(), categories.end(), [](const MemoryCategory &a, const MemoryCategory &b) {
+        return a.gpu > b.gpu;
+    });
+    return categories;
+}
+
+std::vector<MemoryAllocation> MemoryTracker::Allocations() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::vector<MemoryAllocation> allocations;
+    for (auto &entry : _textures)
+        allocations.push_back(entry.second);
+    for (auto &entry : _buffers)
+        allocations.push_back(entry.second);
+    std::sort(allocations.begin(), allocations.end(), [](const MemoryAllocation &a, const MemoryAllocation &b) {
+        return a.bytes > b.bytes;
+    });
+    return allocations;
+}
+
+size_t MemoryTracker::TextureBytes(GLenum format, int width, int height, int levels, int layers) {
+    int blockBytes = BlockBytes(format);
+    size_t bytes = 0;
+    for (int l = 0; l < std::max(1, levels); l++) {
+        int w = std::max(1, width >> l);
+        int h = std::max(1, height >> l);
+        bytes += blockBytes > 0 ? (size_t)((w + 3) / 4) * ((h + 3) / 4) * blockBytes : (size_t)w * h * PixelBytes(format);
+    }
+    return bytes * std::max(1, layers);
+}
+
+int MemoryTracker::BlockBytes(GLenum format) {
+    switch (format) {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RED_RGTC1:
+        return 8;
+    case GL_COMPRESSED_RG_RGTC2:
+    case GL_COMPRESSED_RGBA_BPTC_UNORM:
+    case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+int MemoryTracker::PixelBytes(GLenum format) {
+    switch (format) {
+    case GL_R8: return 1;
+    case GL_RG8: return 2;
+    case GL_RGB8: case GL_SRGB8: return 3;
+    case GL_RGBA8: case GL_SRGB8_ALPHA8: return 4;
+    case GL_R16F: return 2;
+    case GL_RG16F: return 4;
+    case GL_RGB16F: return 6;
+    case GL_RGBA16F: return 8;
+    case GL_R32F: return 4;
+    case GL_RG32F: return 8;
+    case GL_RGB32F: return 12;
+    case GL_RGBA32F: return 16;
+    case GL_DEPTH_COMPONENT24: return 4; //padded to 32 bits
+    case GL_DEPTH_COMPONENT32F: return 4;
+    default: return 4;
+    }
+}
+
+const char* MemoryTracker::FormatName(GLenum format) {
+    switch (format) {
+    case 0: return "buffer";
+    case GL_R8: return "R8";
+    case GL_RG8: return "RG8";
+    case GL_RGB8: return "RGB8";
+    case GL_SRGB8: return "SRGB8";
+    case GL_RGBA8: return "RGBA8";
+    case GL_SRGB8_ALPHA8: return "SRGB8_A8";
+    case GL_R16F: return "R16F";
+    case GL_RG16F: return "RG16F";
+    case GL_RGB16F: return "RGB16F";
+    case GL_RGBA16F: return "RGBA16F";
+    case GL_R32F: return "R32F";
+    case GL_RG32F: return "RG32F";
+    case GL_RGB32F: return "RGB32F";
+    case GL_RGBA32F: return "RGBA32F";
+    case GL_DEPTH_COMPONENT24: return "DEPTH24";
+    case GL_DEPTH_COMPONENT32F: return "DEPTH32F";
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: return "BC1";
+    case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT: return "BC1 sRGB";
+    case GL_COMPRESSED_RED_RGTC1: return "BC4";
+    case GL_COMPRESSED_RG_RGTC2: return "BC5";
+    case GL_COMPRESSED_RGBA_BPTC_UNORM: return "BC7";
+    case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM: return "BC7 sRGB";
+    default: return "other";
+    }
+}
+
+#endif
@@ -0,0 +1,206 @@
+#ifndef __MIPMAP__
+#define __MIPMAP__
+
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+enum MipFilter {
+    MIP_FILTER_BOX,
+    MIP_FILTER_KAISER,
+    MIP_FILTER_LANCZOS
+};
+
+enum MipFlags {
+    MIP_SRGB = 1,       //8-bit values are sRGB encoded, average them in linear space
+    MIP_NORMALS = 2     //RGB values are unit vectors, renormalize each level
+};
+
+
+// Computes a mip chain one level at a time on the CPU, each level filtered from the
+// previous one kept in float, with wrapping borders since every texture repeats.
+class MipGenerator {
+public:
+    MipGenerator(int width, int height, int channels, const unsigned char *pixels, MipFilter filter, int flags);
+
+    // Filters the next level, returns false once the current one is 1x1
+    bool Next();
+    void Store(unsigned char *pixels) const;
+
+    int Width() const { return _width; }
+    int Height() const { return _height; }
+
+private:
+    //Source pixel and weight of every tap of every destination pixel along one axis
+    struct Taps {
+        int count = 0;
+        std::vector<int> source;
+        std::vector<float> weight;
+    };
+
+    Taps ComputeTaps(int sourceSize, int size) const;
+    float Weight(float t) const;
+
+    int _width;
+    int _height;
+    int _channels;
+    MipFilter _filter;
+    int _flags;
+    std::vector<float> _level;
+    std::vector<float> _rows;
+};
+
+
+static float SRGBToLinear(float c) {
+    return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static float LinearToSRGB(float c) {
+    return c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+}
+
+static float Sinc(float x) {
+    if (fabsf(x) < 1e-6f)
+        return 1.0f;
+    x *= (float)M_PI;
+    return sinf(x) / x;
+}
+
+static float BesselI0(float x) {
+    float sum = 1.0f, term = 1.0f;
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2.0f * k)) * (x / (2.0f * k));
+        sum += term;
+    }
+    return sum;
+}
+
+
+MipGenerator::MipGenerator(int width, int height, int channels, const unsigned char *pixels, MipFilter filter, int flags)
+    : _width(width), _height(height), _channels(channels), _filter(filter), _flags(flags) {
+    float table[256];
+    for (int i = 0; i < 256; i++) {
+        if (flags & MIP_SRGB)
+            table[i] = SRGBToLinear(i / 255.0f);
+        else if (flags & MIP_NORMALS)
+            table[i] = i / 127.5f - 1.0f;
+        else
+            table[i] = i / 255.0f;
+    }
+
+    _level.resize((size_t)width * height * channels);
+    for (size_t i = 0; i < _level.size(); i++)
+        _level[i] = table[pixels[i]];
+}
+
+//Filter profiles, t in destination pixels; the windowed sincs reach 3 pixels away
+float MipGenerator::Weight(float t) const {
+    const float radius = 3.0f;
+    switch (_filter) {
+    case MIP_FILTER_KAISER: {
+        if (fabsf(t) >= radius)
+            return 0.0f;
+        const float alpha = 4.0f;
+        float x = t / radius;
+        return Sinc(t) * BesselI0(alpha * sqrtf(1.0f - x * x)) / BesselI0(alpha);
+    }
+    case MIP_FILTER_LANCZOS:
+        return fabsf(t) < radius ? Sinc(t) * Sinc(t / radius) : 0.0f;
+    default:
+        return t >= -0.5f && t < 0.5f ? 1.0f : 0.0f;
+    }
+}
+
+MipGenerator::Taps MipGenerator::ComputeTaps(int sourceSize, int size) const {
+    float scale = (float)sourceSize / size;
+    float support = (_filter == MIP_FILTER_BOX ? 0.5f : 3.0f) * scale;
+
+    Taps taps;
+    taps.count = (int)ceilf(2.0f * support) + 1;
+    taps.source.resize((size_t)size * taps.count);
+    taps.weight.resize((size_t)size * taps.count);
+    for (int i = 0; i < size; i++) {
+        float center = (i + 0.5f) * scale;
+        int first = (int)floorf(center - support);
+        float sum = 0.0f;
+        for (int k = 0; k < taps.count; k++) {
+            int s = first + k;
+            float w = Weight((s + 0.5f - center) / scale);
+            taps.source[i * taps.count + k] = ((s % sourceSize) + sourceSize) % sourceSize;
+            taps.weight[i * taps.count + k] = w;
+            sum += w;
+        }
+        for (int k = 0; k < taps.count; k++)
+            taps.weight[i * taps.count + k] /= sum;
+    }
+    return taps;
+}
+
+bool MipGenerator::Next() {
+    if (_width == 1 && _height == 1)
+        return false;
+
+    int width = std::max(1, _width / 2);
+    int height = std::max(1, _height / 2);
+    int c = _channels;
+    Taps tx = ComputeTaps(_width, width);
+    Taps ty = ComputeTaps(_height, height);
+
+    //Horizontal pass, one source row at a time
+    _rows.assign((size_t)_height * width * c, 0.0f);
+    for (int y = 0; y < _height; y++) {
+        const float *src = &_level[(size_t)y * _width * c];
+        float *dst = &_rows[(size_t)y * width * c];
+        for (int x = 0; x < width; x++) {
+            const int *source = &tx.source[x * tx.count];
+            const float *weight = &tx.weight[x * tx.count];
+            for (int k = 0; k < tx.count; k++) {
+                const float *p = src + source[k] * c;
+                for (int j = 0; j < c; j++)
+                    dst[x * c + j] += weight[k] * p[j];
+            }
+        }
+    }
+
+    //Vertical pass, whole rows at a time so the inner loop is a contiguous multiply-add
+    std::vector<float> level((size_t)width * height * c, 0.0f);
+    size_t rowSize = (size_t)width * c;
+    for (int y = 0; y < height; y++) {
+        float *dst = &level[y * rowSize];
+        for (int k = 0; k < ty.count; k++) {
+            const float *src = &_rows[ty.source[y * ty.count + k] * rowSize];
+            float w = ty.weight[y * ty.count + k];
+            for (size_t i = 0; i < rowSize; i++)
+                dst[i] += w * src[i];
+        }
+    }
+
+    if (_flags & MIP_NORMALS && c >= 3) {
+        for (size_t i = 0; i < level.size(); i += c) {
+            float length = sqrtf(level[i] * level[i] + level[i + 1] * level[i + 1] + level[i + 2] * level[i + 2]);
+            if (length > 0) {
+                level[i + 0] /= length;
+                level[i + 1] /= length;
+                level[i + 2] /= length;
+            }
+        }
+    }
+
+    _level.swap(level);
+    _width = width;
+    _height = height;
+    return true;
+}
+
+void MipGenerator::Store(unsigned char *pixels) const {
+    for (size_t i = 0; i < _level.size(); i++) {
+        float v = _level[i];
+        if (_flags & MIP_SRGB)
+            v = LinearToSRGB(std::min(1.0f, std::max(0.0f, v)));
+        else if (_flags & MIP_NORMALS)
+            v = v * 0.5f + 0.5f;
+        pixels[i] = (unsigned char)(std::min(1.0f, std::max(0.0f, v)) * 255.0f + 0.5f);
+    }
+}
+
+#endif
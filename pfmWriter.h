@@ -0,0 +1,75 @@
+#ifndef __PFMWRITER__
+#define __PFMWRITER__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+// Writes a Portable Float Map (linear float RGB) a few rows at a time, like BMPWriter.
+// PFM stores the rows bottom to top, as OpenGL reads them back, and the floats without
+// any quantization, so the file can be compared with a reference image.
+class PFMWriter {
+public:
+    ~PFMWriter() { Close(); }
+
+    bool Open(const char* path, int width, int height);
+    // Appends count rows of width * 3 floats each
+    bool WriteRows(const float *rows, int count);
+    // Returns false if the file could not be written or is missing rows
+    bool Close();
+
+    int Width() const { return _width; }
+    int Height() const { return _height; }
+
+private:
+    FILE *_file = NULL;
+    int _width = 0;
+    int _height = 0;
+    int _written = 0;
+    bool _failed = false;
+};
+
+
+bool PFMWriter::Open(const char* path, int width, int height) {
+    Close();
+    if (width <= 0 || height <= 0) {
+        fprintf(stderr, "ERROR::SCREENSHOT:: Cannot write a %dx%d PFM file\n", width, height);
+        return false;
+    }
+    _file = fopen(path, "wb");
+    if (_file == NULL) {
+        fprintf(stderr, "ERROR::SCREENSHOT:: Could not write '%s'\n", path);
+        return false;
+    }
+    _width = width;
+    _height = height;
+    _written = 0;
+
+    //A negative scale declares little endian floats
+    const uint16_t one = 1;
+    bool littleEndian = *(const unsigned char *)&one == 1;
+    _failed = fprintf(_file, "PF\n%d %d\n%s\n", width, height, littleEndian ? "-1.0" : "1.0") < 0;
+    return !_failed;
+}
+
+bool PFMWriter::WriteRows(const float *rows, int count) {
+    if (_file == NULL || _written + count > _height)
+        return false;
+    size_t floats = (size_t)_width * 3 * count;
+    if (fwrite(rows, sizeof(float), floats, _file) != floats)
+        _failed = true;
+    _written += count;
+    return !_failed;
+}
+
+bool PFMWriter::Close() {
+    if (_file == NULL)
+        return false;
+    bool complete = !_failed && _written == _height;
+    if (fclose(_file) != 0)
+        complete = false;
+    _file = NULL;
+    return complete;
+}
+
+#endif
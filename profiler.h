@@ -0,0 +1,229 @@
+#ifndef __PROFILER__
+#define __PROFILER__
+
+// Scoped zones dumped as Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+// Compiled in with -DPROFILE (make PROFILE=1) only: otherwise every macro below expands to nothing.
+//   PROFILE_ZONE("name")      times the enclosing scope on the calling thread
+//   PROFILE_GPU_ZONE("name")  times the GL commands of the enclosing scope, on a thread with a current GL context
+//   PROFILE_THREAD("name")    names the calling thread in the trace
+//   PROFILE_FRAME()           reads back the finished GPU zones of the calling thread, once per frame on each GL thread
+//   PROFILE_DUMP("path")      writes the events still in the buffers
+// Zone names must be string literals: only their address is recorded.
+
+#ifdef PROFILE
+
+#include <GL/glew.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//Events kept per thread, the oldest are overwritten
+#define PROFILE_BUFFER_EVENTS 65536
+
+struct ProfileEvent {
+    const char* name;
+    int64_t start;      //ns since the start of the program
+    int64_t duration;   //ns
+};
+
+// Ring buffer of the events of one thread. Only its thread writes to it; the lock is taken
+// by a dump from another thread, so it is never contended otherwise.
+struct ProfileBuffer {
+    int id;
+    std::string threadName;
+    std::mutex mutex;
+    std::vector<ProfileEvent> events;
+    uint64_t count = 0;
+
+    void Push(const char* name, int64_t start, int64_t duration) {
+        std::lock_guard<std::mutex> lock(mutex);
+        events[count % PROFILE_BUFFER_EVENTS] = {name, start, duration};
+        count++;
+    }
+};
+
+class Profiler {
+public:
+    static int64_t Now() {
+        static const auto origin = std::chrono::steady_clock::now();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+    }
+
+    //Buffer of the calling thread, registered on its first event and kept after it exits
+    static ProfileBuffer& ThreadBuffer() {
+        static thread_local ProfileBuffer *buffer = NULL;
+        if (buffer == NULL)
+            buffer = Instance().AddBuffer("Thread");
+        return *buffer;
+    }
+
+    static void SetThreadName(const char* name) {
+        ProfileBuffer &buffer = ThreadBuffer();
+        std::lock_guard<std::mutex> lock(buffer.mutex);
+        buffer.threadName = name;
+    }
+
+    //Timestamp queries of the calling GL thread, recycled once read: query objects are not shared between contexts
+    static GLuint AcquireQuery() {
+        std::vector<GLuint> &free = ThreadGpu().freeQueries;
+        if (free.empty()) {
+            free.resize(64);
+            glGenQueries(free.size(), free.data());
+        }
+        GLuint query = free.back();
+        free.pop_back();
+        return query;
+    }
+
+    static void AddGpuZone(const char* name, GLuint begin, GLuint end) {
+        ThreadGpu().pending.push_back({name, begin, end});
+    }
+
+    //Finished GPU zones of the calling thread, in submission order, moved to the timeline of the CPU zones
+    static void CollectGpuZones() {
+        GpuTimeline &gpu = ThreadGpu();
+        if (gpu.pending.empty())
+            return;
+        GLint64 gpuNow = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+        int64_t offset = Now() - gpuNow;
+        while (!gpu.pending.empty()) {
+            PendingGpuZone &zone = gpu.pending.front();
+            GLint available = 0;
+            glGetQueryObjectiv(zone.end, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                break;
+            GLuint64 begin = 0, end = 0;
+            glGetQueryObjectui64v(zone.begin, GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(zone.end, GL_QUERY_RESULT, &end);
+            gpu.buffer->Push(zone.name, (int64_t)begin + offset, (int64_t)(end - begin));
+            gpu.freeQueries.push_back(zone.begin);
+            gpu.freeQueries.push_back(zone.end);
+            gpu.pending.pop_front();
+        }
+    }
+
+    static bool Dump(const char* path) {
+        FILE *file = fopen(path, "w");
+        if (file == NULL) {
+            fprintf(stderr, "ERROR::PROFILER:: Could not write '%s'\n", path);
+            return false;
+        }
+        fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+        Profiler &profiler = Instance();
+        std::lock_guard<std::mutex> lock(profiler._mutex);
+        bool first = true;
+        for (auto &buffer : profiler._buffers) {
+            std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+            fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                    first ? "" : ",\n", buffer->id, buffer->threadName.c_str());
+            first = false;
+            uint64_t begin = buffer->count > PROFILE_BUFFER_EVENTS ? buffer->count - PROFILE_BUFFER_EVENTS : 0;
+            for (uint64_t i = begin; i < buffer->count; i++) {
+                const ProfileEvent &event = buffer->events[i % PROFILE_BUFFER_EVENTS];
+                fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                        event.name, buffer->id, event.start / 1e3, event.duration / 1e3);
+            }
+        }
+        fprintf(file, "\n]}\n");
+        if (fclose(file) != 0)
+            return false;
+        printf("Trace written to '%s'\n", path);
+        return true;
+    }
+
+private:
+    struct PendingGpuZone {
+        const char* name;
+        GLuint begin;
+        GLuint end;
+    };
+
+    //GPU zones of one GL thread, shown as a track named after the thread. Never destroyed, as the buffers.
+    struct GpuTimeline {
+        ProfileBuffer *buffer;
+        std::deque<PendingGpuZone> pending;
+        std::vector<GLuint> freeQueries;
+    };
+
+    Profiler() {}
+
+    static GpuTimeline& ThreadGpu() {
+        static thread_local GpuTimeline *gpu = NULL;
+        if (gpu == NULL) {
+            gpu = new GpuTimeline();
+            gpu->buffer = Instance().AddBuffer(("GPU (" + ThreadBuffer().threadName + ")").c_str());
+        }
+        return *gpu;
+    }
+
+    //Never destroyed, so that threads still running at exit can record into their buffers
+    static Profiler& Instance() {
+        static Profiler *profiler = new Profiler();
+        return *profiler;
+    }
+
+    ProfileBuffer* AddBuffer(const char* name) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _buffers.emplace_back(new ProfileBuffer());
+        ProfileBuffer *buffer = _buffers.back().get();
+        buffer->id = _buffers.size();
+        buffer->threadName = name;
+        buffer->events.resize(PROFILE_BUFFER_EVENTS);
+        return buffer;
+    }
+
+    std::mutex _mutex;
+    std::vector<std::unique_ptr<ProfileBuffer>> _buffers;
+};
+
+class ProfileZone {
+public:
+    ProfileZone(const char* name) : _name(name), _start(Profiler::Now()) {}
+    ~ProfileZone() { Profiler::ThreadBuffer().Push(_name, _start, Profiler::Now() - _start); }
+
+private:
+    const char* _name;
+    int64_t _start;
+};
+
+// Timestamps around the commands of a scope. Timestamp queries, unlike elapsed time ones,
+// can nest and overlap with the timer queries of the renderer.
+class GpuProfileZone {
+public:
+    GpuProfileZone(const char* name) : _name(name), _begin(Profiler::AcquireQuery()) { glQueryCounter(_begin, GL_TIMESTAMP); }
+    ~GpuProfileZone() {
+        GLuint end = Profiler::AcquireQuery();
+        glQueryCounter(end, GL_TIMESTAMP);
+        Profiler::AddGpuZone(_name, _begin, end);
+    }
+
+private:
+    const char* _name;
+    GLuint _begin;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_GPU_ZONE(name) GpuProfileZone PROFILE_CONCAT(gpuProfileZone, __LINE__)(name)
+#define PROFILE_THREAD(name) Profiler::SetThreadName(name)
+#define PROFILE_FRAME() Profiler::CollectGpuZones()
+#define PROFILE_DUMP(path) Profiler::Dump(path)
+
+#else
+
+#define PROFILE_ZONE(name)
+#define PROFILE_GPU_ZONE(name)
+#define PROFILE_THREAD(name)
+#define PROFILE_FRAME()
+#define PROFILE_DUMP(path) false
+
+#endif
+
+#endif
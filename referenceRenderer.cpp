@@ -0,0 +1,558 @@
+// Software reference of the viewer's shading, runs without a GPU:
+//   reference_renderer <pos1|pos2|pos3|pos4> output.pfm [width height samples threads]
+// Loads the viewer's mesh and normal map, casts samples x samples stratified rays per pixel
+// and shades every hit from the full resolution slope map. The pixel footprint is integrated
+// by sampling instead of by the LEAN mip maps, so the result is the ground truth that
+// groundTruth(n) approximates on the GPU. Hits are shaded in packets of 8 (AVX2 when the
+// compiler targets it) and the image is written as a PFM file of linear float RGB, before the
+// viewer's tone mapping, in the same format as its .pfm screenshots.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#include "camera.h"
+#include "pfmWriter.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#define TILE_SIZE 16
+
+//Shading constants of shaders/fshader.glsl
+static const float SLOPE_S = 25;
+static const glm::vec3 LIGHT_COLOR = glm::vec3(1.0f, 0.8f, 0.7f) * 2.0f;
+static const glm::vec3 AMBIENT_COLOR = glm::vec3(0.1f, 0.25f, 0.35f);
+static const glm::vec3 DIFFUSE_COLOR = glm::vec3(0.2f, 0.3f, 0.5f) * 0.75f;
+static const glm::vec3 CLEAR_COLOR = glm::vec3(33.0f / 255.0f, 33.0f / 255.0f, 35.0f / 255.0f);
+
+
+/////////// 8-WIDE FLOATS
+
+#ifdef __AVX2__
+struct float8 {
+    __m256 v;
+    float8() {}
+    float8(__m256 v) : v(v) {}
+    float8(float f) : v(_mm256_set1_ps(f)) {}
+};
+
+static inline float8 operator+(float8 a, float8 b) { return _mm256_add_ps(a.v, b.v); }
+static inline float8 operator-(float8 a, float8 b) { return _mm256_sub_ps(a.v, b.v); }
+static inline float8 operator*(float8 a, float8 b) { return _mm256_mul_ps(a.v, b.v); }
+static inline float8 operator/(float8 a, float8 b) { return _mm256_div_ps(a.v, b.v); }
+static inline float8 Min(float8 a, float8 b) { return _mm256_min_ps(a.v, b.v); }
+static inline float8 Max(float8 a, float8 b) { return _mm256_max_ps(a.v, b.v); }
+static inline float8 Sqrt(float8 a) { return _mm256_sqrt_ps(a.v); }
+static inline float8 Floor(float8 a) { return _mm256_floor_ps(a.v); }
+static inline float8 Less(float8 a, float8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+static inline float8 Select(float8 mask, float8 a, float8 b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+static inline float8 Load(const float *p) { return _mm256_loadu_ps(p); }
+static inline void Store(float *p, float8 a) { _mm256_storeu_ps(p, a.v); }
+//base[2 * (y * width + x)], the index is computed in integer lanes since floats lose texels above 2^24
+static inline float8 Gather(const float *base, float8 x, float8 y, int width) {
+    __m256i texel = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_cvtps_epi32(y.v), _mm256_set1_epi32(width)), _mm256_cvtps_epi32(x.v));
+    return _mm256_i32gather_ps(base, texel, 8);
+}
+
+//Cephes polynomial on [-ln2/2, ln2/2], scaled by 2^n through the exponent bits
+static inline float8 Exp(float8 x) {
+    x = Min(Max(x, -87.0f), 87.0f);
+    float8 n = _mm256_round_ps((x * 1.44269504f).v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    float8 r = x - n * 0.693359375f + n * 2.12194440e-4f;
+    float8 p = 1.9875691500e-4f;
+    p = p * r + 1.3981999507e-3f;
+    p = p * r + 8.3334519073e-3f;
+    p = p * r + 4.1665795894e-2f;
+    p = p * r + 1.6666665459e-1f;
+    p = p * r + 5.0000001201e-1f;
+    p = p * r * r + r + 1.0f;
+    __m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n.v), _mm256_set1_epi32(127)), 23);
+    return p * float8(_mm256_castsi256_ps(e));
+}
+#else
+struct float8 {
+    float v[8];
+    float8() {}
+    float8(float f) { for (int i = 0; i < 8; i++) v[i] = f; }
+};
+
+#define FLOAT8_LANES(expression) float8 r; for (int i = 0; i < 8; i++) r.v[i] = expression; return r;
+static inline float8 operator+(float8 a, float8 b) { FLOAT8_LANES(a.v[i] + b.v[i]) }
+static inline float8 operator-(float8 a, float8 b) { FLOAT8_LANES(a.v[i] - b.v[i]) }
+static inline float8 operator*(float8 a, float8 b) { FLOAT8_LANES(a.v[i] * b.v[i]) }
+static inline float8 operator/(float8 a, float8 b) { FLOAT8_LANES(a.v[i] / b.v[i]) }
+static inline float8 Min(float8 a, float8 b) { FLOAT8_LANES(std::min(a.v[i], b.v[i])) }
+static inline float8 Max(float8 a, float8 b) { FLOAT8_LANES(std::max(a.v[i], b.v[i])) }
+static inline float8 Sqrt(float8 a) { FLOAT8_LANES(sqrtf(a.v[i])) }
+static inline float8 Floor(float8 a) { FLOAT8_LANES(floorf(a.v[i])) }
+static inline float8 Less(float8 a, float8 b) { FLOAT8_LANES(a.v[i] < b.v[i] ? 1.0f : 0.0f) }
+static inline float8 Select(float8 mask, float8 a, float8 b) { FLOAT8_LANES(mask.v[i] != 0 ? a.v[i] : b.v[i]) }
+static inline float8 Load(const float *p) { FLOAT8_LANES(p[i]) }
+static inline void Store(float *p, float8 a) { memcpy(p, a.v, sizeof(a.v)); }
+static inline float8 Gather(const float *base, float8 x, float8 y, int width) { FLOAT8_LANES(base[((size_t)y.v[i] * width + (size_t)x.v[i]) * 2]) }
+static inline float8 Exp(float8 x) { FLOAT8_LANES(expf(x.v[i])) }
+#endif
+
+static inline float8 Fract(float8 a) { return a - Floor(a); }
+
+
+//Functions without a vector version, one lane at a time
+static inline float8 Lanes(float8 a, float (*f)(float)) {
+    float values[8];
+    Store(values, a);
+    for (int i = 0; i < 8; i++)
+        values[i] = f(values[i]);
+    return Load(values);
+}
+
+struct vec3x8 {
+    float8 x, y, z;
+};
+
+static inline float8 Dot(const vec3x8 &a, const vec3x8 &b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+static inline vec3x8 Cross(const vec3x8 &a, const vec3x8 &b) { return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x}; }
+
+
+/////////// SCENE
+
+//One triangle of the mesh, with the attributes the vertex shader passes on
+struct Triangle {
+    glm::vec3 position[3];
+    glm::vec2 uv[3];
+    glm::vec3 normal[3];
+    glm::vec3 tangent;
+};
+
+//b = (x / z, y / z) of every texel of the normal map, as the LEAN b map of the viewer
+struct SlopeMap {
+    int width = 0;
+    int height = 0;
+    std::vector<float> b;
+};
+
+//Visible samples waiting to be shaded, one lane each
+struct Packet {
+    int count = 0;
+    int pixel[8];
+    float position[3][8];
+    float uv[2][8];
+    float normal[3][8];
+    float tangent[3][8];
+};
+
+struct Scene {
+    std::vector<Triangle> triangles;
+    SlopeMap slopes;
+    glm::vec3 camera;
+    glm::mat4 inverseViewProjection;
+    glm::mat4 viewProjection;
+    int width, height, samples;
+};
+
+
+std::vector<std::string> splitstr (std::string str, std::string del) {
+    size_t pos = 0;
+    std::vector<std::string> split;
+    while ((pos = str.find(del)) != std::string::npos) {
+        split.push_back(str.substr(0, pos));
+        str.erase(0, pos + del.length());
+    }
+    split.push_back(str);
+    return split;
+}
+
+//Same parsing and tangents as Renderer3D::LoadMesh
+bool LoadMesh(const char *model, std::vector<Triangle> &triangles) {
+    std::ifstream file(model);
+    if (!file.is_open()) {
+        fprintf(stderr, "ERROR::REFERENCE:: Could not open '%s'\n", model);
+        return false;
+    }
+
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec2> uvs;
+    std::vector<glm::vec3> normals;
+    std::string line;
+    while (std::getline(file, line)) {
+        std::stringstream stream(line);
+        std::string command;
+        stream >> command;
+
+        float x, y, z;
+        if (command == "v") {
+            stream >> x >> y >> z;
+            positions.push_back(glm::vec3(x, y, z));
+        } else if (command == "vt") {
+            stream >> x >> y;
+            uvs.push_back(glm::vec2(x, y));
+        } else if (command == "vn") {
+            stream >> x >> y >> z;
+            normals.push_back(glm::vec3(x, y, z));
+        } else if (command == "f") {
+            std::vector<std::string> split = splitstr(line, " ");
+            Triangle triangle;
+            for (int i = 0; i < 3; i++) {
+                std::vector<std::string> nmbrs = splitstr(split[i + 1], "/");
+                triangle.position[i] = positions[atoi(nmbrs[0].c_str()) - 1];
+                triangle.uv[i] = uvs[atoi(nmbrs[1].c_str()) - 1];
+                triangle.normal[i] = normals[atoi(nmbrs[2].c_str()) - 1];
+            }
+
+            glm::vec3 edge1 = triangle.position[1] - triangle.position[0];
+            glm::vec3 edge2 = triangle.position[2] - triangle.position[0];
+            glm::vec2 deltaUV1 = triangle.uv[1] - triangle.uv[0];
+            glm::vec2 deltaUV2 = triangle.uv[2] - triangle.uv[0];
+            float f = 1.0f / (deltaUV1.x * deltaUV2.y - deltaUV2.x * deltaUV1.y);
+            triangle.tangent = f * (deltaUV2.y * edge1 - deltaUV1.y * edge2);
+            triangles.push_back(triangle);
+        }
+    }
+    return true;
+}
+
+bool LoadSlopes(const char *path, SlopeMap &map) {
+    int channels;
+    unsigned char *data = stbi_load(path, &map.width, &map.height, &channels, 3);
+    if (data == NULL) {
+        fprintf(stderr, "ERROR::REFERENCE:: Could not load '%s': %s\n", path, stbi_failure_reason());
+        return false;
+    }
+    map.b.resize((size_t)map.width * map.height * 2);
+    for (size_t i = 0; i < (size_t)map.width * map.height; i++) {
+        float nx = data[3 * i + 0] / 255.0f * 2.0f - 1.0f;
+        float ny = data[3 * i + 1] / 255.0f * 2.0f - 1.0f;
+        float nz = data[3 * i + 2] / 255.0f * 2.0f - 1.0f;
+        map.b[2 * i + 0] = std::min(1.0f, std::max(-1.0f, nx / nz));
+        map.b[2 * i + 1] = std::min(1.0f, std::max(-1.0f, ny / nz));
+    }
+    stbi_image_free(data);
+    return true;
+}
+
+
+/////////// SHADING
+
+static inline float8 Wrap(float8 x, float size) {
+    x = x - Floor(x / size) * size;
+    return Select(Less(x, size), x, x - size);
+}
+
+//Bilinear fetch with repeat wrapping, as the viewer samples level 0
+static void SampleSlopes(const SlopeMap &map, float8 u, float8 v, float8 &bx, float8 &by) {
+    float8 x = u * (float)map.width - 0.5f;
+    float8 y = v * (float)map.height - 0.5f;
+    float8 x0 = Floor(x), y0 = Floor(y);
+    float8 fx = x - x0, fy = y - y0;
+    float8 x1 = Wrap(x0 + 1.0f, map.width), y1 = Wrap(y0 + 1.0f, map.height);
+    x0 = Wrap(x0, map.width);
+    y0 = Wrap(y0, map.height);
+
+    float8 texelX[4] = {x0, x1, x0, x1};
+    float8 texelY[4] = {y0, y0, y1, y1};
+    float8 weight[4] = {(1.0f - fx) * (1.0f - fy), fx * (1.0f - fy), (1.0f - fx) * fy, fx * fy};
+    bx = 0.0f;
+    by = 0.0f;
+    for (int k = 0; k < 4; k++) {
+        bx = bx + weight[k] * Gather(map.b.data(), texelX[k], texelY[k], map.width);
+        by = by + weight[k] * Gather(map.b.data() + 1, texelX[k], texelY[k], map.width);
+    }
+}
+
+static void Hash(float8 px, float8 py, float8 &hx, float8 &hy) {
+    hx = Fract(Lanes(px * 127.1f + py * 311.7f, sinf) * 43758.5453f);
+    hy = Fract(Lanes(px * 269.5f + py * 183.3f, sinf) * 43758.5453f);
+}
+
+//TilingAndBlending(bmap, uv) of the shader, x and y of b
+static void TilingAndBlending(const SlopeMap &map, float8 u, float8 v, float8 &bx, float8 &by) {
+    //TriangleGrid
+    float8 gx = u * 3.464f, gy = v * 3.464f;
+    float8 sx = gx - gy * 0.57735027f;
+    float8 sy = gy * 1.15470054f;
+    float8 baseX = Floor(sx), baseY = Floor(sy);
+    float8 tx = sx - baseX, ty = sy - baseY;
+    float8 tz = 1.0f - tx - ty;
+    float8 lower = Less(0.0f, tz);
+
+    float8 w[3] = {Select(lower, tz, 0.0f - tz), Select(lower, ty, 1.0f - ty), Select(lower, tx, 1.0f - tx)};
+    float8 vx[3] = {Select(lower, baseX, baseX + 1.0f), Select(lower, baseX, baseX + 1.0f), Select(lower, baseX + 1.0f, baseX)};
+    float8 vy[3] = {Select(lower, baseY, baseY + 1.0f), Select(lower, baseY + 1.0f, baseY), Select(lower, baseY, baseY + 1.0f)};
+
+    //Variance-preserving blending of three randomly offset fetches
+    float8 norm = Sqrt(w[0] * w[0] + w[1] * w[1] + w[2] * w[2]);
+    bx = 0.0f;
+    by = 0.0f;
+    for (int k = 0; k < 3; k++) {
+        float8 hx, hy, gx, gy;
+        Hash(vx[k], vy[k], hx, hy);
+        SampleSlopes(map, u + hx, v + hy, gx, gy);
+        bx = bx + w[k] / norm * gx;
+        by = by + w[k] / norm * gy;
+    }
+}
+
+//Color of main() in the shader: tiling and blending specular and diffuse, full resolution variance of 0
+static void ShadePacket(const Scene &scene, const Packet &packet, float color[3][8]) {
+    vec3x8 P = {Load(packet.position[0]), Load(packet.position[1]), Load(packet.position[2])};
+    vec3x8 N = {Load(packet.normal[0]), Load(packet.normal[1]), Load(packet.normal[2])};
+    vec3x8 T = {Load(packet.tangent[0]), Load(packet.tangent[1]), Load(packet.tangent[2])};
+    glm::vec3 l = glm::normalize(glm::vec3(0, 0.1f, 1));
+    vec3x8 L = {l.x, l.y, l.z};
+
+    float8 bx, by;
+    TilingAndBlending(scene.slopes, Load(packet.uv[0]), Load(packet.uv[1]), bx, by);
+
+    //Tangent space basis of GlobalToNormalSpace
+    vec3x8 c0 = Cross(N, T);
+    vec3x8 c1 = N;
+    vec3x8 c2 = {0.0f - T.x, 0.0f - T.y, 0.0f - T.z};
+
+    //Specular
+    vec3x8 V = {scene.camera.x - P.x, scene.camera.y - P.y, scene.camera.z - P.z};
+    float8 length = Sqrt(Dot(V, V));
+    vec3x8 H = {(V.x / length + L.x) * 0.5f, (V.y / length + L.y) * 0.5f, (V.z / length + L.z) * 0.5f};
+    float8 hy = Dot(H, c1);
+    float8 hbx = Dot(H, c0) / hy - bx;
+    float8 hby = Dot(H, c2) / hy - by;
+    float8 sigma = 1.0f / SLOPE_S;
+    float8 det = sigma * sigma;
+    float8 e = hbx * hbx * sigma + hby * hby * sigma;
+    float8 spec = Exp(-0.5f * e / det) / Sqrt(det);
+    spec = Select(Less(Dot(H, N), 0.0f), 0.0f, spec);
+
+    //Diffuse: micro normal (b.x, 1, -b.y) out of the tangent space, inverse(M) by its cofactors
+    float8 ml = Sqrt(bx * bx + by * by + 1.0f);
+    vec3x8 r0 = Cross(c1, c2), r1 = Cross(c2, c0), r2 = Cross(c0, c1);
+    float8 inverseDet = 1.0f / Dot(c0, r0);
+    float8 mx = bx / ml * inverseDet, my = 1.0f / ml * inverseDet, mz = (0.0f - by) / ml * inverseDet;
+    vec3x8 n = {mx * r0.x + my * r1.x + mz * r2.x, mx * r0.y + my * r1.y + mz * r2.y, mx * r0.z + my * r1.z + mz * r2.z};
+    float8 light = Dot(n, L) * 0.5f + 0.5f;
+
+    float8 highlight = spec * 0.04f;
+    for (int c = 0; c < 3; c++) {
+        float8 diffuse = (Max(light * LIGHT_COLOR[c], 0.0f) + AMBIENT_COLOR[c]) * DIFFUSE_COLOR[c];
+        Store(color[c], highlight + diffuse);
+    }
+}
+
+
+/////////// VISIBILITY
+
+static uint32_t HashSeed(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+//Closest front facing triangle along the ray, back faces are culled as in the viewer
+static bool Intersect(const Scene &scene, const std::vector<int> &candidates, glm::vec3 origin, glm::vec3 direction, int &hit, float &hitU, float &hitV) {
+    float closest = 1e30f;
+    hit = -1;
+    for (int id : candidates) {
+        const Triangle &tri = scene.triangles[id];
+        glm::vec3 e1 = tri.position[1] - tri.position[0];
+        glm::vec3 e2 = tri.position[2] - tri.position[0];
+        glm::vec3 p = glm::cross(direction, e2);
+        float det = glm::dot(e1, p);
+        if (det <= 1e-12f)
+            continue;
+        glm::vec3 s = origin - tri.position[0];
+        float u = glm::dot(s, p) / det;
+        if (u < 0 || u > 1)
+            continue;
+        glm::vec3 q = glm::cross(s, e1);
+        float v = glm::dot(direction, q) / det;
+        if (v < 0 || u + v > 1)
+            continue;
+        float t = glm::dot(e2, q) / det;
+        if (t > 0.1f && t < closest) {
+            closest = t;
+            hit = id;
+            hitU = u;
+            hitV = v;
+        }
+    }
+    return hit >= 0;
+}
+
+//Triangles whose projection may overlap each tile
+static void BinTriangles(const Scene &scene, int tilesX, int tilesY, std::vector<std::vector<int>> &bins) {
+    bins.assign((size_t)tilesX * tilesY, std::vector<int>());
+    for (int id = 0; id < (int)scene.triangles.size(); id++) {
+        float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f;
+        bool behind = false;
+        for (int k = 0; k < 3; k++) {
+            glm::vec4 clip = scene.viewProjection * glm::vec4(scene.triangles[id].position[k], 1);
+            if (clip.w <= 0.1f) {
+                behind = true;
+                break;
+            }
+            float x = (clip.x / clip.w * 0.5f + 0.5f) * scene.width;
+            float y = (0.5f - clip.y / clip.w * 0.5f) * scene.height;
+            minX = std::min(minX, x); maxX = std::max(maxX, x);
+            minY = std::min(minY, y); maxY = std::max(maxY, y);
+        }
+        int x0 = 0, y0 = 0, x1 = tilesX - 1, y1 = tilesY - 1;
+        if (!behind) {
+            x0 = std::max(0, (int)floorf(minX) / TILE_SIZE);
+            y0 = std::max(0, (int)floorf(minY) / TILE_SIZE);
+            x1 = std::min(tilesX - 1, (int)floorf(maxX) / TILE_SIZE);
+            y1 = std::min(tilesY - 1, (int)floorf(maxY) / TILE_SIZE);
+        }
+        for (int ty = y0; ty <= y1; ty++)
+            for (int tx = x0; tx <= x1; tx++)
+                bins[(size_t)ty * tilesX + tx].push_back(id);
+    }
+}
+
+//Shades the packet and adds its lanes to their pixels
+static void FlushPacket(const Scene &scene, Packet &packet, std::vector<glm::vec3> &accumulation) {
+    if (packet.count == 0)
+        return;
+    for (int i = packet.count; i < 8; i++) { //Repeat the last sample in the unused lanes
+        for (int c = 0; c < 3; c++) {
+            packet.position[c][i] = packet.position[c][packet.count - 1];
+            packet.normal[c][i] = packet.normal[c][packet.count - 1];
+            packet.tangent[c][i] = packet.tangent[c][packet.count - 1];
+        }
+        packet.uv[0][i] = packet.uv[0][packet.count - 1];
+        packet.uv[1][i] = packet.uv[1][packet.count - 1];
+    }
+    float color[3][8];
+    ShadePacket(scene, packet, color);
+    for (int i = 0; i < packet.count; i++)
+        accumulation[packet.pixel[i]] += glm::vec3(color[0][i], color[1][i], color[2][i]);
+    packet.count = 0;
+}
+
+static void RenderTile(const Scene &scene, const std::vector<int> &candidates, int tileX, int tileY, float *image) {
+    int x0 = tileX * TILE_SIZE, y0 = tileY * TILE_SIZE;
+    int x1 = std::min(scene.width, x0 + TILE_SIZE), y1 = std::min(scene.height, y0 + TILE_SIZE);
+    std::vector<glm::vec3> accumulation(TILE_SIZE * TILE_SIZE, glm::vec3(0));
+    Packet packet;
+    int n = scene.samples;
+
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+            int local = (y - y0) * TILE_SIZE + (x - x0);
+            uint32_t seed = HashSeed((uint32_t)(y * scene.width + x));
+            for (int s = 0; s < n * n; s++) {
+                //Stratified jitter inside the pixel
+                seed = HashSeed(seed + s);
+                float jx = ((s % n) + (seed & 0xFFFF) / 65536.0f) / n;
+                float jy = ((s / n) + (seed >> 16) / 65536.0f) / n;
+                glm::vec4 ndc((x + jx) / scene.width * 2.0f - 1.0f, 1.0f - (y + jy) / scene.height * 2.0f, 1.0f, 1.0f);
+                glm::vec4 far = scene.inverseViewProjection * ndc;
+                glm::vec3 direction = glm::normalize(glm::vec3(far) / far.w - scene.camera);
+
+                int hit;
+                float u, v;
+                if (!Intersect(scene, candidates, scene.camera, direction, hit, u, v)) {
+                    accumulation[local] += CLEAR_COLOR;
+                    continue;
+                }
+
+                const Triangle &tri = scene.triangles[hit];
+                float w = 1.0f - u - v;
+                glm::vec3 position = w * tri.position[0] + u * tri.position[1] + v * tri.position[2];
+                glm::vec2 uv = w * tri.uv[0] + u * tri.uv[1] + v * tri.uv[2];
+                glm::vec3 normal = w * tri.normal[0] + u * tri.normal[1] + v * tri.normal[2];
+                int i = packet.count++;
+                packet.pixel[i] = local;
+                for (int c = 0; c < 3; c++) {
+                    packet.position[c][i] = position[c];
+                    packet.normal[c][i] = normal[c];
+                    packet.tangent[c][i] = tri.tangent[c];
+                }
+                packet.uv[0][i] = uv.x;
+                packet.uv[1][i] = uv.y;
+                if (packet.count == 8)
+                    FlushPacket(scene, packet, accumulation);
+            }
+        }
+    }
+    FlushPacket(scene, packet, accumulation);
+
+    for (int y = y0; y < y1; y++)
+        for (int x = x0; x < x1; x++)
+            for (int c = 0; c < 3; c++)
+                image[((size_t)y * scene.width + x) * 3 + c] = accumulation[(y - y0) * TILE_SIZE + (x - x0)][c] / (n * n);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <pos1|pos2|pos3|pos4> output.pfm [width height samples threads]\n", argv[0]);
+        return 1;
+    }
+    const CameraPreset *preset = NULL;
+    for (const CameraPreset &p : CAMERA_PRESETS)
+        if (strcmp(p.name, argv[1]) == 0)
+            preset = &p;
+    if (preset == NULL) {
+        fprintf(stderr, "ERROR::REFERENCE:: Unknown camera preset '%s'\n", argv[1]);
+        return 1;
+    }
+
+    Scene scene;
+    scene.width = argc > 4 ? atoi(argv[3]) : 800;
+    scene.height = argc > 4 ? atoi(argv[4]) : 600;
+    scene.samples = std::max(1, argc > 5 ? atoi(argv[5]) : 4);
+    int threads = argc > 6 ? atoi(argv[6]) : (int)std::thread::hardware_concurrency();
+    threads = std::max(1, threads);
+
+    if (!LoadMesh("./models/bigGrid.obj", scene.triangles) || !LoadSlopes("textures/anisonoiseTile_Normal.png", scene.slopes))
+        return 1;
+
+    scene.camera = OrbitPosition(preset->azimuth, preset->elevation, preset->zoom);
+    glm::mat4 projection = glm::perspective<float>(glm::radians(55.0), (float)scene.width / scene.height, 0.1f, 1000.0f);
+    glm::mat4 view = glm::lookAt(scene.camera, glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
+    scene.viewProjection = projection * view;
+    scene.inverseViewProjection = glm::inverse(scene.viewProjection);
+
+    auto start = std::chrono::steady_clock::now();
+    int tilesX = (scene.width + TILE_SIZE - 1) / TILE_SIZE;
+    int tilesY = (scene.height + TILE_SIZE - 1) / TILE_SIZE;
+    std::vector<std::vector<int>> bins;
+    BinTriangles(scene, tilesX, tilesY, bins);
+
+    std::vector<float> image((size_t)scene.width * scene.height * 3);
+    std::atomic<int> nextTile(0);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.push_back(std::thread([&]() {
+            for (int tile = nextTile++; tile < tilesX * tilesY; tile = nextTile++)
+                RenderTile(scene, bins[tile], tile % tilesX, tile / tilesX, image.data());
+        }));
+    }
+    for (auto &worker : workers)
+        worker.join();
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    //PFM rows go bottom to top
+    PFMWriter writer;
+    bool written = writer.Open(argv[2], scene.width, scene.height);
+    for (int y = scene.height - 1; written && y >= 0; y--)
+        written = writer.WriteRows(image.data() + (size_t)y * scene.width * 3, 1);
+    if (!writer.Close() || !written) {
+        fprintf(stderr, "ERROR::REFERENCE:: Could not write '%s'\n", argv[2]);
+        return 1;
+    }
+    printf("%s: %dx%d, %d samples per pixel, %d threads, %.0f ms\n", argv[2], scene.width, scene.height, scene.samples * scene.samples, threads, ms);
+    return 0;
+}
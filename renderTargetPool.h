@@ -0,0 +1,158 @@
+#ifndef __RENDERTARGETPOOL__
+#define __RENDERTARGETPOOL__
+
+#include <GL/glew.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include "memoryTracker.h"
+
+//Target sides are rounded up to multiples of this, so that small resizes reuse the same storage
+#define RENDER_TARGET_BUCKET 256
+//Released targets kept for reuse, the least recently released ones are deleted first
+#define RENDER_TARGET_SPARES 2
+
+
+// A frame buffer with immutable color (RGBA8, RGBA16F or RGBA32F) and 24-bit depth storage.
+// Rendering only covers the (0, 0, width, height) sub viewport of the allocated size.
+struct RenderTarget {
+    GLuint fbo = 0;
+    GLuint color = 0;
+    GLuint depth = 0;
+    GLenum format = GL_RGBA8;
+    int width = 0;              //requested size
+    int height = 0;
+    int storageWidth = 0;       //allocated size
+    int storageHeight = 0;
+    uint64_t released = 0;
+};
+
+class RenderTargetPool {
+public:
+    ~RenderTargetPool();
+
+    // A target of width x height, reusing a spare one of the same bucket and format when there is one
+    RenderTarget* Acquire(int width, int height, GLenum format = GL_RGBA8);
+    // Resizes target within its bucket, or replaces it by another one of the same format
+    RenderTarget* Resize(RenderTarget *target, int width, int height);
+    void Release(RenderTarget *target);
+
+    size_t Bytes() const;
+    int Count() const { return _targets.size(); }
+    int SpareCount() const { return _spares.size(); }
+
+private:
+    static int Bucket(int size) { return std::max(1, (size + RENDER_TARGET_BUCKET - 1) / RENDER_TARGET_BUCKET) * RENDER_TARGET_BUCKET; }
+    static int PixelBytes(GLenum format) { return format == GL_RGBA32F ? 16 : format == GL_RGBA16F ? 8 : 4; }
+    RenderTarget* Create(int storageWidth, int storageHeight, GLenum format);
+    void Destroy(RenderTarget *target);
+
+    std::vector<RenderTarget*> _targets;
+    std::vector<RenderTarget*> _spares;
+    uint64_t _releases = 0;
+};
+
+
+RenderTargetPool::~RenderTargetPool() {
+    for (RenderTarget *target : _targets)
+        Destroy(target);
+}
+
+RenderTarget* RenderTargetPool::Acquire(int width, int height, GLenum format) {
+    int storageWidth = Bucket(width);
+    int storageHeight = Bucket(height);
+    RenderTarget *target = NULL;
+    for (size_t i = 0; i < _spares.size(); i++) {
+        if (_spares[i]->storageWidth == storageWidth && _spares[i]->storageHeight == storageHeight && _spares[i]->format == format) {
+            target = _spares[i];
+            _spares.erase(_spares.begin() + i);
+            break;
+        }
+    }
+    if (target == NULL)
+        target = Create(storageWidth, storageHeight, format);
+    target->width = width;
+    target->height = height;
+    return target;
+}
+
+RenderTarget* RenderTargetPool::Resize(RenderTarget *target, int width, int height) {
+    if (target != NULL && target->storageWidth == Bucket(width) && target->storageHeight == Bucket(height)) {
+        target->width = width;
+        target->height = height;
+        return target;
+    }
+    //Acquire first, so that a spare of the new bucket is not the one evicted by the release
+    RenderTarget *resized = Acquire(width, height, target != NULL ? target->format : GL_RGBA8);
+    Release(target);
+    return resized;
+}
+
+void RenderTargetPool::Release(RenderTarget *target) {
+    if (target == NULL)
+        return;
+    target->released = ++_releases;
+    _spares.push_back(target);
+    while (_spares.size() > RENDER_TARGET_SPARES) {
+        auto oldest = std::min_element(_spares.begin(), _spares.end(), [](const RenderTarget *a, const RenderTarget *b) {
+            return a->released < b->released;
+        });
+        RenderTarget *evicted = *oldest;
+        _spares.erase(oldest);
+        _targets.erase(std::find(_targets.begin(), _targets.end(), evicted));
+        Destroy(evicted);
+    }
+}
+
+size_t RenderTargetPool::Bytes() const {
+    size_t bytes = 0;
+    for (const RenderTarget *target : _targets)
+        bytes += (size_t)target->storageWidth * target->storageHeight * (PixelBytes(target->format) + 4); //and 24-bit depth padded to 32 bits
+    return bytes;
+}
+
+RenderTarget* RenderTargetPool::Create(int storageWidth, int storageHeight, GLenum format) {
+    RenderTarget *target = new RenderTarget();
+    target->format = format;
+    target->storageWidth = storageWidth;
+    target->storageHeight = storageHeight;
+
+    glGenFramebuffers(1, &target->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, target->fbo);
+
+    glGenTextures(1, &target->color);
+    glBindTexture(GL_TEXTURE_2D, target->color);
+    glTexStorage2D(GL_TEXTURE_2D, 1, format, storageWidth, storageHeight);
+    MemoryTracker::Instance().AddTexture("Render targets", target->color, format, storageWidth, storageHeight, 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target->color, 0);
+    GLenum DrawBuffers[1] = {GL_COLOR_ATTACHMENT0};
+    glDrawBuffers(1, DrawBuffers);
+
+    glGenTextures(1, &target->depth);
+    glBindTexture(GL_TEXTURE_2D, target->depth);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT24, storageWidth, storageHeight);
+    MemoryTracker::Instance().AddTexture("Render targets", target->depth, GL_DEPTH_COMPONENT24, storageWidth, storageHeight, 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, target->depth, 0);
+
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        printf("ERROR::FRAMEBUFFER:: Framebuffer is not complete!\n");
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    _targets.push_back(target);
+    return target;
+}
+
+void RenderTargetPool::Destroy(RenderTarget *target) {
+    GLuint textures[2] = {target->color, target->depth};
+    MemoryTracker::Instance().RemoveTextures(textures, 2);
+    glDeleteFramebuffers(1, &target->fbo);
+    glDeleteTextures(2, textures);
+    delete target;
+}
+
+#endif
@@ -0,0 +1,424 @@
+#ifndef __RENDERTHREAD__
+#define __RENDERTHREAD__
+
+#include <GL/glew.h>
+#include <math.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "renderer3D.h"
+#include "cameraPath.h"
+
+//Viewport images: the one shown by the UI, the newest finished one, and the one being rendered
+#define RENDER_THREAD_SLOTS 3
+
+
+// Settings of the renderer edited from the UI. The UI keeps its own copy and sends all of it when
+// one of them changes, so that its widgets never wait for a frame of the render thread.
+struct RendererSettings {
+    bool environment;
+    bool lobeLUT;
+    bool histogram;
+    bool depthPrepass;
+    bool dynamicResolution;
+    float frameBudget;
+    float exposure;
+    bool tonemap;
+    bool float32Target;
+    bool comparisonDifference;
+    float differenceScale;
+
+    static RendererSettings Capture(const Renderer3D &renderer);
+    void Apply(Renderer3D &renderer) const;
+};
+
+// State of the renderer after its last frame, published by the render thread
+struct RendererStats {
+    float resolutionScale = 1;
+    float gpuMs = 0;
+    double renderMs = 0;    //CPU time of the last frame on the render thread
+    glm::mat4 view = glm::mat4(1);
+    glm::mat4 projection = glm::mat4(1);
+    bool benchmarking = false;
+    CameraKey benchmarkKey = {0, 0, 0, 1};
+    BenchmarkSummary benchmark;
+};
+
+// Inputs of a frame, submitted by the UI every frame: the render thread draws the latest one
+struct RenderFrame {
+    ImVec2 size;
+    ImVec4 clearColor;
+    float dt;
+    float t;
+    glm::vec3 camera;
+};
+
+// An RGBA8 image of the whole viewport, comparison grid included, with the labels of its cells
+struct ViewportSlot {
+    GLuint texture = 0;
+    GLuint fbo = 0;         //of the render context: frame buffers are not shared
+    int width = 0;
+    int height = 0;
+    GLsync rendered = 0;    //after the commands that drew the image
+    GLsync displayed = 0;   //after the UI commands that last sampled it
+    std::vector<std::string> labels;
+    int columns = 1;
+    ImVec2 cell;
+};
+
+// Owns the renderer on a thread with a GL context of its own, sharing its textures with the UI
+// context, so that a slow shader does not slow down the editors and the camera. Frames are handed
+// over in a triple buffer: the render thread draws into the back slot and swaps it with the ready
+// one; the UI swaps the ready slot with the front one when it holds a newer frame, and shows the
+// front one until then. Fences order the two contexts on the GPU only: the UI context waits for the
+// frame of a slot before sampling it, the render context for the last sampling before drawing into
+// it again. Renderer calls go through Post and Call, which run them between two frames.
+// Without makeCurrent (no shared context), everything runs on the calling thread in the same order.
+class RenderThread {
+public:
+    typedef std::function<void(Renderer3D&)> Command;
+
+    // makeCurrent makes the shared context current on the render thread, where create then builds the
+    // renderer, looking at camera
+    RenderThread(std::function<void()> makeCurrent, std::function<Renderer3D*(glm::vec3 &camera)> create);
+    ~RenderThread() { Stop(); }
+    // Destroys the renderer and the slots, before the contexts are
+    void Stop();
+    bool Threaded() const { return _thread.joinable(); }
+
+    // Runs command on the render thread before its next frame, in the order posted
+    void Post(Command command);
+    // Same, with a result to poll
+    template<typename T>
+    std::future<T> Call(std::function<T(Renderer3D&)> function);
+    void Submit(const RenderFrame &frame);
+    // Renders the steps of path one frame each, whatever the submitted frames, then writes their timings to csv
+    void StartBenchmark(const CameraPath &path, const std::string &csv);
+
+    // Settings of the renderer when it was created
+    const RendererSettings& Settings() const { return _settings; }
+    RendererStats Stats() const;
+
+    // UI thread: shows the newest finished frame at the cursor, then fences it once the UI is drawn
+    void Show();
+    void Displayed();
+
+private:
+    void Run(std::function<void()> makeCurrent, std::function<Renderer3D*(glm::vec3 &camera)> create, std::promise<void> *created);
+    void Create(std::function<Renderer3D*(glm::vec3 &camera)> create);
+    void Destroy();
+    void RenderNext(RenderFrame frame);
+    void Resize(ViewportSlot &slot, int width, int height);
+
+    std::thread _thread;
+    mutable std::mutex _mutex;
+    std::condition_variable _wake;
+    bool _stopping = false;
+
+    //Render thread only
+    Renderer3D *_renderer = NULL;
+    glm::vec3 _camera;
+    std::unique_ptr<CameraBenchmark> _benchmark;
+    std::string _benchmarkCsv;
+
+    //Guarded by _mutex
+    std::deque<Command> _commands;
+    RenderFrame _frame;
+    bool _submitted = false;
+    RendererStats _stats;
+
+    //Each slot belongs to the thread of its index, which only change under _mutex
+    ViewportSlot _slots[RENDER_THREAD_SLOTS];
+    int _front = 0;
+    int _ready = 1;
+    int _back = 2;
+    bool _fresh = false;    //the ready slot holds a frame the UI has not shown
+
+    RendererSettings _settings;
+};
+
+
+RendererSettings RendererSettings::Capture(const Renderer3D &renderer) {
+    RendererSettings settings;
+    settings.environment = renderer.getEnvironment();
+    settings.lobeLUT = renderer.getLobeLUT();
+    settings.histogram = renderer.getHistogramPreserving();
+    settings.depthPrepass = renderer.getDepthPrepass();
+    settings.dynamicResolution = renderer.getDynamicResolution();
+    settings.frameBudget = renderer.getFrameBudget();
+    settings.exposure = renderer.getExposure();
+    settings.tonemap = renderer.getTonemap();
+    settings.float32Target = renderer.getFloat32Target();
+    settings.comparisonDifference = renderer.getComparisonDifference();
+    settings.differenceScale = renderer.getDifferenceScale();
+    return settings;
+}
+
+void RendererSettings::Apply(Renderer3D &renderer) const {
+    renderer.SetEnvironment(environment);
+    renderer.SetLobeLUT(lobeLUT);
+    renderer.SetHistogramPreserving(histogram);
+    renderer.SetDepthPrepass(depthPrepass);
+    renderer.SetDynamicResolution(dynamicResolution, frameBudget);
+    renderer.SetExposure(exposure);
+    renderer.SetTonemap(tonemap);
+    renderer.SetFloat32Target(float32Target);
+    renderer.SetComparisonDifference(comparisonDifference, differenceScale);
+}
+
+
+RenderThread::RenderThread(std::function<void()> makeCurrent, std::function<Renderer3D*(glm::vec3 &camera)> create) {
+    if (!makeCurrent) {
+        Create(create);
+        return;
+    }
+    //The UI starts once the renderer exists, with its settings
+    std::promise<void> created;
+    std::future<void> ready = created.get_future();
+    _thread = std::thread(&RenderThread::Run, this, makeCurrent, create, &created);
+    ready.wait();
+}
+
+void RenderThread::Stop() {
+    if (_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _wake.notify_one();
+        _thread.join();
+    } else {
+        Destroy();
+    }
+}
+
+void RenderThread::Post(Command command) {
+    if (!Threaded()) {
+        if (_renderer != NULL)
+            command(*_renderer);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _commands.push_back(command);
+    }
+    _wake.notify_one();
+}
+
+template<typename T>
+std::future<T> RenderThread::Call(std::function<T(Renderer3D&)> function) {
+    auto task = std::make_shared<std::packaged_task<T(Renderer3D&)>>(function);
+    std::future<T> result = task->get_future();
+    Post([task](Renderer3D &renderer) { (*task)(renderer); });
+    return result;
+}
+
+void RenderThread::Submit(const RenderFrame &frame) {
+    if (!Threaded()) {
+        RenderNext(frame);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _frame = frame;
+        _submitted = true;
+    }
+    _wake.notify_one();
+}
+
+void RenderThread::StartBenchmark(const CameraPath &path, const std::string &csv) {
+    Post([this, path, csv](Renderer3D&) {
+        _benchmark->Start(path);
+        _benchmarkCsv = csv;
+    });
+}
+
+RendererStats RenderThread::Stats() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+}
+
+void RenderThread::Show() {
+    PROFILE_ZONE("RenderThread::Show");
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_fresh) {
+            std::swap(_front, _ready);
+            _fresh = false;
+        }
+    }
+    ViewportSlot &slot = _slots[_front];
+    if (slot.rendered == 0) //Nothing rendered yet
+        return;
+    glWaitSync(slot.rendered, 0, GL_TIMEOUT_IGNORED);
+
+    ImVec2 origin = ImGui::GetCursorPos();
+    ImGui::Image((ImTextureID)(intptr_t)slot.texture, ImVec2(slot.width, slot.height), ImVec2(0, 1), ImVec2(1, 0));
+    for (size_t i = 0; i < slot.labels.size(); i++) {
+        ImVec2 position(origin.x + (i % slot.columns) * slot.cell.x, origin.y + (i / slot.columns) * slot.cell.y);
+        ImGui::SetCursorPos(ImVec2(position.x + 8, position.y + slot.cell.y - 24));
+        ImGui::Text("%s", slot.labels[i].c_str());
+    }
+}
+
+//After the draw data of the UI is submitted
+void RenderThread::Displayed() {
+    ViewportSlot &slot = _slots[_front];
+    if (slot.rendered == 0)
+        return;
+    if (slot.displayed != 0)
+        glDeleteSync(slot.displayed);
+    slot.displayed = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    //Flushed, or the render context could wait for it forever
+    glFlush();
+}
+
+void RenderThread::Run(std::function<void()> makeCurrent, std::function<Renderer3D*(glm::vec3 &camera)> create, std::promise<void> *created) {
+    PROFILE_THREAD("Render");
+    makeCurrent();
+    Create(create);
+    created->set_value();
+
+    while (true) {
+        std::deque<Command> commands;
+        RenderFrame frame;
+        bool render;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [this] { return _stopping || !_commands.empty() || _submitted || _benchmark->Running(); });
+            if (_stopping)
+                break;
+            commands.swap(_commands);
+            frame = _frame;
+            //Frames submitted while the last one was rendered are dropped but for the latest
+            render = _submitted || _benchmark->Running();
+            _submitted = false;
+        }
+        for (Command &command : commands)
+            command(*_renderer);
+        if (render)
+            RenderNext(frame);
+    }
+    Destroy();
+}
+
+void RenderThread::Create(std::function<Renderer3D*(glm::vec3 &camera)> create) {
+    _renderer = create(_camera);
+    _benchmark.reset(new CameraBenchmark());
+    _settings = RendererSettings::Capture(*_renderer);
+}
+
+//On the render thread, whose context owns the frame buffers and queries
+void RenderThread::Destroy() {
+    if (_renderer == NULL)
+        return;
+    delete _renderer;
+    _renderer = NULL;
+    _benchmark.reset();
+    MemoryTracker &memory = MemoryTracker::Instance();
+    for (ViewportSlot &slot : _slots) {
+        if (slot.texture != 0) {
+            memory.RemoveTextures(&slot.texture, 1);
+            glDeleteTextures(1, &slot.texture);
+            glDeleteFramebuffers(1, &slot.fbo);
+        }
+        if (slot.rendered != 0)
+            glDeleteSync(slot.rendered);
+        if (slot.displayed != 0)
+            glDeleteSync(slot.displayed);
+        slot = ViewportSlot();
+    }
+}
+
+void RenderThread::RenderNext(RenderFrame frame) {
+    PROFILE_ZONE("RenderThread::RenderNext");
+    //Playback: the camera of the path and a fixed TIME, one step per frame
+    CameraKey key;
+    bool benchmark = _benchmark->Running() && _benchmark->Next(key);
+    if (_benchmark->Running() && !benchmark)
+        _benchmark->Finish(_benchmarkCsv.c_str());
+    if (benchmark) {
+        frame.camera = OrbitPosition(key.azimuth, key.elevation, key.zoom);
+        frame.dt = _benchmark->Step();
+        frame.t = key.time;
+    }
+    //Whole pixels, the size of the slot
+    frame.size = ImVec2(std::max(1.0f, floorf(frame.size.x)), std::max(1.0f, floorf(frame.size.y)));
+
+    ViewportSlot &slot = _slots[_back];
+    if (slot.displayed != 0) {
+        glWaitSync(slot.displayed, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync(slot.displayed);
+        slot.displayed = 0;
+    }
+
+    _camera = frame.camera;
+    if (benchmark)
+        _benchmark->BeginFrame();
+    auto start = std::chrono::steady_clock::now();
+    _renderer->Render(frame.size, frame.clearColor, frame.dt, frame.t);
+    if (slot.width != (int)frame.size.x || slot.height != (int)frame.size.y)
+        Resize(slot, (int)frame.size.x, (int)frame.size.y);
+    _renderer->Compose(slot.fbo);
+    double renderMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (benchmark)
+        _benchmark->EndFrame(renderMs);
+    slot.labels = _renderer->getComparisonLabels();
+    slot.columns = _renderer->getComparisonColumns();
+    slot.cell = _renderer->getComparisonCell();
+
+    if (slot.rendered != 0)
+        glDeleteSync(slot.rendered);
+    slot.rendered = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::swap(_back, _ready);
+        _fresh = true;
+        _stats.resolutionScale = _renderer->getResolutionScale();
+        _stats.gpuMs = _renderer->getGpuMs();
+        _stats.renderMs = renderMs;
+        _stats.view = _renderer->getViewMatrix();
+        _stats.projection = _renderer->getProjectionMatrix();
+        _stats.benchmarking = _benchmark->Running();
+        if (benchmark)
+            _stats.benchmarkKey = key;
+        _stats.benchmark = _benchmark->Summary();
+    }
+    PROFILE_FRAME();
+}
+
+//Immutable storage as the render targets; the slot is not sampled anymore, its displayed fence is waited
+void RenderThread::Resize(ViewportSlot &slot, int width, int height) {
+    MemoryTracker &memory = MemoryTracker::Instance();
+    if (slot.texture != 0) {
+        memory.RemoveTextures(&slot.texture, 1);
+        glDeleteTextures(1, &slot.texture);
+        glDeleteFramebuffers(1, &slot.fbo);
+    }
+    slot.width = width;
+    slot.height = height;
+    glGenTextures(1, &slot.texture);
+    glBindTexture(GL_TEXTURE_2D, slot.texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    memory.AddTexture("Viewport slots", slot.texture, GL_RGBA8, width, height, 1);
+
+    glGenFramebuffers(1, &slot.fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, slot.fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, slot.texture, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        fprintf(stderr, "ERROR::RENDER_THREAD:: Viewport slot frame buffer is not complete\n");
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+#endif
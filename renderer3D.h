@@ -13,12 +13,55 @@
 #include <map>
 #include <sstream>
 #include <iostream>
+#include "textureLoader.h"
+#include "blockCompression.h"
+#include "environment.h"
+#include "histogram.h"
+#include "bmpWriter.h"
+#include "pfmWriter.h"
+#include "renderTargetPool.h"
+#include "dynamicResolution.h"
+#include "profiler.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 #define BUFFER_OFFSET(i) ((char *)NULL + (i))
 
+//Specular lobe table: exp(-q / 2) for squared whitened distances q in [0, LOBE_LUT_RANGE]
+#define LOBE_LUT_SIZE 256
+#define LOBE_LUT_RANGE 36.0f
+
+//Largest side of the frame buffer screenshots are rendered into, one tile at a time
+#define SCREENSHOT_TILE_SIZE 2048
+
+//Fullscreen pass from the linear scene target to the displayed one
+#define TONEMAP_VSHADER "./shaders/tonemap_vshader.glsl"
+#define TONEMAP_FSHADER "./shaders/tonemap_fshader.glsl"
+
+
+struct LobeBenchmark {
+    double analyticMs = 0;
+    double lutMs = 0;
+    float maxError = 0;     //of the linear output
+    float meanError = 0;
+};
+
+struct OverdrawStats {
+    GLuint fragments = 0;           //shaded fragments without the depth pre-pass
+    GLuint prepassFragments = 0;    //with it, the visible ones only
+    double ms = 0;
+    double prepassMs = 0;           //both passes
+};
+
+//One cell of the comparison layout: the scene shader built with its own #defines
+struct ComparisonView {
+    std::string name;
+    std::string defines;
+    GLuint program = 0;
+    RenderTarget *target = NULL;
+    RenderTarget *display = NULL;
+};
 
 struct VertexData {
     glm::vec3 position;
@@ -30,16 +73,46 @@ struct VertexData {
 
 class Renderer3D {
 private:
-    GLuint _FBO = 0;
-    GLuint _outputColor = 0;
-    GLuint _outputDepth = 0;
+    RenderTargetPool _renderTargets;
+    RenderTarget *_target = NULL;   //linear radiance of the scene, RGBA16F or RGBA32F
+    RenderTarget *_display = NULL;  //tone mapped from _target, shown in the viewport
+    GLenum _hdrFormat = GL_RGBA16F;
     ImVec2 _size;
+    ImVec2 _renderSize;     //_size scaled by the dynamic resolution, what DrawScene renders
+    DynamicResolution _dynamicResolution;
+    glm::vec3 _lastCamera;
+    ImVec4 _clearColor = ImVec4(0, 0, 0, 1);
 
     GLuint _VBO;
     GLuint _shaderProgram;
     GLuint _vShader = 0;
     GLuint _fShader = 0;
+
+    //Depth pre-pass: depth only with the same vertex shader, then shading of the fragments of equal depth
+    GLuint _depthProgram = 0;
+    GLuint _depthFShader = 0;
+    bool _depthPrepass = false;
+    GLuint _fragmentCounter = 0;    //atomic counter buffer of the overdraw statistics
+    bool _countFragments = false;
+
+    //Exposure and tone curve, applied by the tonemap pass so that changing them does not touch the scene shader
+    GLuint _tonemapProgram = 0;
+    GLuint _tonemapVAO = 0;
+    float _exposure = 0;
+    bool _tonemap = true;
+
+    //Comparison layout: the views share the mesh, textures and camera, drawn one after the other in a grid
+    std::vector<ComparisonView> _comparison;
+    std::string _fShaderCode;
+    bool _comparisonDifference = false;     //views after the first show their difference to it
+    float _differenceScale = 10;
+    int _comparisonColumns = 1;             //layout of the last frame
+    ImVec2 _comparisonCell;
+    ImVec2 _comparisonRenderSize;
     GLuint _envMap = 0;
+    GLuint _irradianceSH = 0;
+    int _environmentLevels = 1;
+    bool _useEnvironment = false;
     GLuint _albedo = 0;
     GLuint _normal = 0;
     GLuint _roughness = 0;
@@ -48,6 +121,34 @@ private:
     GLuint _constantSigma = 0;
     GLuint _var = 0;
     GLuint _mipchart = 0;
+    GLuint _lobeLUT = 0;
+    bool _useLobeLUT = false;
+
+    //Histogram-preserving tiling and blending of the b map: gaussianized texture and its inverse LUT
+    GLuint _bmapGaussian = 0;
+    GLuint _bmapLUT = 0;
+    bool _useHistogram = false;
+
+    //Bound until the loaded textures are ready
+    GLuint _placeholderGray = 0;
+    GLuint _placeholderBlack = 0;
+    GLuint _placeholderNormal = 0;
+    GLuint _placeholderSlope = 0;
+    GLuint _placeholderArray = 0;
+
+    //Registry keys of the textures shown and of the ones being loaded to replace them
+    struct TextureSlot {
+        std::string shown;
+        std::string pending;
+    };
+
+    TextureLoader _textureLoader;
+    TextureRegistry _textures{_textureLoader};
+    TextureSlot _albedoSlot;
+    TextureSlot _normalSlot;
+    TextureSlot _roughnessSlot;
+    TextureSlot _envMapSlot;
+    TextureSlot _mipchartSlot;
 
     glm::mat4x4 _projectionMatrix;
     glm::mat4x4 _viewMatrix;
@@ -60,13 +161,17 @@ private:
     float s = 25;
     int mip_levels = 8;
     float max_aniso = 1;
+    MipFilter mip_filter = MIP_FILTER_KAISER;
+    EnvironmentSettings environment;
 
 
 
 public:
     Renderer3D(ImVec2 size, glm::vec3 &cameraPosition, const char* model, const char* vertexShader, const char* fragmentShader);
     ~Renderer3D();
-    void Draw(ImVec2 size, ImVec4 clearColor, float dt, float t);
+    //Renders the scene, or the comparison views, into the display targets that Compose copies
+    void Render(ImVec2 size, ImVec4 clearColor, float dt, float t);
+    void Compose(GLuint fbo);
     std::string SetFShader(const std::string &code);
     std::string SetVShader(const std::string &code);
 
@@ -76,108 +181,163 @@ public:
     glm::mat4 getProjectionMatrix() {return _projectionMatrix;}
     glm::mat4 getViewMatrix() {return _viewMatrix;}
     glm::mat4 getModelMatrix() {return _modelMatrix;}
-
-    void Screenshot (const char* path);
+    size_t getTextureBytes() const {return _textures.ResidentBytes();}
+    size_t getRenderTargetBytes() const {return _renderTargets.Bytes();}
+    int getRenderTargetCount() const {return _renderTargets.Count();}
+    bool getEnvironment() const {return _useEnvironment;}
+    void SetEnvironment(bool enabled) {_useEnvironment = enabled;}
+    bool getLobeLUT() const {return _useLobeLUT;}
+    void SetLobeLUT(bool enabled) {_useLobeLUT = enabled;}
+    bool getHistogramPreserving() const {return _useHistogram;}
+    void SetHistogramPreserving(bool enabled) {_useHistogram = enabled;}
+    bool getDynamicResolution() const {return _dynamicResolution.enabled;}
+    float getFrameBudget() const {return _dynamicResolution.budgetMs;}
+    void SetDynamicResolution(bool enabled, float budgetMs) {_dynamicResolution.enabled = enabled; _dynamicResolution.budgetMs = budgetMs;}
+    float getResolutionScale() const {return _renderSize.x / _size.x;}
+    float getGpuMs() const {return _dynamicResolution.GpuMs();}
+    bool getDepthPrepass() const {return _depthPrepass;}
+    void SetDepthPrepass(bool enabled) {_depthPrepass = enabled;}
+    float getExposure() const {return _exposure;}
+    void SetExposure(float stops) {_exposure = stops;}
+    bool getTonemap() const {return _tonemap;}
+    void SetTonemap(bool enabled) {_tonemap = enabled;}
+    bool getFloat32Target() const {return _hdrFormat == GL_RGBA32F;}
+    void SetFloat32Target(bool enabled);
+
+    //Comparison views, drawn instead of the single viewport when there are any
+    void AddComparisonView(const char* name, const char* defines);
+    void ClearComparison();
+    int getComparisonViewCount() const {return _comparison.size();}
+    bool getComparisonDifference() const {return _comparisonDifference;}
+    float getDifferenceScale() const {return _differenceScale;}
+    void SetComparisonDifference(bool enabled, float scale) {_comparisonDifference = enabled; _differenceScale = scale;}
+    int getComparisonColumns() const {return _comparisonColumns;}
+    ImVec2 getComparisonCell() const {return _comparisonCell;}
+    std::vector<std::string> getComparisonLabels() const;
+
+    //Linear radiance of the last frame: width x height RGB floats, bottom row first
+    void ReadHDR(std::vector<float> &pixels, int &width, int &height);
+
+    LobeBenchmark BenchmarkLobeLUT(int frames);
+    OverdrawStats MeasureOverdraw(int frames);
+
+    //Saves the current view as a BMP file of width x height (the viewport size when 0),
+    //or as a PFM file of the linear radiance when path ends with .pfm
+    bool Screenshot (const char* path, int width = 0, int height = 0, int tileSize = SCREENSHOT_TILE_SIZE);
+
+    //CPU side of LoadMesh and SetNormal, which need no GL context: used by the benchmarks
+    static void ParseMesh(const char* model, std::vector<VertexData> &vertices);
+    static bool DecodeNormal(const std::string &path, int mip_levels, float max_aniso, MipFilter filter, std::vector<TextureData> &textures);
 
 private:
     void LoadMesh(const char* model);
     void MakeShaderProgram(const char* fragmentShader, const char* vertexShader);
+    void MakeDepthProgram();
+    void MakeTonemapProgram();
+    void Tonemap(RenderTarget *source, RenderTarget *destination, RenderTarget *reference = NULL);
+    void SetMatrices(GLuint program);
+    void DrawScene(ImVec4 clearColor, float dt, float t, GLuint program = 0);
+    void DrawComparison(ImVec4 clearColor, float dt, float t, float scale);
+    void MakeComparisonProgram(ComparisonView &view);
+    GLuint MakeSolidTexture(unsigned char r, unsigned char g, unsigned char b);
+    GLuint MakeLobeLUT();
+    std::string TextureKey(const char* kind, const std::string &path) const;
+    void SetTextures(TextureSlot &slot, const std::string &key, TextureLoader::DecodeFunction decode, std::function<void(const std::vector<GLuint>&)> bind);
+    static bool DecodeTexture(const std::string &path, int channels, int mip_levels, float max_aniso, MipFilter filter, int flags, GLint minFilter, std::vector<TextureData> &textures);
 };
 
 
 Renderer3D::Renderer3D(ImVec2 size, glm::vec3 &cameraPosition, const char* model = "./models/cube.obj", const char* fragmentShader = "./shaders/fshader.glsl", const char* vertexShader = "./shaders/vshader.glsl") : _size(size), _cameraPosition(&cameraPosition) {
+    PROFILE_ZONE("Renderer3D::Renderer3D");
     MakeShaderProgram(fragmentShader, vertexShader);
+    MakeTonemapProgram();
 
     LoadMesh(model);
     
-    //We create a new buffer
-    glGenFramebuffers(1, &_FBO);
-    glBindFramebuffer(GL_FRAMEBUFFER, _FBO); //Bind
-
-    //Create & Attach a texture to it
-    glGenTextures(1, &_outputColor);
-    glBindTexture(GL_TEXTURE_2D, _outputColor);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, _size.x, _size.y, 0,  GL_RGB, GL_UNSIGNED_BYTE, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);  
-
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _outputColor, 0);  
-    GLenum DrawBuffers[1] = {GL_COLOR_ATTACHMENT0};
-    glDrawBuffers(1, DrawBuffers);
-
-    glGenTextures(1, &_outputDepth);
-    glBindTexture(GL_TEXTURE_2D, _outputDepth);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, _size.x, _size.y, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, _outputDepth, 0);
-
-    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-	    printf("ERROR::FRAMEBUFFER:: Framebuffer is not complete!\n");
+    //The viewport is rendered into targets of the pool, replaced when they no longer fit
+    _renderSize = _size;
+    _target = _renderTargets.Acquire((int)_size.x, (int)_size.y, _hdrFormat);
+    _display = _renderTargets.Acquire((int)_size.x, (int)_size.y);
     
     _projectionMatrix = glm::perspective<float>(glm::radians(55.0), _size.x / _size.y, 0.1f, 1000.0f);
     _modelMatrix = glm::mat4x4(1.0f);
     _viewMatrix = glm::lookAt(*_cameraPosition, glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
 
-    {
-        glGenTextures(1, &_roughness);
-        glBindTexture(GL_TEXTURE_2D, _roughness);
-        int w, h, nbC;
-        unsigned char *data = stbi_load("textures/Gravel_Roughness.png", &w, &h, &nbC, 0); 
-        glTexStorage2D(GL_TEXTURE_2D, mip_levels, GL_R8, w, h);
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_R, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameterf(GL_TEXTURE_2D, GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, max_aniso);
-    }
-    {
-        glGenTextures(1, &_envMap);
-        glBindTexture(GL_TEXTURE_2D, _envMap);
-        int w, h, nbC;
-        unsigned char *data = stbi_load("textures/hdri_warehouse.png", &w, &h, &nbC, 0); 
-        glTexStorage2D(GL_TEXTURE_2D, mip_levels, GL_RGB8, w, h);
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_RGB, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameterf(GL_TEXTURE_2D, GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, max_aniso);
-    }
-    { // MIP CHART
-        int mipw;
-        int miph;
-        int mipnbC;
-
-        glGenTextures(1, &_mipchart);
-        glBindTexture(GL_TEXTURE_2D, _mipchart);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 9);
-
-        unsigned char *mip0 = stbi_load("textures/MIP/0.png", &mipw, &miph, &mipnbC, 0);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, 256, 256, 0, GL_RGB, GL_UNSIGNED_BYTE, mip0);
-        unsigned char *mip1 = stbi_load("textures/MIP/1.png", &mipw, &miph, &mipnbC, 0);
-        glTexImage2D(GL_TEXTURE_2D, 1, GL_RGB8, 128, 128, 0, GL_RGB, GL_UNSIGNED_BYTE, mip1);
-        unsigned char *mip2 = stbi_load("textures/MIP/2.png", &mipw, &miph, &mipnbC, 0);
-        glTexImage2D(GL_TEXTURE_2D, 2, GL_RGB8, 64 , 64 , 0, GL_RGB, GL_UNSIGNED_BYTE, mip2);
-        unsigned char *mip3 = stbi_load("textures/MIP/3.png", &mipw, &miph, &mipnbC, 0);
-        glTexImage2D(GL_TEXTURE_2D, 3, GL_RGB8, 32 , 32 , 0, GL_RGB, GL_UNSIGNED_BYTE, mip3);
-        unsigned char *mip4 = stbi_load("textures/MIP/4.png", &mipw, &miph, &mipnbC, 0);
-        glTexImage2D(GL_TEXTURE_2D, 4, GL_RGB8, 16 , 16 , 0, GL_RGB, GL_UNSIGNED_BYTE, mip4);
-        unsigned char *mip5 = stbi_load("textures/MIP/5.png", &mipw, &miph, &mipnbC, 0);
-        glTexImage2D(GL_TEXTURE_2D, 5, GL_RGB8, 8  , 8  , 0, GL_RGB, GL_UNSIGNED_BYTE, mip5);
-        unsigned char *mip6 = stbi_load("textures/MIP/6.png", &mipw, &miph, &mipnbC, 0);
-        glTexImage2D(GL_TEXTURE_2D, 6, GL_RGB8, 4  , 4  , 0, GL_RGB, GL_UNSIGNED_BYTE, mip6);
-        unsigned char *mip7 = stbi_load("textures/MIP/7.png", &mipw, &miph, &mipnbC, 0);
-        glTexImage2D(GL_TEXTURE_2D, 7, GL_RGB8, 2  , 2  , 0, GL_RGB, GL_UNSIGNED_BYTE, mip7);
-        glTexImage2D(GL_TEXTURE_2D, 8, GL_RGB8, 1  , 1  , 0, GL_RGB, GL_UNSIGNED_BYTE, mip0);
+    _placeholderGray = MakeSolidTexture(128, 128, 128);
+    _placeholderBlack = MakeSolidTexture(0, 0, 0);
+    _placeholderNormal = MakeSolidTexture(128, 128, 255);
+    _placeholderSlope = MakeSolidTexture(0, 0, 255);
+    glGenTextures(1, &_placeholderArray);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, _placeholderArray);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, 1, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    MemoryTracker::Instance().AddTexture("Placeholders", _placeholderArray, GL_RGBA8, 1, 1, 1, 1);
+    _albedo = _placeholderGray;
+    _roughness = _placeholderGray;
+    _lobeLUT = MakeLobeLUT();
+    _bmapGaussian = _placeholderGray;
+    _bmapLUT = _placeholderArray;
+    _envMap = _placeholderGray;
+    _irradianceSH = _placeholderBlack;
+    _mipchart = _placeholderGray;
+    _normal = _placeholderNormal;
+    _bmap = _placeholderSlope;
+    _mmap = _placeholderBlack;
+    _constantSigma = _placeholderBlack;
+    _var = _placeholderBlack;
+
+    if (GLEW_ARB_shader_atomic_counters) {
+        glGenBuffers(1, &_fragmentCounter);
+        glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, _fragmentCounter);
+        glBufferData(GL_ATOMIC_COUNTER_BUFFER, sizeof(GLuint), NULL, GL_DYNAMIC_READ);
+        glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+        MemoryTracker::Instance().AddBuffer("Counters", _fragmentCounter, sizeof(GLuint));
     }
 
+    int levels = mip_levels;
+    float aniso = max_aniso;
+    MipFilter filter = mip_filter;
+    SetTextures(_roughnessSlot, TextureKey("roughness", "textures/Gravel_Roughness.png"), [levels, aniso, filter](std::vector<TextureData> &textures) {
+        return DecodeTexture("textures/Gravel_Roughness.png", 1, levels, aniso, filter, 0, GL_LINEAR_MIPMAP_LINEAR, textures);
+    }, [this](const std::vector<GLuint> &names) {
+        _roughness = names[0];
+    });
+    EnvironmentSettings settings = environment;
+    settings.maxLevels = mip_levels;
+    SetTextures(_envMapSlot, TextureKey("environment", "textures/hdri_warehouse.hdr"), [settings](std::vector<TextureData> &textures) {
+        PROFILE_ZONE("DecodeEnvironment");
+        return DecodeEnvironment("textures/hdri_warehouse.hdr", settings, textures);
+    }, [this](const std::vector<GLuint> &names) {
+        _envMap = names[0];
+        _irradianceSH = names[1];
+        glBindTexture(GL_TEXTURE_2D, _envMap);
+        glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_IMMUTABLE_LEVELS, &_environmentLevels);
+    });
+    SetTextures(_mipchartSlot, "mipchart", [](std::vector<TextureData> &textures) { // MIP CHART
+        TextureData tex;
+        tex.minFilter = GL_NEAREST_MIPMAP_NEAREST;
+        tex.storageLevels = 9;
+        tex.levels.resize(9);
+        for (int i = 0; i < 8; i++) {
+            char path[64];
+            snprintf(path, sizeof(path), "textures/MIP/%d.png", i);
+            if (!DecodeImage(path, 3, tex.levels[i]))
+                return false;
+        }
+        //The last level is the average of the 2x2 one
+        MipGenerator last(tex.levels[7].width, tex.levels[7].height, 3, tex.levels[7].pixels.data(), MIP_FILTER_BOX, MIP_SRGB);
+        last.Next();
+        tex.levels[8].width = last.Width();
+        tex.levels[8].height = last.Height();
+        tex.levels[8].pixels.resize((size_t)last.Width() * last.Height() * 3);
+        last.Store(tex.levels[8].pixels.data());
+        textures.push_back(tex);
+        return true;
+    }, [this](const std::vector<GLuint> &names) {
+        _mipchart = names[0];
+    });
+
 
     //Back to the default frame buffer
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
@@ -185,38 +345,173 @@ Renderer3D::Renderer3D(ImVec2 size, glm::vec3 &cameraPosition, const char* model
 
 
 Renderer3D::~Renderer3D() {
-    glDeleteFramebuffers(1, &_FBO);
-    glDeleteTextures(1, &_outputColor);
+    _renderTargets.Release(_target);
+    _renderTargets.Release(_display);
+    ClearComparison();
+
+    MemoryTracker &memory = MemoryTracker::Instance();
+    GLuint placeholders[5] = {_placeholderGray, _placeholderBlack, _placeholderNormal, _placeholderSlope, _placeholderArray};
+    memory.RemoveTextures(placeholders, 5);
+    glDeleteTextures(5, placeholders);
+    memory.RemoveTextures(&_lobeLUT, 1);
+    glDeleteTextures(1, &_lobeLUT);
+    GLuint buffers[2] = {_fragmentCounter, _VBO};
+    memory.RemoveBuffers(buffers, 2);
+    glDeleteBuffers(2, buffers);
+    memory.Free("Vertices", _vertices.capacity() * sizeof(VertexData));
+    glDeleteProgram(_depthProgram);
+    glDeleteShader(_depthFShader);
+    glDeleteProgram(_tonemapProgram);
+    glDeleteVertexArrays(1, &_tonemapVAO);
+}
+
+std::string Renderer3D::TextureKey(const char* kind, const std::string &path) const {
+    return std::string(kind) + ":" + path + ":" + std::to_string(mip_levels) + ":" + std::to_string(max_aniso) + ":" + std::to_string(mip_filter);
+}
+
+//Loads the textures of key into slot, and releases the ones it showed once they are replaced
+void Renderer3D::SetTextures(TextureSlot &slot, const std::string &key, TextureLoader::DecodeFunction decode, std::function<void(const std::vector<GLuint>&)> bind) {
+    if (key == slot.pending || (slot.pending.empty() && key == slot.shown))
+        return;
+    if (!slot.pending.empty())
+        _textures.Release(slot.pending);
+    slot.pending = key;
+
+    _textures.Acquire(key, decode, [this, &slot, key, bind](const std::vector<GLuint> &names) {
+        if (slot.pending != key)
+            return;
+        slot.pending.clear();
+        if (names.empty())
+            return;
+        if (!slot.shown.empty())
+            _textures.Release(slot.shown);
+        slot.shown = key;
+        bind(names);
+    });
 }
 
 void Renderer3D::SetAlbedo(const char* path) {
-    glGenTextures(1, &_albedo);
-    glBindTexture(GL_TEXTURE_2D, _albedo);
-    int w, h, nbC;
-    unsigned char *data = stbi_load(path, &w, &h, &nbC, 0);
-    glTexStorage2D(GL_TEXTURE_2D, mip_levels, GL_RGB8, w, h);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_RGB, GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
-    glTexParameterf(GL_TEXTURE_2D, GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, max_aniso);
+    PROFILE_ZONE("Renderer3D::SetAlbedo");
+    std::string file(path);
+    int levels = mip_levels;
+    float aniso = max_aniso;
+    MipFilter filter = mip_filter;
+    SetTextures(_albedoSlot, TextureKey("albedo", file), [file, levels, aniso, filter](std::vector<TextureData> &textures) {
+        //The shader shades with a constant diffuse color, so only the b map is gaussianized
+        return DecodeTexture(file, 3, levels, aniso, filter, MIP_SRGB, GL_LINEAR_MIPMAP_NEAREST, textures);
+    }, [this](const std::vector<GLuint> &names) {
+        _albedo = names[0];
+    });
 }
 
 void Renderer3D::SetNormal(const char* path) {
-    glGenTextures(1, &_normal);
-    glBindTexture(GL_TEXTURE_2D, _normal);
-    int w, h, nbC;
-    unsigned char *data = stbi_load(path, &w, &h, &nbC, 0);
-    glTexStorage2D(GL_TEXTURE_2D, mip_levels, GL_RGB8, w, h);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_RGB, GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameterf(GL_TEXTURE_2D, GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, max_aniso);
+    PROFILE_ZONE("Renderer3D::SetNormal");
+    std::string file(path);
+    int levels = mip_levels;
+    float aniso = max_aniso;
+    MipFilter filter = mip_filter;
+    SetTextures(_normalSlot, TextureKey("normal", file), [file, levels, aniso, filter](std::vector<TextureData> &textures) {
+        return DecodeNormal(file, levels, aniso, filter, textures);
+    }, [this](const std::vector<GLuint> &names) {
+        _normal = names[0];
+        _bmap = names[1];
+        _mmap = names[2];
+        _constantSigma = names[3];
+        _var = names[4];
+        _bmapGaussian = names[5];
+        _bmapLUT = names[6];
+    });
+}
+
+//Runs on a loader thread: a one or three channel texture and its mip chain,
+//or its block compressed version when one was encoded next to it
+bool Renderer3D::DecodeTexture(const std::string &path, int channels, int mip_levels, float max_aniso, MipFilter filter, int flags, GLint minFilter, std::vector<TextureData> &textures) {
+    PROFILE_ZONE("Renderer3D::DecodeTexture");
+    TextureData tex;
+    tex.internalFormat = channels == 1 ? GL_R8 : GL_RGB8;
+    tex.format = channels == 1 ? GL_RED : GL_RGB;
+    tex.pixelSize = channels;
+    tex.minFilter = minFilter;
+    tex.maxAniso = max_aniso;
+
+    std::string compressed = IsCompressedPath(path) ? path : CompressedPath(path);
+    if (compressed == path || FileExists(compressed)) {
+        if (!DecodeDDS(compressed.c_str(), mip_levels, tex))
+            return false;
+        textures.push_back(std::move(tex));
+        return true;
+    }
+
+    tex.levels.resize(1);
+    if (!DecodeImage(path.c_str(), channels, tex.levels[0]))
+        return false;
+    tex.storageLevels = MipLevelCount(tex.levels[0].width, tex.levels[0].height, mip_levels);
+    GenerateMipChain(tex, filter, flags);
+    textures.push_back(std::move(tex));
+    return true;
+}
+
+//Runs on a loader thread: the normal map and the LEAN maps derived from it.
+//A BC5 compressed normal map is uploaded as is, and decoded on the CPU for the LEAN maps.
+bool Renderer3D::DecodeNormal(const std::string &path, int mip_levels, float max_aniso, MipFilter filter, std::vector<TextureData> &textures) {
+    PROFILE_ZONE("Renderer3D::DecodeNormal");
+    TextureData normal;
+    normal.maxAniso = max_aniso;
+
+    std::vector<unsigned char> decoded;
+    std::string compressed = IsCompressedPath(path) ? path : CompressedPath(path);
+    if (compressed == path || FileExists(compressed)) {
+        if (!DecodeDDS(compressed.c_str(), mip_levels, normal))
+            return false;
+        if (normal.internalFormat != GL_COMPRESSED_RG_RGTC2) {
+            fprintf(stderr, "ERROR::TEXTURE:: Normal map '%s' must be BC5 compressed\n", compressed.c_str());
+            return false;
+        }
+
+        //Decode the x and y of the first level, and rebuild z
+        int w = normal.levels[0].width;
+        int h = normal.levels[0].height;
+        int bw = (w + 3) / 4;
+        decoded.resize((size_t)w * h * 3);
+        unsigned char texels[4 * 4 * 3];
+        for (int by = 0; by < (h + 3) / 4; by++) {
+            for (int bx = 0; bx < bw; bx++) {
+                DecodeBC5Block(&normal.levels[0].pixels[(by * bw + bx) * 16], texels, 4 * 3, 3);
+                for (int y = 0; y < 4 && 4 * by + y < h; y++)
+                    for (int x = 0; x < 4 && 4 * bx + x < w; x++)
+                        memcpy(&decoded[3 * ((size_t)(4 * by + y) * w + 4 * bx + x)], &texels[3 * (4 * y + x)], 2);
+            }
+        }
+        for (size_t i = 0; i < decoded.size(); i += 3) {
+            float nx = decoded[i + 0] / 255.0f * 2.0f - 1.0f;
+            float ny = decoded[i + 1] / 255.0f * 2.0f - 1.0f;
+            float nz = sqrtf(std::max(0.0f, 1.0f - nx * nx - ny * ny));
+            decoded[i + 2] = (unsigned char)((nz * 0.5f + 0.5f) * 255.0f + 0.5f);
+        }
+    } else {
+        PROFILE_ZONE("Renderer3D::DecodeNormal::Decode");
+        normal.levels.resize(1);
+        if (!DecodeImage(path.c_str(), 3, normal.levels[0]))
+            return false;
+        normal.storageLevels = MipLevelCount(normal.levels[0].width, normal.levels[0].height, mip_levels);
+        GenerateMipChain(normal, filter, MIP_NORMALS);
+    }
+
+    int w = normal.levels[0].width;
+    int h = normal.levels[0].height;
+    int nbC = 3;
+    textures.reserve(5);
+    textures.push_back(std::move(normal));
+    const unsigned char *data = decoded.empty() ? textures[0].levels[0].pixels.data() : decoded.data();
+
+    auto addFloatLevel = [](TextureData &tex, int lw, int lh, const std::vector<float> &values) {
+        TextureLevel level;
+        level.width = lw;
+        level.height = lh;
+        const unsigned char *bytes = (const unsigned char *)values.data();
+        level.pixels.assign(bytes, bytes + (size_t)lw * lh * tex.pixelSize);
+        tex.levels.push_back(level);
+    };
 
     std::vector<std::vector<float>> dataB(64, std::vector<float>(0));
     std::vector<std::vector<float>> dataM(64, std::vector<float>(0));
@@ -253,52 +548,30 @@ void Renderer3D::SetNormal(const char* path) {
         }
     }
 
-    glGenTextures(1, &_bmap);
-    glBindTexture(GL_TEXTURE_2D, _bmap);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    //glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 9);
-
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, w, h, 0, GL_RGB, GL_FLOAT, dataB[0].data());
-
-    glGenTextures(1, &_mmap);
-    glBindTexture(GL_TEXTURE_2D, _mmap);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    //glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 9);
-
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, w, h, 0, GL_RGB, GL_FLOAT, dataM[0].data());
-
-    glGenTextures(1, &_constantSigma);
-    glBindTexture(GL_TEXTURE_2D, _constantSigma);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    //glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 9);
-
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, w, h, 0, GL_RGB, GL_FLOAT, dataS[0].data());
-
-    glGenTextures(1, &_var);
-    glBindTexture(GL_TEXTURE_2D, _var);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    //glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 9);
-
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, w, h, 0, GL_RGB, GL_FLOAT, dataV[0].data());
+    //LEAN maps: b, m, constant sigma and variance, one RGB32F pyramid each
+    int levelCount = MipLevelCount(w, h, 64);
+    for (int t = 0; t < 4; t++) {
+        TextureData lean;
+        lean.internalFormat = GL_RGB32F;
+        lean.type = GL_FLOAT;
+        lean.pixelSize = 3 * sizeof(float);
+        lean.storageLevels = levelCount;
+        lean.levels.reserve(levelCount);
+        textures.push_back(lean);
+    }
+    addFloatLevel(textures[1], w, h, dataB[0]);
+    addFloatLevel(textures[2], w, h, dataM[0]);
+    addFloatLevel(textures[3], w, h, dataS[0]);
+    addFloatLevel(textures[4], w, h, dataV[0]);
 
 
     //width and height of the mipmap levels
     int mw = w;
     int mh = h;
-    for (int i = 1; mw > 0 && mh > 0; i++) { //For each mipmap level
+    for (int i = 1; i < levelCount; i++) { //For each mipmap level
         mw /= 2;
         mh /= 2;
 
-        printf("%d, %d \n", mw, mh);
-
         std::vector<float> Sigma(3); //Mean covariance matrix
         Sigma[0] = 0.0f;
         Sigma[1] = 0.0f;
@@ -366,71 +639,364 @@ void Renderer3D::SetNormal(const char* path) {
         Sigma[1] /= n;
         Sigma[2] /= n;
 
-        printf("Sigma: %f, %f, %f \n", Sigma[0], Sigma[1], Sigma[2]);
-
         for (int j = 0; j < mh * mw * 3; j++) {
             dataS[i].push_back(Sigma[0]);
             dataS[i].push_back(Sigma[1]);
             dataS[i].push_back(Sigma[2]);
         }
 
-        glBindTexture(GL_TEXTURE_2D, _bmap);
-        glTexImage2D(GL_TEXTURE_2D, i, GL_RGB32F, mw, mh, 0, GL_RGB, GL_FLOAT, dataB[i].data());
-        glBindTexture(GL_TEXTURE_2D, _mmap);
-        glTexImage2D(GL_TEXTURE_2D, i, GL_RGB32F, mw, mh, 0, GL_RGB, GL_FLOAT, dataM[i].data());
-        glBindTexture(GL_TEXTURE_2D, _constantSigma);
-        glTexImage2D(GL_TEXTURE_2D, i, GL_RGB32F, mw, mh, 0, GL_RGB, GL_FLOAT, dataS[i].data());
-        glBindTexture(GL_TEXTURE_2D, _var);
-        glTexImage2D(GL_TEXTURE_2D, i, GL_RGB32F, mw, mh, 0, GL_RGB, GL_FLOAT, dataV[i].data());
+        addFloatLevel(textures[1], mw, mh, dataB[i]);
+        addFloatLevel(textures[2], mw, mh, dataM[i]);
+        addFloatLevel(textures[3], mw, mh, dataS[i]);
+        addFloatLevel(textures[4], mw, mh, dataV[i]);
     }
+
+    //The pyramids are all built by now, so this is the peak of the scratch buffers
+    size_t scratch = decoded.capacity();
+    for (int i = 0; i < levelCount; i++)
+        scratch += (dataB[i].capacity() + dataM[i].capacity() + dataS[i].capacity() + dataV[i].capacity()) * sizeof(float);
+    MemoryTracker::Instance().Allocate("Decode scratch", scratch);
+
+    PROFILE_ZONE("GaussianizeTexture");
+    bool gaussianized = GaussianizeTexture(path, ReplaceExtension(path, ".bmap.gaussian"), dataB[0].data(), w, h, mip_levels, filter, textures);
+    MemoryTracker::Instance().Free("Decode scratch", scratch);
+    return gaussianized;
 }
 
-void Renderer3D::Screenshot (const char* path) {
-    glBindFramebuffer(GL_FRAMEBUFFER, _FBO); //Bind
-    glViewport(0, 0, _size.x, _size.y);
+//Renders the view tile by tile, each with the part of the projection it covers, and streams every
+//row of tiles to the file: memory stays bounded by one row of tiles whatever the resolution
+bool Renderer3D::Screenshot (const char* path, int width, int height, int tileSize) {
+    PROFILE_ZONE("Renderer3D::Screenshot");
+    if (width <= 0 || height <= 0) {
+        width = (int)_size.x;
+        height = (int)_size.y;
+    }
+    GLint maxSize[2];
+    glGetIntegerv(GL_MAX_VIEWPORT_DIMS, maxSize);
+    tileSize = std::max(1, std::min(std::min(tileSize, std::max(width, height)), std::min(maxSize[0], maxSize[1])));
+
+    std::string file(path);
+    bool hdr = file.size() > 4 && file.compare(file.size() - 4, 4, ".pfm") == 0;
+    BMPWriter writer;
+    PFMWriter hdrWriter;
+    if (!(hdr ? hdrWriter.Open(path, width, height) : writer.Open(path, width, height)))
+        return false;
+    RenderTarget *tile = _renderTargets.Acquire(tileSize, tileSize, _hdrFormat);
+    RenderTarget *tileDisplay = hdr ? NULL : _renderTargets.Acquire(tileSize, tileSize);
+
+    ImVec2 renderSize = _renderSize;
+    glm::mat4 projection = glm::perspective<float>(glm::radians(55.0), (float)width / height, 0.1f, 1000.0f);
+    std::vector<unsigned char> band(hdr ? 0 : (size_t)width * tileSize * 3);
+    std::vector<float> hdrBand(hdr ? (size_t)width * tileSize * 3 : 0);
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glPixelStorei(GL_PACK_ROW_LENGTH, width);
+    for (int y0 = 0; y0 < height; y0 += tileSize) {
+        int th = std::min(tileSize, height - y0);
+        for (int x0 = 0; x0 < width; x0 += tileSize) {
+            int tw = std::min(tileSize, width - x0);
+
+            //Scales and offsets the clip space so that the tile fills the viewport
+            glm::mat4 crop(1.0f);
+            crop[0][0] = (float)width / tw;
+            crop[1][1] = (float)height / th;
+            crop[3][0] = (width - 2.0f * x0 - tw) / tw;
+            crop[3][1] = (height - 2.0f * y0 - th) / th;
+            _projectionMatrix = crop * projection;
+            _renderSize = ImVec2(tw, th);
+
+            glBindFramebuffer(GL_FRAMEBUFFER, tile->fbo);
+            DrawScene(_clearColor, 0, 0);
+            if (hdr) {
+                glReadPixels(0, 0, tw, th, GL_RGB, GL_FLOAT, &hdrBand[(size_t)x0 * 3]);
+            } else {
+                Tonemap(tile, tileDisplay);
+                glReadPixels(0, 0, tw, th, GL_BGR, GL_UNSIGNED_BYTE, &band[(size_t)x0 * 3]);
+            }
+        }
+        if (hdr)
+            hdrWriter.WriteRows(hdrBand.data(), th);
+        else
+            writer.WriteRows(band.data(), th);
+    }
+    glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    _renderTargets.Release(tile);
+    _renderTargets.Release(tileDisplay);
+
+    _renderSize = renderSize;
+    _projectionMatrix = glm::perspective<float>(glm::radians(55.0), _size.x / _size.y, 0.1f, 1000.0f);
+    return hdr ? hdrWriter.Close() : writer.Close();
+}
+
+void Renderer3D::ReadHDR(std::vector<float> &pixels, int &width, int &height) {
+    PROFILE_ZONE("Renderer3D::ReadHDR");
+    width = _target->width;
+    height = _target->height;
+    pixels.resize((size_t)width * height * 3);
+    glBindFramebuffer(GL_FRAMEBUFFER, _target->fbo);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_FLOAT, pixels.data());
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void Renderer3D::SetFloat32Target(bool enabled) {
+    GLenum format = enabled ? GL_RGBA32F : GL_RGBA16F;
+    if (format == _hdrFormat)
+        return;
+    _hdrFormat = format;
+    RenderTarget *target = _renderTargets.Acquire(_target->width, _target->height, _hdrFormat);
+    _renderTargets.Release(_target);
+    _target = target;
+}
+
+GLuint Renderer3D::MakeLobeLUT() {
+    PROFILE_ZONE("Renderer3D::MakeLobeLUT");
+    float table[LOBE_LUT_SIZE];
+    for (int i = 0; i < LOBE_LUT_SIZE; i++)
+        table[i] = exp(-0.5 * LOBE_LUT_RANGE * i / (LOBE_LUT_SIZE - 1));
+
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, LOBE_LUT_SIZE, 1, 0, GL_RED, GL_FLOAT, table);
+    MemoryTracker::Instance().AddTexture("Lookup tables", texture, GL_R32F, LOBE_LUT_SIZE, 1, 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    return texture;
+}
+
+//Renders the current view with the analytic lobe and with the table, and compares their time and output
+LobeBenchmark Renderer3D::BenchmarkLobeLUT(int frames) {
+    PROFILE_ZONE("Renderer3D::BenchmarkLobeLUT");
+    LobeBenchmark result;
+    bool useLobeLUT = _useLobeLUT;
+    int w = (int)_renderSize.x;
+    int h = (int)_renderSize.y;
+    std::vector<float> images[2];
+
+    GLuint query;
+    glGenQueries(1, &query);
+    glBindFramebuffer(GL_FRAMEBUFFER, _target->fbo);
+    for (int pass = 0; pass < 2; pass++) {
+        _useLobeLUT = pass == 1;
+        DrawScene(ImVec4(0, 0, 0, 1), 0, 0); //Warm up
+
+        GLuint64 elapsed = 0;
+        for (int i = 0; i < frames; i++) {
+            GLuint64 ns = 0;
+            glBeginQuery(GL_TIME_ELAPSED, query);
+            DrawScene(ImVec4(0, 0, 0, 1), 0, 0);
+            glEndQuery(GL_TIME_ELAPSED);
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+            elapsed += ns;
+        }
+        (pass == 0 ? result.analyticMs : result.lutMs) = elapsed / 1e6 / std::max(1, frames);
 
-    char *pixels = new char[3 * (int)_size.x * (int)_size.y];
-    glReadPixels(0, 0, (int)_size.x, (int)_size.y, GL_RGB, GL_UNSIGNED_BYTE, pixels);
-    stbi_flip_vertically_on_write(1);
-    stbi_write_bmp(path, (int)_size.x, (int)_size.y, 3, pixels);
+        images[pass].resize((size_t)w * h * 3);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, w, h, GL_RGB, GL_FLOAT, images[pass].data());
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    }
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteQueries(1, &query);
+    _useLobeLUT = useLobeLUT;
+
+    double sum = 0;
+    float maxError = 0;
+    for (size_t i = 0; i < images[0].size(); i++) {
+        float error = fabsf(images[0][i] - images[1][i]);
+        maxError = std::max(maxError, error);
+        sum += error;
+    }
+    result.maxError = maxError;
+    result.meanError = images[0].empty() ? 0 : sum / images[0].size();
+    return result;
+}
+
+//Renders the current view without and with the depth pre-pass, and counts the fragments shaded by each
+OverdrawStats Renderer3D::MeasureOverdraw(int frames) {
+    PROFILE_ZONE("Renderer3D::MeasureOverdraw");
+    OverdrawStats result;
+    if (_fragmentCounter == 0) {
+        fprintf(stderr, "ERROR::OVERDRAW:: Atomic counters are not supported\n");
+        return result;
+    }
+    bool depthPrepass = _depthPrepass;
+
+    GLuint query;
+    glGenQueries(1, &query);
+    glBindFramebuffer(GL_FRAMEBUFFER, _target->fbo);
+    for (int pass = 0; pass < 2; pass++) {
+        _depthPrepass = pass == 1;
+        DrawScene(ImVec4(0, 0, 0, 1), 0, 0); //Warm up
+
+        GLuint64 elapsed = 0;
+        for (int i = 0; i < frames; i++) {
+            GLuint64 ns = 0;
+            glBeginQuery(GL_TIME_ELAPSED, query);
+            DrawScene(ImVec4(0, 0, 0, 1), 0, 0);
+            glEndQuery(GL_TIME_ELAPSED);
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+            elapsed += ns;
+        }
+        (pass == 0 ? result.ms : result.prepassMs) = elapsed / 1e6 / std::max(1, frames);
+
+        //Counted in a frame of its own, the increments of a single counter would weigh on the timings
+        GLuint count = 0;
+        glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, _fragmentCounter);
+        glBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(GLuint), &count);
+        _countFragments = true;
+        DrawScene(ImVec4(0, 0, 0, 1), 0, 0);
+        _countFragments = false;
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, _fragmentCounter);
+        glGetBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(GLuint), &count);
+        (pass == 0 ? result.fragments : result.prepassFragments) = count;
+    }
+    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteQueries(1, &query);
+    _depthPrepass = depthPrepass;
+    return result;
+}
+
+GLuint Renderer3D::MakeSolidTexture(unsigned char r, unsigned char g, unsigned char b) {
+    const unsigned char pixel[4] = {r, g, b, 255};
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixel);
+    MemoryTracker::Instance().AddTexture("Placeholders", texture, GL_RGBA8, 1, 1, 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    return texture;
 }
 
-void Renderer3D::Draw(ImVec2 size, ImVec4 clearColor, float dt, float t) {
-    glBindFramebuffer(GL_FRAMEBUFFER, _FBO); //Bind
+void Renderer3D::Render(ImVec2 size, ImVec4 clearColor, float dt, float t) {
+    PROFILE_ZONE("Renderer3D::Render");
+    PROFILE_GPU_ZONE("Renderer3D::Render");
+    _textureLoader.Update();
+    _clearColor = clearColor;
+
+    bool changed = _size.x != size.x || _size.y != size.y || *_cameraPosition != _lastCamera;
+    _lastCamera = *_cameraPosition;
     if (_size.x != size.x || _size.y != size.y) {
         _size = size;
-        //Create & Attach a texture to it
-        glGenTextures(1, &_outputColor);
-        glBindTexture(GL_TEXTURE_2D, _outputColor);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, _size.x, _size.y, 0,  GL_RGB, GL_UNSIGNED_BYTE, NULL);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);  
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _outputColor, 0);  
-        GLenum DrawBuffers[1] = {GL_COLOR_ATTACHMENT0};
-        glDrawBuffers(1, DrawBuffers);
-
-        glGenTextures(1, &_outputDepth);
-        glBindTexture(GL_TEXTURE_2D, _outputDepth);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, _size.x, _size.y, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, _outputDepth, 0);
-
-        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-            printf("ERROR::FRAMEBUFFER:: Framebuffer is not complete!\n");
-        
         _projectionMatrix = glm::perspective<float>(glm::radians(55.0), _size.x / _size.y, 0.1f, 1000.0f);        
     }
+
+    //Render size chosen from the GPU time of the previous frames, full size when idle
+    float scale = _dynamicResolution.Update(changed);
     _viewMatrix = glm::lookAt(*_cameraPosition, glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
+    if (!_comparison.empty()) {
+        DrawComparison(clearColor, dt, t, scale);
+        return;
+    }
+
+    ImVec2 renderSize(std::max(1.0f, roundf(_size.x * scale)), std::max(1.0f, roundf(_size.y * scale)));
+    if (_renderSize.x != renderSize.x || _renderSize.y != renderSize.y) {
+        _renderSize = renderSize;
+        //Same targets while the size stays in their bucket, drawn in a sub viewport
+        _target = _renderTargets.Resize(_target, (int)_renderSize.x, (int)_renderSize.y);
+        _display = _renderTargets.Resize(_display, (int)_renderSize.x, (int)_renderSize.y);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, _target->fbo); //Bind
+    _dynamicResolution.Begin();
+    DrawScene(clearColor, dt, t);
+    Tonemap(_target, _display);
+    _dynamicResolution.End();
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0); //Unbind
+}
 
+//Copies the last frame, upscaled to the viewport size, into the (0, 0) corner of the frame buffer fbo:
+//the viewport image of another context, which cannot use the frame buffers of this one
+void Renderer3D::Compose(GLuint fbo) {
+    PROFILE_ZONE("Renderer3D::Compose");
+    PROFILE_GPU_ZONE("Renderer3D::Compose");
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
     glViewport(0, 0, _size.x, _size.y);
+    glClearColor(_clearColor.x, _clearColor.y, _clearColor.z, _clearColor.w);
+    glClear(GL_COLOR_BUFFER_BIT);
+    if (_comparison.empty()) {
+        bool upscaled = _renderSize.x != _size.x || _renderSize.y != _size.y;
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, _display->fbo);
+        glBlitFramebuffer(0, 0, _renderSize.x, _renderSize.y, 0, 0, _size.x, _size.y, GL_COLOR_BUFFER_BIT, upscaled ? GL_LINEAR : GL_NEAREST);
+    } else {
+        //Rows from the top, under the labels placed by RenderThread::Show
+        bool upscaled = _comparisonRenderSize.x != _comparisonCell.x || _comparisonRenderSize.y != _comparisonCell.y;
+        for (size_t i = 0; i < _comparison.size(); i++) {
+            int x = (i % _comparisonColumns) * _comparisonCell.x;
+            int y = _size.y - (i / _comparisonColumns + 1) * _comparisonCell.y;
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, _comparison[i].display->fbo);
+            glBlitFramebuffer(0, 0, _comparisonRenderSize.x, _comparisonRenderSize.y, x, y, x + _comparisonCell.x, y + _comparisonCell.y,
+                              GL_COLOR_BUFFER_BIT, upscaled ? GL_LINEAR : GL_NEAREST);
+        }
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+std::vector<std::string> Renderer3D::getComparisonLabels() const {
+    std::vector<std::string> labels;
+    for (size_t i = 0; i < _comparison.size(); i++)
+        labels.push_back(_comparison[i].name + (i > 0 && _comparisonDifference ? " (difference)" : ""));
+    return labels;
+}
+
+//Draws every comparison view in a cell of a two column grid filling the viewport, then tone maps
+//them, or shows their difference to the first one. Each view has targets of the cell size.
+void Renderer3D::DrawComparison(ImVec4 clearColor, float dt, float t, float scale) {
+    PROFILE_ZONE("Renderer3D::DrawComparison");
+    PROFILE_GPU_ZONE("Renderer3D::DrawComparison");
+    int columns = _comparison.size() > 1 ? 2 : 1;
+    int rows = (_comparison.size() + columns - 1) / columns;
+    ImVec2 cell(std::max(1.0f, floorf(_size.x / columns)), std::max(1.0f, floorf(_size.y / rows)));
+    ImVec2 renderSize = _renderSize;
+    _renderSize = ImVec2(std::max(1.0f, roundf(cell.x * scale)), std::max(1.0f, roundf(cell.y * scale)));
+    _projectionMatrix = glm::perspective<float>(glm::radians(55.0), cell.x / cell.y, 0.1f, 1000.0f);
+
+    _dynamicResolution.Begin();
+    for (ComparisonView &view : _comparison) {
+        view.target = _renderTargets.Resize(view.target, (int)_renderSize.x, (int)_renderSize.y);
+        view.display = _renderTargets.Resize(view.display, (int)_renderSize.x, (int)_renderSize.y);
+        glBindFramebuffer(GL_FRAMEBUFFER, view.target->fbo);
+        if (view.program != 0) {
+            DrawScene(clearColor, dt, t, view.program);
+        } else { //Did not compile
+            glViewport(0, 0, _renderSize.x, _renderSize.y);
+            glClearColor(clearColor.x, clearColor.y, clearColor.z, clearColor.w);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        }
+    }
+    for (size_t i = 0; i < _comparison.size(); i++)
+        Tonemap(_comparison[i].target, _comparison[i].display, i > 0 && _comparisonDifference ? _comparison[0].target : NULL);
+    _dynamicResolution.End();
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    _comparisonColumns = columns;
+    _comparisonCell = cell;
+    _comparisonRenderSize = _renderSize;
+    _renderSize = renderSize;
+    _projectionMatrix = glm::perspective<float>(glm::radians(55.0), _size.x / _size.y, 0.1f, 1000.0f);
+}
+
+//Renders into the bound frame buffer, at the current size, with program or else the scene program
+void Renderer3D::DrawScene(ImVec4 clearColor, float dt, float t, GLuint program) {
+    PROFILE_ZONE("Renderer3D::DrawScene");
+    PROFILE_GPU_ZONE("Renderer3D::DrawScene");
+    if (program == 0)
+        program = _shaderProgram;
+    glViewport(0, 0, _renderSize.x, _renderSize.y);
 
 
     glClearColor(clearColor.x, clearColor.y, clearColor.z, clearColor.w);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  
-    glUseProgram(_shaderProgram);
 
     glEnableVertexAttribArray(0);
     glEnableVertexAttribArray(1);
@@ -444,51 +1010,121 @@ void Renderer3D::Draw(ImVec2 size, ImVec4 clearColor, float dt, float t) {
     glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(VertexData), BUFFER_OFFSET(sizeof(float) * 8));
     glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(VertexData), BUFFER_OFFSET(sizeof(float) * 11));
 
-    glUniformMatrix4fv(glGetUniformLocation(_shaderProgram, "modelMatrix"), 1, GL_FALSE, glm::value_ptr(_modelMatrix));
-    glUniformMatrix4fv(glGetUniformLocation(_shaderProgram, "viewMatrix"), 1, GL_FALSE, glm::value_ptr(_viewMatrix));
-    glUniformMatrix4fv(glGetUniformLocation(_shaderProgram, "projectionMatrix"), 1, GL_FALSE, glm::value_ptr(_projectionMatrix));
-    glUniform3f(glGetUniformLocation(_shaderProgram, "cameraPosition"), _cameraPosition->x, _cameraPosition->y, _cameraPosition->z);
-    glUniform1f(glGetUniformLocation(_shaderProgram, "DTIME"), dt);
-    glUniform1f(glGetUniformLocation(_shaderProgram, "TIME"), t);
-    glUniform1f(glGetUniformLocation(_shaderProgram, "s"), s);
+    //Lays down the depth of the visible surfaces, so that the heavy shader then runs once per pixel
+    if (_depthPrepass) {
+        glUseProgram(_depthProgram);
+        SetMatrices(_depthProgram);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDrawArrays(GL_TRIANGLES, 0, _vertices.size());
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDepthFunc(GL_EQUAL);
+        glDepthMask(GL_FALSE);
+    }
+
+    glUseProgram(program);
+    SetMatrices(program);
+    glUniform3f(glGetUniformLocation(program, "cameraPosition"), _cameraPosition->x, _cameraPosition->y, _cameraPosition->z);
+    glUniform1f(glGetUniformLocation(program, "DTIME"), dt);
+    glUniform1f(glGetUniformLocation(program, "TIME"), t);
+    glUniform1f(glGetUniformLocation(program, "s"), s);
 
 
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, _albedo);
-    glUniform1i(glGetUniformLocation(_shaderProgram, "albedo"), 0);
+    glUniform1i(glGetUniformLocation(program, "albedo"), 0);
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_2D, _normal);
-    glUniform1i(glGetUniformLocation(_shaderProgram, "normal"), 1);
+    glUniform1i(glGetUniformLocation(program, "normal"), 1);
     glActiveTexture(GL_TEXTURE2);
     glBindTexture(GL_TEXTURE_2D, _roughness);
-    glUniform1i(glGetUniformLocation(_shaderProgram, "roughness"), 2);
+    glUniform1i(glGetUniformLocation(program, "roughness"), 2);
     glActiveTexture(GL_TEXTURE3);
     glBindTexture(GL_TEXTURE_2D, _bmap);
-    glUniform1i(glGetUniformLocation(_shaderProgram, "bmap"), 3);
+    glUniform1i(glGetUniformLocation(program, "bmap"), 3);
     glActiveTexture(GL_TEXTURE4);
     glBindTexture(GL_TEXTURE_2D, _mmap);
-    glUniform1i(glGetUniformLocation(_shaderProgram, "mmap"), 4);
+    glUniform1i(glGetUniformLocation(program, "mmap"), 4);
     glActiveTexture(GL_TEXTURE5);
     glBindTexture(GL_TEXTURE_2D, _mipchart);
-    glUniform1i(glGetUniformLocation(_shaderProgram, "mipchart"), 5);
+    glUniform1i(glGetUniformLocation(program, "mipchart"), 5);
     glActiveTexture(GL_TEXTURE6);
     glBindTexture(GL_TEXTURE_2D, _constantSigma);
-    glUniform1i(glGetUniformLocation(_shaderProgram, "constantSigma"), 6);
+    glUniform1i(glGetUniformLocation(program, "constantSigma"), 6);
     glActiveTexture(GL_TEXTURE7);
     glBindTexture(GL_TEXTURE_2D, _var);
-    glUniform1i(glGetUniformLocation(_shaderProgram, "var"), 7);
+    glUniform1i(glGetUniformLocation(program, "var"), 7);
+    glActiveTexture(GL_TEXTURE8);
+    glBindTexture(GL_TEXTURE_2D, _envMap);
+    glUniform1i(glGetUniformLocation(program, "environment"), 8);
+    glActiveTexture(GL_TEXTURE9);
+    glBindTexture(GL_TEXTURE_2D, _irradianceSH);
+    glUniform1i(glGetUniformLocation(program, "irradianceSH"), 9);
+    glUniform1f(glGetUniformLocation(program, "environmentLevels"), _environmentLevels);
+    glUniform1f(glGetUniformLocation(program, "environmentMaxSigma"), environment.maxSigma);
+    glUniform1i(glGetUniformLocation(program, "useEnvironment"), _useEnvironment);
+    glActiveTexture(GL_TEXTURE10);
+    glBindTexture(GL_TEXTURE_2D, _lobeLUT);
+    glUniform1i(glGetUniformLocation(program, "lobeLUT"), 10);
+    glUniform1f(glGetUniformLocation(program, "lobeLUTRange"), LOBE_LUT_RANGE);
+    glUniform1i(glGetUniformLocation(program, "useLobeLUT"), _useLobeLUT);
+    glActiveTexture(GL_TEXTURE13);
+    glBindTexture(GL_TEXTURE_2D, _bmapGaussian);
+    glUniform1i(glGetUniformLocation(program, "bmapGaussian"), 13);
+    glActiveTexture(GL_TEXTURE14);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, _bmapLUT);
+    glUniform1i(glGetUniformLocation(program, "bmapLUT"), 14);
+    glUniform1i(glGetUniformLocation(program, "useHistogram"), _useHistogram);
+    glUniform1i(glGetUniformLocation(program, "countFragments"), _countFragments);
+    if (_fragmentCounter != 0)
+        glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 0, _fragmentCounter);
 
     glDrawArrays(GL_TRIANGLES, 0, _vertices.size());
 
+    if (_depthPrepass) {
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+    }
+
     glDisableVertexAttribArray(0);
     glDisableVertexAttribArray(1);
     glDisableVertexAttribArray(2);
     glDisableVertexAttribArray(3);
     glDisableVertexAttribArray(4);
+}
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0); //Unbind
+//Exposure and tone curve from the linear source into destination, at the current size,
+//or the magnified difference of source to reference when there is one
+void Renderer3D::Tonemap(RenderTarget *source, RenderTarget *destination, RenderTarget *reference) {
+    PROFILE_ZONE("Renderer3D::Tonemap");
+    PROFILE_GPU_ZONE("Renderer3D::Tonemap");
+    glBindFramebuffer(GL_FRAMEBUFFER, destination->fbo);
+    glViewport(0, 0, _renderSize.x, _renderSize.y);
+    GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+    glDisable(GL_DEPTH_TEST);
+
+    glUseProgram(_tonemapProgram);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, source->color);
+    glUniform1i(glGetUniformLocation(_tonemapProgram, "hdr"), 0);
+    glUniform1f(glGetUniformLocation(_tonemapProgram, "exposure"), _exposure);
+    glUniform1i(glGetUniformLocation(_tonemapProgram, "tonemap"), _tonemap);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, reference != NULL ? reference->color : source->color);
+    glUniform1i(glGetUniformLocation(_tonemapProgram, "reference"), 1);
+    glUniform1i(glGetUniformLocation(_tonemapProgram, "difference"), reference != NULL);
+    glUniform1f(glGetUniformLocation(_tonemapProgram, "differenceScale"), _differenceScale);
+    glBindVertexArray(_tonemapVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+
+    if (depthTest)
+        glEnable(GL_DEPTH_TEST);
+}
 
-    ImGui::Image((ImTextureID)_outputColor, _size, ImVec2(0, 1), ImVec2(1, 0));
+void Renderer3D::SetMatrices(GLuint program) {
+    glUniformMatrix4fv(glGetUniformLocation(program, "modelMatrix"), 1, GL_FALSE, glm::value_ptr(_modelMatrix));
+    glUniformMatrix4fv(glGetUniformLocation(program, "viewMatrix"), 1, GL_FALSE, glm::value_ptr(_viewMatrix));
+    glUniformMatrix4fv(glGetUniformLocation(program, "projectionMatrix"), 1, GL_FALSE, glm::value_ptr(_projectionMatrix));
 }
 
 
@@ -506,6 +1142,19 @@ std::vector<std::string> splitstr (std::string str, std::string del) {
 }
 
 void Renderer3D::LoadMesh(const char* model) {
+    PROFILE_ZONE("Renderer3D::LoadMesh");
+    ParseMesh(model, _vertices);
+
+    glGenBuffers(1, &_VBO);
+    glBindBuffer(GL_ARRAY_BUFFER, _VBO);
+    glBufferData(GL_ARRAY_BUFFER, _vertices.size() * sizeof(VertexData), _vertices.data(), GL_STATIC_DRAW);
+    MemoryTracker::Instance().AddBuffer("Vertex buffers", _VBO, _vertices.size() * sizeof(VertexData));
+    MemoryTracker::Instance().Allocate("Vertices", _vertices.capacity() * sizeof(VertexData));
+}
+
+//Triangles of an OBJ file, three vertices each, with the tangent frame of their face
+void Renderer3D::ParseMesh(const char* model, std::vector<VertexData> &vertices) {
+    PROFILE_ZONE("Renderer3D::ParseMesh");
     std::ifstream file(model);
     assert (file.is_open());
 
@@ -556,12 +1205,12 @@ void Renderer3D::LoadMesh(const char* model) {
                 vdata.uv = uvs[b];
                 vdata.normal = normals[c];
 
-                _vertices.push_back(vdata);
+                vertices.push_back(vdata);
             }
 
-            VertexData *v1 = &_vertices.at(_vertices.size() - 3);
-            VertexData *v2 = &_vertices.at(_vertices.size() - 2);
-            VertexData *v3 = &_vertices.at(_vertices.size() - 1);
+            VertexData *v1 = &vertices.at(vertices.size() - 3);
+            VertexData *v2 = &vertices.at(vertices.size() - 2);
+            VertexData *v3 = &vertices.at(vertices.size() - 1);
 
             glm::vec3 edge1 = v2->position - v1->position;
             glm::vec3 edge2 = v3->position - v1->position;
@@ -588,10 +1237,6 @@ void Renderer3D::LoadMesh(const char* model) {
             v2->bitangeant = bitangent;
             v3->bitangeant = bitangent;
         }
-
-        glGenBuffers(1, &_VBO);
-        glBindBuffer(GL_ARRAY_BUFFER, _VBO);
-        glBufferData(GL_ARRAY_BUFFER, _vertices.size() * sizeof(VertexData), _vertices.data(), GL_STATIC_DRAW);
     }
 
     //Free the memory
@@ -602,6 +1247,7 @@ void Renderer3D::LoadMesh(const char* model) {
 }
 
 std::string Renderer3D::SetFShader(const std::string &code) {
+    PROFILE_ZONE("Renderer3D::SetFShader");
     GLchar infoLog[1024];
     GLuint fShader = glCreateShader(GL_FRAGMENT_SHADER);
 
@@ -635,12 +1281,16 @@ std::string Renderer3D::SetFShader(const std::string &code) {
     }
 
     _fShader = fShader;
+    _fShaderCode = code;
+    for (ComparisonView &view : _comparison)
+        MakeComparisonProgram(view);
 
     return std::string("");
 }
 
 
 std::string Renderer3D::SetVShader(const std::string &code) {
+    PROFILE_ZONE("Renderer3D::SetVShader");
     GLchar infoLog[1024];
     GLuint vShader = glCreateShader(GL_VERTEX_SHADER);
 
@@ -674,12 +1324,16 @@ std::string Renderer3D::SetVShader(const std::string &code) {
     }
 
     _vShader = vShader;
+    MakeDepthProgram();
+    for (ComparisonView &view : _comparison)
+        MakeComparisonProgram(view);
 
     return std::string("");
 }
 
 
 void Renderer3D::MakeShaderProgram(const char* fragmentShader, const char* vertexShader) {
+    PROFILE_ZONE("Renderer3D::MakeShaderProgram");
     //SHADER
     _shaderProgram = glCreateProgram();
     GLint success;
@@ -714,6 +1368,7 @@ void Renderer3D::MakeShaderProgram(const char* fragmentShader, const char* verte
     std::stringstream fCodeStream;
     fCodeStream << fCodeFile.rdbuf();
     std::string fCodeStr = fCodeStream.str();
+    _fShaderCode = fCodeStr;
 
     const GLchar* fCode[1];
     fCode[0] = fCodeStr.c_str();
@@ -741,7 +1396,132 @@ void Renderer3D::MakeShaderProgram(const char* fragmentShader, const char* verte
         glGetProgramInfoLog(_shaderProgram, sizeof(ErrorLog), NULL, ErrorLog);
         fprintf(stderr, "Error linking shader program: '%s'\n", ErrorLog);
     }
+    MakeDepthProgram();
+}
+
+//Links the vertex shader with an empty fragment shader, for the depth pre-pass
+void Renderer3D::MakeDepthProgram() {
+    PROFILE_ZONE("Renderer3D::MakeDepthProgram");
+    if (_depthFShader == 0) {
+        const GLchar* code = "#version 330\nvoid main () {}\n";
+        _depthFShader = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(_depthFShader, 1, &code, NULL);
+        glCompileShader(_depthFShader);
+    }
+    if (_depthProgram != 0)
+        glDeleteProgram(_depthProgram);
+    _depthProgram = glCreateProgram();
+    glAttachShader(_depthProgram, _vShader);
+    glAttachShader(_depthProgram, _depthFShader);
+    glLinkProgram(_depthProgram);
+
+    GLint success;
+    glGetProgramiv(_depthProgram, GL_LINK_STATUS, &success);
+    if (success == 0) {
+        GLchar ErrorLog[1024];
+        glGetProgramInfoLog(_depthProgram, sizeof(ErrorLog), NULL, ErrorLog);
+        fprintf(stderr, "Error linking depth program: '%s'\n", ErrorLog);
+    }
+}
+
+//Compiles code, 0 when it fails
+static GLuint CompileShaderCode(GLenum type, const std::string &code, const char* name) {
+    const GLchar* source = code.c_str();
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+    GLint success;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    if (!success) {
+        GLchar InfoLog[1024];
+        glGetShaderInfoLog(shader, sizeof(InfoLog), NULL, InfoLog);
+        fprintf(stderr, "Error compiling shader '%s': '%s'\n", name, InfoLog);
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
 }
 
+//Compiles the shader in file path, 0 when it fails
+static GLuint CompileShaderFile(GLenum type, const char* path) {
+    std::ifstream file(path);
+    std::stringstream stream;
+    stream << file.rdbuf();
+    return CompileShaderCode(type, stream.str(), path);
+}
+
+//The fullscreen triangle is generated from gl_VertexID, the vertex array stays empty
+void Renderer3D::MakeTonemapProgram() {
+    PROFILE_ZONE("Renderer3D::MakeTonemapProgram");
+    GLuint vShader = CompileShaderFile(GL_VERTEX_SHADER, TONEMAP_VSHADER);
+    GLuint fShader = CompileShaderFile(GL_FRAGMENT_SHADER, TONEMAP_FSHADER);
+    _tonemapProgram = glCreateProgram();
+    glAttachShader(_tonemapProgram, vShader);
+    glAttachShader(_tonemapProgram, fShader);
+    glLinkProgram(_tonemapProgram);
+    glDeleteShader(vShader);
+    glDeleteShader(fShader);
+
+    GLint success;
+    glGetProgramiv(_tonemapProgram, GL_LINK_STATUS, &success);
+    if (success == 0) {
+        GLchar ErrorLog[1024];
+        glGetProgramInfoLog(_tonemapProgram, sizeof(ErrorLog), NULL, ErrorLog);
+        fprintf(stderr, "Error linking tonemap program: '%s'\n", ErrorLog);
+    }
+    glGenVertexArrays(1, &_tonemapVAO);
+}
+
+
+void Renderer3D::AddComparisonView(const char* name, const char* defines) {
+    ComparisonView view;
+    view.name = name;
+    view.defines = defines;
+    view.target = _renderTargets.Acquire((int)_renderSize.x, (int)_renderSize.y, _hdrFormat);
+    view.display = _renderTargets.Acquire((int)_renderSize.x, (int)_renderSize.y);
+    MakeComparisonProgram(view);
+    _comparison.push_back(view);
+}
+
+void Renderer3D::ClearComparison() {
+    for (ComparisonView &view : _comparison) {
+        glDeleteProgram(view.program);
+        _renderTargets.Release(view.target);
+        _renderTargets.Release(view.display);
+    }
+    _comparison.clear();
+}
+
+//The current fragment shader with the defines of view after its #version line
+void Renderer3D::MakeComparisonProgram(ComparisonView &view) {
+    PROFILE_ZONE("Renderer3D::MakeComparisonProgram");
+    glDeleteProgram(view.program);
+    view.program = 0;
+
+    std::string code = _fShaderCode;
+    size_t version = code.find("#version");
+    size_t line = version == std::string::npos ? std::string::npos : code.find('\n', version);
+    code.insert(line == std::string::npos ? 0 : line + 1, view.defines + "\n");
+    GLuint fShader = CompileShaderCode(GL_FRAGMENT_SHADER, code, view.name.c_str());
+    if (fShader == 0)
+        return;
+
+    view.program = glCreateProgram();
+    glAttachShader(view.program, _vShader);
+    glAttachShader(view.program, fShader);
+    glLinkProgram(view.program);
+    glDetachShader(view.program, _vShader);
+    glDeleteShader(fShader);
+
+    GLint success;
+    glGetProgramiv(view.program, GL_LINK_STATUS, &success);
+    if (success == 0) {
+        GLchar ErrorLog[1024];
+        glGetProgramInfoLog(view.program, sizeof(ErrorLog), NULL, ErrorLog);
+        fprintf(stderr, "Error linking comparison program '%s': '%s'\n", view.name.c_str(), ErrorLog);
+        glDeleteProgram(view.program);
+        view.program = 0;
+    }
+}
 
-#endif
\ No newline at end of file
+#endif
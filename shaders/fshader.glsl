@@ -1,5 +1,15 @@
 #version 400
 
+//Overdraw statistics: every shaded fragment increments the counter when countFragments is set.
+//Depth is tested before shading, otherwise the side effect of the counter disables early-Z
+#if defined(GL_ARB_shader_atomic_counters) && defined(GL_ARB_shader_image_load_store)
+#extension GL_ARB_shader_atomic_counters : enable
+#extension GL_ARB_shader_image_load_store : enable
+#define FRAGMENT_COUNTER
+layout(early_fragment_tests) in;
+layout(binding = 0, offset = 0) uniform atomic_uint fragmentCount;
+#endif
+
 in vec3 vPosition;
 in vec2 vUv;
 in vec3 vNormal;
@@ -17,6 +27,18 @@ uniform sampler2D roughness;
 uniform sampler2D mipchart;
 uniform sampler2D constantSigma;
 uniform sampler2D var;
+uniform sampler2D environment;
+uniform sampler2D irradianceSH;
+uniform float environmentLevels;
+uniform float environmentMaxSigma;
+uniform bool useEnvironment;
+uniform sampler2D lobeLUT;
+uniform float lobeLUTRange;
+uniform bool useLobeLUT;
+uniform sampler2D bmapGaussian;
+uniform sampler2DArray bmapLUT;
+uniform bool useHistogram;
+uniform bool countFragments;
 
 uniform vec3 cameraPosition;
 
@@ -195,7 +217,16 @@ float getSpecularIntensity (float meanx, float meany, float varx, float vary, fl
 	float det = sigma.x * sigma.y - sigma.z * sigma.z;
 	
 	float e = (hb.x*hb.x*sigma.y + hb.y*hb.y*sigma.x - 2.0*hb.x*hb.y*sigma.z);
-	float spec = (det <= 0.0) ? 0.0 : exp(-0.5 * e / det) / sqrt(det);
+	if (det <= 0.0) return 0.0;
+	
+	if (useLobeLUT) {
+		//exp(-q / 2) read from a table, q = e / det being the squared whitened distance to the mean
+		float q = clamp(e / det / lobeLUTRange, 0.0, 1.0);
+		float n = float(textureSize(lobeLUT, 0).x);
+		return texture(lobeLUT, vec2(q * (n - 1.0) / n + 0.5 / n, 0.5)).r * inversesqrt(det);
+	}
+	
+	float spec = exp(-0.5 * e / det) / sqrt(det);
 	
 	return spec;
 }
@@ -277,6 +308,54 @@ vec3 TilingAndBlending(sampler2D tex, vec2 uv)
 	return G;
 }
 
+//Maps blended gaussian values back to the texture values: inverse CDF of each channel
+//(first row of the LUT layer prefiltered for the mip level), then out of the PCA space
+//(basis and mean on the second row)
+vec3 InverseHistogramLayer(sampler2DArray lut, vec3 G, float layer) {
+	return vec3(
+		texture(lut, vec3(G.r, 0.25, layer)).r,
+		texture(lut, vec3(G.g, 0.25, layer)).g,
+		texture(lut, vec3(G.b, 0.25, layer)).b);
+}
+
+vec3 InverseHistogram(sampler2DArray lut, vec3 G, float lod) {
+	G = clamp(G, 0.0, 1.0);
+	lod = clamp(lod, 0.0, float(textureSize(lut, 0).z - 1));
+	vec3 T = mix(InverseHistogramLayer(lut, G, floor(lod)), InverseHistogramLayer(lut, G, ceil(lod)), fract(lod));
+	mat3 basis = mat3(texelFetch(lut, ivec3(0, 1, 0), 0).rgb, texelFetch(lut, ivec3(1, 1, 0), 0).rgb, texelFetch(lut, ivec3(2, 1, 0), 0).rgb);
+	return texelFetch(lut, ivec3(3, 1, 0), 0).rgb + basis * T;
+}
+
+
+// Histogram-preserving by-example noise at uv (Heitz & Neyret), from a gaussianized texture
+vec3 TilingAndBlendingHistogram(sampler2D gaussian, sampler2DArray lut, vec2 uv)
+{
+	// Get triangle info
+	float w1, w2, w3;
+	ivec2 vertex1, vertex2, vertex3;
+	TriangleGrid(uv, w1, w2, w3, vertex1, vertex2, vertex3);
+
+	float wp1 = w1 / sqrt((pow(w1,2) + pow(w2,2) + pow(w3,2)));
+	float wp2 = w2 / sqrt((pow(w1,2) + pow(w2,2) + pow(w3,2)));
+	float wp3 = w3 / sqrt((pow(w1,2) + pow(w2,2) + pow(w3,2)));
+
+	// Assign random offset to each triangle vertex
+	vec2 uv1 = uv + hash(vertex1);
+	vec2 uv2 = uv + hash(vertex2);
+	vec2 uv3 = uv + hash(vertex3);
+
+	// Fetch Gaussian input
+	vec3 G1 = gtexture(gaussian, uv1).rgb;
+	vec3 G2 = gtexture(gaussian, uv2).rgb;
+	vec3 G3 = gtexture(gaussian, uv3).rgb;
+
+	// Variance-preserving blending around the mean
+	vec3 G = wp1*(G1 - 0.5) + wp2*(G2 - 0.5) + wp3*(G3 - 0.5) + 0.5;
+	
+	float level = (lod < 0) ? textureQueryLod(gaussian, uv).y : lod;
+	return InverseHistogram(lut, G, level);
+}
+
 // By-Example procedural noise at uv
 vec3 TilingAndBlendingSq(sampler2D tex, vec2 uv)
 {
@@ -337,7 +416,7 @@ vec3 getSpecular (float intensity, bool constSigm, vec2 uv) {
 }
 
 float SpecularTilingBlending (bool csigma, bool cov0, vec2 uv) {
-	vec3 b = TilingAndBlending(bmap, uv);
+	vec3 b = useHistogram ? TilingAndBlendingHistogram(bmapGaussian, bmapLUT, uv) : TilingAndBlending(bmap, uv);
 	vec3 v = TilingAndBlendingSq(var, uv);
 
 	float meanx = b.x;
@@ -404,7 +483,7 @@ vec3 getDiffuse (float bias, int lod, vec2 uv) {
 
 
 vec3 getTilingBlendingDiffuse (vec3 color, float bias, vec2 uv) {
-	vec3 b = TilingAndBlending(bmap, uv);
+	vec3 b = useHistogram ? TilingAndBlendingHistogram(bmapGaussian, bmapLUT, uv) : TilingAndBlending(bmap, uv);
 	vec3 micronormal = normalize(vec3(b.x, -b.y, 1)).xzy;
 	vec3 n = NormalToGlobalSpace(micronormal);
 	return (max(lightColor * (dot(n, lightDirection()) * (1.0 - bias) + bias), 0.0) + ambientColor) * color;
@@ -464,23 +543,70 @@ vec3 groundTruthDiffuse (int n) {
 	return mean;
 }
 
+/////////// ENVIRONMENT
+
+
+//Equirectangular coordinates of a direction
+vec2 equirect(vec3 d) {
+	return vec2(atan(d.z, d.x) / (2.0 * pi) + 0.5, acos(clamp(d.y, -1.0, 1.0)) / pi);
+}
+
+
+//Radiance around r, prefiltered by a gaussian slope lobe of variance sigma2 (one lookup)
+vec3 getEnvironmentSpecular(vec3 r, float sigma2) {
+	float lod = sqrt(sigma2) / environmentMaxSigma * (environmentLevels - 1.0);
+	return textureLod(environment, equirect(r), lod).rgb;
+}
+
+
+//Irradiance from the SH9 projection of the environment
+vec3 getIrradiance(vec3 n) {
+	float basis[9] = float[9](
+				0.282095,
+				0.488603 * n.y, 0.488603 * n.z, 0.488603 * n.x,
+				1.092548 * n.x * n.y, 1.092548 * n.y * n.z, 0.315392 * (3.0 * n.z * n.z - 1.0),
+				1.092548 * n.x * n.z, 0.546274 * (n.x * n.x - n.y * n.y));
+	
+	vec3 irradiance = vec3(0);
+	for (int i = 0; i < 9; i++) {
+		irradiance += basis[i] * texture(irradianceSH, vec2((i + 0.5) / 9.0, 0.5)).rgb;
+	}
+	return max(irradiance, 0.0);
+}
+
+
+
 /////////// MAIN
 
 void main () {
+#ifdef FRAGMENT_COUNTER
+	if (countFragments)
+		atomicCounterIncrement(fragmentCount);
+#endif
 	vec2 uv = vUv + vec2(0, 0);
 	float t = 0.0;
+	int n = 4;
+	//Specular variant, defined by the comparison views: per-texel covariance by default
+#if defined(GROUND_TRUTH)
+	t = groundTruth(n);
+#elif defined(CONSTANT_SIGMA)
+	t = SpecularTilingBlending(true, false, uv);
+#elif defined(COV0)
+	t = SpecularTilingBlending(false, true, uv);
+#else
 	t = SpecularTilingBlending(false, false, uv);
+#endif
 	//t = Specular(false, true, vUv); 
 	
-	int n = 4;
-	
-	//t = groundTruth(n);
-	
 	vec3 diffuse = getTilingBlendingDiffuse(vec3(0.2, 0.3, 0.5) * 0.75, 0.5, uv); //0.2 0.3 0.5
 	
 	//diffuse = groundTruthDiffuse(n);
 	
-	vec3 color = vec3(tanh(t*0.04)*1.05) + diffuse;
+	//Linear radiance, tone mapped by the tonemap pass
+	vec3 color = vec3(t * 0.04) + diffuse;
+	
+	if (useEnvironment)
+		color += getEnvironmentSpecular(reflect(-viewDirection(), vNormal), 1.0 / s) * 0.1 + getIrradiance(vNormal) / pi * 0.1;
 
 	//color = texture(albedo, vUv).rgb;
 	FragColor = vec4(color, 1.0);
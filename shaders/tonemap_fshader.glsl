@@ -0,0 +1,24 @@
+#version 330
+
+//Linear radiance of the scene, one texel per output pixel
+uniform sampler2D hdr;
+uniform float exposure;	//in stops
+uniform bool tonemap;	//tanh curve, or clamped to [0;1] by the 8-bit target
+//Comparison views: absolute difference to the reference view instead, magnified
+uniform sampler2D reference;
+uniform bool difference;
+uniform float differenceScale;
+
+out vec4 FragColor;
+
+void main () {
+	vec3 color = texelFetch(hdr, ivec2(gl_FragCoord.xy), 0).rgb;
+	if (difference) {
+		FragColor = vec4(abs(color - texelFetch(reference, ivec2(gl_FragCoord.xy), 0).rgb) * differenceScale, 1.0);
+		return;
+	}
+	color *= exp2(exposure);
+	if (tonemap)
+		color = tanh(color);
+	FragColor = vec4(color, 1.0);
+}
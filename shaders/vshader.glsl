@@ -17,6 +17,9 @@ out vec3 vNormal;
 out vec3 vTangent;
 out vec3 vBitangent;
 
+//Same depth in the depth pre-pass and in the shading pass, which tests it for equality
+invariant gl_Position;
+
 void main () {
     gl_Position = projectionMatrix * viewMatrix * modelMatrix * vec4(iPosition, 1.0);
 
@@ -0,0 +1,139 @@
+// Offline block compression of the material textures, run as part of the asset pipeline:
+//   texture_encoder <bc1|bc4|bc5> input.png output.dds [threads]
+// bc1 for albedo, bc4 for roughness and bc5 for normal maps (x and y, z is rebuilt when loading).
+// The whole mip chain is generated with a Kaiser filter and written to a DX10 DDS file
+// that the renderer picks up instead of the image with the same name.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#include "blockCompression.h"
+#include "mipmap.h"
+
+
+struct Image {
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    std::vector<unsigned char> pixels;
+};
+
+// Block rows [from, to) of the level, borders padded by repeating the last texels
+void EncodeRows(const Image &image, const std::string &format, int blockSize, int from, int to, unsigned char *out) {
+    int bw = (image.width + 3) / 4;
+    std::vector<unsigned char> texels(4 * 4 * image.channels);
+    for (int by = from; by < to; by++) {
+        for (int bx = 0; bx < bw; bx++) {
+            for (int y = 0; y < 4; y++) {
+                int sy = std::min(4 * by + y, image.height - 1);
+                for (int x = 0; x < 4; x++) {
+                    int sx = std::min(4 * bx + x, image.width - 1);
+                    memcpy(&texels[(4 * y + x) * image.channels], &image.pixels[((size_t)sy * image.width + sx) * image.channels], image.channels);
+                }
+            }
+            unsigned char *block = out + ((size_t)by * bw + bx) * blockSize;
+            if (format == "bc1")
+                EncodeBC1Block(texels.data(), 4 * image.channels, image.channels, block);
+            else if (format == "bc4")
+                EncodeBC4Block(texels.data(), 4 * image.channels, image.channels, 0, block);
+            else
+                EncodeBC5Block(texels.data(), 4 * image.channels, image.channels, block);
+        }
+    }
+}
+
+void WriteHeader(FILE *file, int width, int height, int levels, int dxgiFormat, size_t firstLevelBytes) {
+    uint32_t header[32] = {0};
+    memcpy(&header[0], "DDS ", 4);
+    header[1] = 124;
+    header[2] = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000; //caps, height, width, pixel format, mip count, linear size
+    header[3] = height;
+    header[4] = width;
+    header[5] = firstLevelBytes;
+    header[7] = levels;
+    header[19] = 32;
+    header[20] = 0x4; //four CC
+    memcpy(&header[21], "DX10", 4);
+    header[27] = 0x1000 | 0x400000 | 0x8; //texture, mipmap, complex
+    uint32_t dx10[5] = {(uint32_t)dxgiFormat, 3, 0, 1, 0}; //2D texture, array of one
+    fwrite(header, sizeof(header), 1, file);
+    fwrite(dx10, sizeof(dx10), 1, file);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s <bc1|bc4|bc5> input output.dds [threads]\n", argv[0]);
+        return 1;
+    }
+    std::string format = argv[1];
+    int channels, blockSize, dxgiFormat;
+    if (format == "bc1") {
+        channels = 3; blockSize = 8; dxgiFormat = 71;
+    } else if (format == "bc4") {
+        channels = 1; blockSize = 8; dxgiFormat = 80;
+    } else if (format == "bc5") {
+        channels = 3; blockSize = 16; dxgiFormat = 83;
+    } else {
+        fprintf(stderr, "ERROR::ENCODER:: Unknown format '%s'\n", argv[1]);
+        return 1;
+    }
+    int threads = argc > 4 ? atoi(argv[4]) : (int)std::thread::hardware_concurrency();
+    threads = std::max(1, threads);
+
+    Image image;
+    unsigned char *data = stbi_load(argv[2], &image.width, &image.height, &image.channels, channels);
+    if (data == NULL) {
+        fprintf(stderr, "ERROR::ENCODER:: Could not load '%s': %s\n", argv[2], stbi_failure_reason());
+        return 1;
+    }
+    image.channels = channels;
+    image.pixels.assign(data, data + (size_t)image.width * image.height * channels);
+    stbi_image_free(data);
+
+    FILE *file = fopen(argv[3], "wb");
+    if (file == NULL) {
+        fprintf(stderr, "ERROR::ENCODER:: Could not write '%s'\n", argv[3]);
+        return 1;
+    }
+
+    int levels = 1;
+    while ((image.width >> levels) > 0 && (image.height >> levels) > 0)
+        levels++;
+    WriteHeader(file, image.width, image.height, levels, dxgiFormat, (size_t)((image.width + 3) / 4) * ((image.height + 3) / 4) * blockSize);
+
+    MipGenerator mips(image.width, image.height, channels, image.pixels.data(), MIP_FILTER_KAISER, format == "bc1" ? MIP_SRGB : format == "bc5" ? MIP_NORMALS : 0);
+    size_t inputBytes = 0, outputBytes = 0;
+    for (int l = 0; l < levels; l++) {
+        if (l > 0) {
+            mips.Next();
+            image.width = mips.Width();
+            image.height = mips.Height();
+            image.pixels.resize((size_t)image.width * image.height * channels);
+            mips.Store(image.pixels.data());
+        }
+
+        int rows = (image.height + 3) / 4;
+        std::vector<unsigned char> blocks((size_t)rows * ((image.width + 3) / 4) * blockSize);
+        int count = std::min(threads, rows);
+        std::vector<std::thread> workers;
+        for (int t = 0; t < count; t++)
+            workers.push_back(std::thread(EncodeRows, std::cref(image), std::cref(format), blockSize, rows * t / count, rows * (t + 1) / count, blocks.data()));
+        for (auto &worker : workers)
+            worker.join();
+
+        fwrite(blocks.data(), 1, blocks.size(), file);
+        inputBytes += image.pixels.size();
+        outputBytes += blocks.size();
+    }
+    fclose(file);
+
+    printf("%s: %d levels, %zu -> %zu bytes\n", argv[3], levels, inputBytes, outputBytes);
+    return 0;
+}
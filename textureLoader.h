@@ -0,0 +1,539 @@
+#ifndef __TEXTURELOADER__
+#define __TEXTURELOADER__
+
+#include <GL/glew.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <map>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "stb_image.h"
+#include "mipmap.h"
+#include "profiler.h"
+#include "memoryTracker.h"
+
+
+struct TextureLevel {
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> pixels;
+};
+
+// CPU side of a texture: its levels and how to allocate and sample it
+struct TextureData {
+    GLenum internalFormat = GL_RGB8;
+    GLenum format = GL_RGB;
+    GLenum type = GL_UNSIGNED_BYTE;
+    int pixelSize = 3;
+    int blockSize = 0;              //bytes per 4x4 block of a block compressed format, 0 otherwise
+    int layers = 0;                 //a 2D array texture of one level when > 0, levels holds its layers
+    int storageLevels = 1;
+    GLint wrapS = GL_REPEAT;
+    GLint wrapT = GL_REPEAT;
+    GLint minFilter = GL_LINEAR_MIPMAP_LINEAR;
+    GLint magFilter = GL_LINEAR;
+    float maxAniso = 0;
+    std::vector<TextureLevel> levels;
+};
+
+// Number of levels of a full mip chain, capped to maxLevels
+int MipLevelCount(int w, int h, int maxLevels) {
+    int levels = 1;
+    while (levels < maxLevels && (w >> levels) > 0 && (h >> levels) > 0)
+        levels++;
+    return levels;
+}
+
+// Bytes of one w*h level of tex
+size_t LevelBytes(const TextureData &tex, int w, int h) {
+    if (tex.blockSize > 0)
+        return (size_t)((w + 3) / 4) * ((h + 3) / 4) * tex.blockSize;
+    return (size_t)w * h * tex.pixelSize;
+}
+
+// GPU bytes of every level allocated for the textures
+size_t TextureBytes(const std::vector<TextureData> &textures) {
+    size_t bytes = 0;
+    for (auto &tex : textures) {
+        if (tex.levels.empty())
+            continue;
+        if (tex.layers > 0)
+            bytes += LevelBytes(tex, tex.levels[0].width, tex.levels[0].height) * tex.layers;
+        else for (int l = 0; l < tex.storageLevels; l++)
+            bytes += LevelBytes(tex, std::max(1, tex.levels[0].width >> l), std::max(1, tex.levels[0].height >> l));
+    }
+    return bytes;
+}
+
+// Bytes of the levels decoded on the CPU
+size_t DecodedBytes(const std::vector<TextureData> &textures) {
+    size_t bytes = 0;
+    for (auto &tex : textures)
+        for (auto &level : tex.levels)
+            bytes += level.pixels.size();
+    return bytes;
+}
+
+// Fills the levels of an 8-bit texture after its first one, up to storageLevels
+void GenerateMipChain(TextureData &tex, MipFilter filter, int flags) {
+    const TextureLevel &first = tex.levels[0];
+    MipGenerator generator(first.width, first.height, tex.pixelSize, first.pixels.data(), filter, flags);
+    tex.levels.resize(1);
+    while ((int)tex.levels.size() < tex.storageLevels && generator.Next()) {
+        TextureLevel level;
+        level.width = generator.Width();
+        level.height = generator.Height();
+        level.pixels.resize((size_t)level.width * level.height * tex.pixelSize);
+        generator.Store(level.pixels.data());
+        tex.levels.push_back(std::move(level));
+    }
+    tex.storageLevels = tex.levels.size();
+}
+
+bool DecodeImage(const char* path, int channels, TextureLevel &level) {
+    int w, h, nbC;
+    unsigned char *data = stbi_load(path, &w, &h, &nbC, channels);
+    if (data == NULL) {
+        fprintf(stderr, "ERROR::TEXTURE:: Could not load '%s': %s\n", path, stbi_failure_reason());
+        return false;
+    }
+    level.width = w;
+    level.height = h;
+    level.pixels.assign(data, data + (size_t)w * h * channels);
+    stbi_image_free(data);
+    return true;
+}
+
+// Path of a file derived from path and stored next to it
+std::string ReplaceExtension(const std::string &path, const char* extension) {
+    size_t dot = path.find_last_of('.');
+    size_t slash = path.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return path + extension;
+    return path.substr(0, dot) + extension;
+}
+
+// Path of the block compressed version of an image, stored next to it by texture_encoder
+std::string CompressedPath(const std::string &path) {
+    return ReplaceExtension(path, ".dds");
+}
+
+bool IsCompressedPath(const std::string &path) {
+    return path.size() >= 4 && (path.compare(path.size() - 4, 4, ".dds") == 0 || path.compare(path.size() - 4, 4, ".DDS") == 0);
+}
+
+bool FileExists(const std::string &path) {
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == NULL)
+        return false;
+    fclose(file);
+    return true;
+}
+
+// Reads a BC1, BC4, BC5 or BC7 DDS file (legacy FourCC or DX10 header) with its
+// stored mip levels, at most maxLevels of them
+bool DecodeDDS(const char* path, int maxLevels, TextureData &tex) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "ERROR::TEXTURE:: Could not open '%s'\n", path);
+        return false;
+    }
+
+    uint32_t header[32];    //magic, then the 124 bytes DDS_HEADER
+    uint32_t dx10[5] = {0};
+    bool valid = fread(header, sizeof(header), 1, file) == 1 && memcmp(header, "DDS ", 4) == 0 && header[1] == 124;
+    uint32_t fourCC = valid ? header[21] : 0;
+    if (valid && memcmp(&fourCC, "DX10", 4) == 0)
+        valid = fread(dx10, sizeof(dx10), 1, file) == 1;
+    if (!valid) {
+        fprintf(stderr, "ERROR::TEXTURE:: '%s' is not a DDS file\n", path);
+        fclose(file);
+        return false;
+    }
+
+    auto isFourCC = [fourCC](const char* code) { return memcmp(&fourCC, code, 4) == 0; };
+    uint32_t dxgiFormat = dx10[0];
+    if (isFourCC("DXT1") || dxgiFormat == 71) {
+        tex.internalFormat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        tex.blockSize = 8;
+    } else if (dxgiFormat == 72) {
+        tex.internalFormat = GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+        tex.blockSize = 8;
+    } else if (isFourCC("ATI1") || isFourCC("BC4U") || dxgiFormat == 80) {
+        tex.internalFormat = GL_COMPRESSED_RED_RGTC1;
+        tex.blockSize = 8;
+    } else if (isFourCC("ATI2") || isFourCC("BC5U") || dxgiFormat == 83) {
+        tex.internalFormat = GL_COMPRESSED_RG_RGTC2;
+        tex.blockSize = 16;
+    } else if (dxgiFormat == 98) {
+        tex.internalFormat = GL_COMPRESSED_RGBA_BPTC_UNORM;
+        tex.blockSize = 16;
+    } else if (dxgiFormat == 99) {
+        tex.internalFormat = GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;
+        tex.blockSize = 16;
+    } else {
+        fprintf(stderr, "ERROR::TEXTURE:: '%s' is not BC1, BC4, BC5 or BC7 compressed\n", path);
+        fclose(file);
+        return false;
+    }
+
+    int w = header[4];
+    int h = header[3];
+    int levels = std::min(std::max(1, (int)header[7]), MipLevelCount(w, h, maxLevels));
+    tex.storageLevels = levels;
+    tex.levels.resize(levels);
+    for (int l = 0; l < levels; l++) {
+        TextureLevel &level = tex.levels[l];
+        level.width = std::max(1, w >> l);
+        level.height = std::max(1, h >> l);
+        level.pixels.resize(LevelBytes(tex, level.width, level.height));
+        if (fread(level.pixels.data(), 1, level.pixels.size(), file) != level.pixels.size()) {
+            fprintf(stderr, "ERROR::TEXTURE:: '%s' is truncated\n", path);
+            fclose(file);
+            return false;
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+
+// Decodes textures on worker threads and uploads them on the GL thread through a
+// pixel buffer, at most uploadBudget bytes per Update(), so loading never stalls a frame.
+class TextureLoader {
+public:
+    // Runs on a worker, fills the textures to create; returns false if nothing should be created
+    typedef std::function<bool(std::vector<TextureData>&)> DecodeFunction;
+    // Runs on the GL thread once every level is uploaded, with one texture per TextureData (none on failure)
+    typedef std::function<void(const std::vector<GLuint>&)> ReadyFunction;
+
+    TextureLoader(size_t uploadBudget = 4 << 20);
+    ~TextureLoader();
+
+    // The textures are accounted for in the category of the memory tracker
+    void Load(DecodeFunction decode, ReadyFunction ready, const std::string &category = "Textures");
+    void Update();
+
+private:
+    struct Job {
+        DecodeFunction decode;
+        ReadyFunction ready;
+        std::string category;
+        bool decoded = false;
+        size_t decodedBytes = 0;    //held on the CPU until the upload is over
+        std::vector<TextureData> textures;
+        std::vector<GLuint> names;
+        size_t texture = 0;
+        size_t level = 0;
+        int row = 0;
+    };
+
+    void Worker();
+    void Create(Job &job);
+
+    std::vector<std::thread> _workers;
+    std::mutex _mutex;
+    std::condition_variable _signal;
+    std::deque<std::shared_ptr<Job>> _pending;
+    std::deque<std::shared_ptr<Job>> _decoded;
+    bool _quit = false;
+
+    std::deque<std::shared_ptr<Job>> _uploads;
+    GLuint _PBO = 0;
+    size_t _uploadBudget;
+};
+
+
+TextureLoader::TextureLoader(size_t uploadBudget) : _uploadBudget(uploadBudget) {
+    unsigned int count = std::min(4u, std::max(2u, std::thread::hardware_concurrency()) - 1);
+    for (unsigned int i = 0; i < count; i++)
+        _workers.push_back(std::thread(&TextureLoader::Worker, this));
+}
+
+TextureLoader::~TextureLoader() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _quit = true;
+    }
+    _signal.notify_all();
+    for (auto &worker : _workers)
+        worker.join();
+
+    MemoryTracker &memory = MemoryTracker::Instance();
+    for (auto &job : _decoded)
+        memory.Free("Decoded textures", job->decodedBytes);
+    for (auto &job : _uploads) {
+        memory.Free("Decoded textures", job->decodedBytes);
+        if (!job->names.empty()) {
+            memory.RemoveTextures(job->names.data(), job->names.size());
+            glDeleteTextures(job->names.size(), job->names.data());
+        }
+    }
+    if (_PBO != 0) {
+        memory.RemoveBuffers(&_PBO, 1);
+        glDeleteBuffers(1, &_PBO);
+    }
+}
+
+void TextureLoader::Load(DecodeFunction decode, ReadyFunction ready, const std::string &category) {
+    std::shared_ptr<Job> job(new Job());
+    job->decode = decode;
+    job->ready = ready;
+    job->category = category;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pending.push_back(job);
+    }
+    _signal.notify_one();
+}
+
+void TextureLoader::Worker() {
+    PROFILE_THREAD("Texture loader");
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (;;) {
+        _signal.wait(lock, [this] { return _quit || !_pending.empty(); });
+        if (_quit)
+            return;
+
+        std::shared_ptr<Job> job = _pending.front();
+        _pending.pop_front();
+        lock.unlock();
+
+        job->decoded = job->decode(job->textures);
+        job->decodedBytes = DecodedBytes(job->textures);
+        MemoryTracker::Instance().Allocate("Decoded textures", job->decodedBytes);
+
+        lock.lock();
+        _decoded.push_back(job);
+    }
+}
+
+void TextureLoader::Create(Job &job) {
+    job.names.resize(job.textures.size());
+    glGenTextures(job.names.size(), job.names.data());
+    for (size_t i = 0; i < job.textures.size(); i++) {
+        const TextureData &tex = job.textures[i];
+        GLenum target = tex.layers > 0 ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+        glBindTexture(target, job.names[i]);
+        if (tex.layers > 0)
+            glTexStorage3D(target, 1, tex.internalFormat, tex.levels[0].width, tex.levels[0].height, tex.layers);
+        else
+            glTexStorage2D(target, tex.storageLevels, tex.internalFormat, tex.levels[0].width, tex.levels[0].height);
+        glTexParameteri(target, GL_TEXTURE_WRAP_S, tex.wrapS);
+        glTexParameteri(target, GL_TEXTURE_WRAP_T, tex.wrapT);
+        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, tex.magFilter);
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, tex.minFilter);
+        if (tex.maxAniso > 0)
+            glTexParameterf(target, GL_TEXTURE_MAX_ANISOTROPY_EXT, tex.maxAniso);
+        if (tex.layers > 0)
+            MemoryTracker::Instance().AddTexture(job.category.c_str(), job.names[i], tex.internalFormat, tex.levels[0].width, tex.levels[0].height, 1, tex.layers);
+        else
+            MemoryTracker::Instance().AddTexture(job.category.c_str(), job.names[i], tex.internalFormat, tex.levels[0].width, tex.levels[0].height, tex.storageLevels);
+    }
+}
+
+void TextureLoader::Update() {
+    PROFILE_ZONE("TextureLoader::Update");
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        while (!_decoded.empty()) {
+            _uploads.push_back(_decoded.front());
+            _decoded.pop_front();
+        }
+    }
+    if (_uploads.empty())
+        return;
+
+    if (_PBO == 0)
+        glGenBuffers(1, &_PBO);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _PBO);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    std::vector<std::shared_ptr<Job>> finished;
+    size_t budget = _uploadBudget;
+    while (!_uploads.empty() && budget > 0) {
+        Job &job = *_uploads.front();
+
+        if (!job.decoded || job.textures.empty()) {
+            job.names.clear();
+            finished.push_back(_uploads.front());
+            _uploads.pop_front();
+            continue;
+        }
+        if (job.names.empty())
+            Create(job);
+
+        //Upload as many rows of the current level as the budget allows (rows of blocks when compressed)
+        TextureData &tex = job.textures[job.texture];
+        TextureLevel &level = tex.levels[job.level];
+        int rowHeight = tex.blockSize > 0 ? 4 : 1;
+        int rowCount = (level.height + rowHeight - 1) / rowHeight;
+        size_t rowSize = LevelBytes(tex, level.width, rowHeight);
+        int rows = std::min(rowCount - job.row, std::max(1, (int)(budget / rowSize)));
+        size_t bytes = rows * rowSize;
+
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+        MemoryTracker::Instance().AddBuffer("Staging buffers", _PBO, bytes);
+        void *staging = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (staging == NULL) {
+            //The slice stays queued and is uploaded again on the next Update
+            fprintf(stderr, "ERROR::TEXTURE:: Could not map the %zu byte staging buffer (%s texture)\n", bytes, job.category.c_str());
+            break;
+        }
+        memcpy(staging, level.pixels.data() + job.row * rowSize, bytes);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+        int y = job.row * rowHeight;
+        int height = std::min(rows * rowHeight, level.height - y);
+        glBindTexture(tex.layers > 0 ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D, job.names[job.texture]);
+        if (tex.layers > 0) //levels are layers
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, y, job.level, level.width, height, 1, tex.format, tex.type, 0);
+        else if (tex.blockSize > 0)
+            glCompressedTexSubImage2D(GL_TEXTURE_2D, job.level, 0, y, level.width, height, tex.internalFormat, bytes, 0);
+        else
+            glTexSubImage2D(GL_TEXTURE_2D, job.level, 0, y, level.width, height, tex.format, tex.type, 0);
+        budget -= std::min(budget, bytes);
+
+        job.row += rows;
+        if (job.row < rowCount)
+            continue;
+
+        job.row = 0;
+        std::vector<unsigned char>().swap(level.pixels);
+        if (++job.level < tex.levels.size())
+            continue;
+
+        job.level = 0;
+        if (++job.texture < job.textures.size())
+            continue;
+
+        finished.push_back(_uploads.front());
+        _uploads.pop_front();
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    for (auto &job : finished) {
+        MemoryTracker::Instance().Free("Decoded textures", job->decodedBytes);
+        job->ready(job->names);
+    }
+}
+
+
+
+// Shares the textures loaded for the same key (file and load parameters) between
+// its users, and deletes them when the last one releases its reference.
+class TextureRegistry {
+public:
+    TextureRegistry(TextureLoader &loader) : _loader(loader) {}
+    ~TextureRegistry();
+
+    // ready is called once the textures are resident, right away if they already are,
+    // or with no textures if loading failed (the reference is dropped then).
+    // Their memory is accounted for under the part of key before its first ':'
+    void Acquire(const std::string &key, TextureLoader::DecodeFunction decode, TextureLoader::ReadyFunction ready);
+    void Release(const std::string &key);
+
+    size_t ResidentBytes() const { return _residentBytes; }
+    size_t ResidentCount() const { return _entries.size(); }
+
+private:
+    struct Entry {
+        int references = 0;
+        bool requested = false;
+        bool loading = true;
+        std::vector<GLuint> names;
+        std::shared_ptr<size_t> bytes;
+        std::vector<TextureLoader::ReadyFunction> waiting;
+    };
+
+    void Loaded(const std::string &key, const std::vector<GLuint> &names);
+
+    TextureLoader &_loader;
+    std::map<std::string, Entry> _entries;
+    size_t _residentBytes = 0;
+};
+
+
+TextureRegistry::~TextureRegistry() {
+    for (auto &entry : _entries) {
+        if (!entry.second.names.empty()) {
+            MemoryTracker::Instance().RemoveTextures(entry.second.names.data(), entry.second.names.size());
+            glDeleteTextures(entry.second.names.size(), entry.second.names.data());
+        }
+    }
+}
+
+void TextureRegistry::Acquire(const std::string &key, TextureLoader::DecodeFunction decode, TextureLoader::ReadyFunction ready) {
+    Entry &entry = _entries[key];
+    entry.references++;
+    if (!entry.loading) {
+        ready(entry.names);
+        return;
+    }
+
+    entry.waiting.push_back(ready);
+    if (entry.requested)
+        return;
+
+    entry.requested = true;
+    entry.bytes = std::make_shared<size_t>(0);
+    std::shared_ptr<size_t> bytes = entry.bytes;
+    _loader.Load([decode, bytes](std::vector<TextureData> &textures) {
+        if (!decode(textures))
+            return false;
+        *bytes = TextureBytes(textures);
+        return true;
+    }, [this, key](const std::vector<GLuint> &names) {
+        Loaded(key, names);
+    }, "Textures: " + key.substr(0, key.find(':')));
+}
+
+void TextureRegistry::Loaded(const std::string &key, const std::vector<GLuint> &names) {
+    auto it = _entries.find(key);
+    std::vector<TextureLoader::ReadyFunction> waiting;
+    waiting.swap(it->second.waiting);
+
+    if (names.empty()) {
+        _entries.erase(it);
+    } else {
+        it->second.loading = false;
+        it->second.names = names;
+        _residentBytes += *it->second.bytes;
+        if (it->second.references == 0) {
+            //Everyone released it while it was loading
+            it->second.references = 1;
+            Release(key);
+            return;
+        }
+    }
+
+    for (auto &ready : waiting)
+        ready(names);
+}
+
+void TextureRegistry::Release(const std::string &key) {
+    auto it = _entries.find(key);
+    if (it == _entries.end())
+        return;
+
+    Entry &entry = it->second;
+    if (--entry.references > 0 || entry.loading)
+        return;
+
+    MemoryTracker::Instance().RemoveTextures(entry.names.data(), entry.names.size());
+    glDeleteTextures(entry.names.size(), entry.names.data());
+    _residentBytes -= *entry.bytes;
+    _entries.erase(it);
+}
+
+#endif